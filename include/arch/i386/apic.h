@@ -0,0 +1,148 @@
+#ifndef _KERNEL_APIC_H_
+#define _KERNEL_APIC_H_
+
+#include <asm.h>
+#include <libk/virt_mem.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * The Advanced Programmable Interrupt Controller replaces the pair of 8259
+ * PICs. It has two halves:
+ * - Every CPU has a Local APIC. It accepts interrupts for its CPU, and is told
+ *   that one has been handled (EOI) with a single store to a memory mapped
+ *   register instead of the 8259's slow port I/O.
+ * - The IO-APIC receives the device interrupt lines. Its redirection table
+ *   says, for every input pin, which vector to raise on which Local APIC.
+ *
+ * Legacy ISA IRQ n is routed to vector 32+n, the same vectors the remapped
+ * PIC uses, so handlers do not care which controller is active. The PIC is
+ * still remapped at boot and then fully masked, so a stray 8259 interrupt
+ * cannot land on an exception vector.
+ *
+ * The kernel falls back to the PIC when the CPU has no APIC or when booted
+ * with "noapic" on the command line. APIC::eoi, maskIrq and unmaskIrq work
+ * with whichever controller is in use.
+ */
+
+/* Local APIC register offsets */
+#define LAPIC_ID            0x020
+#define LAPIC_VERSION       0x030
+#define LAPIC_TPR           0x080   /* Task priority */
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0   /* Spurious interrupt vector */
+#define LAPIC_ESR           0x280   /* Error status */
+#define LAPIC_ICR_LOW       0x300   /* Interrupt command */
+#define LAPIC_ICR_HIGH      0x310
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_LVT_LINT0     0x350
+#define LAPIC_LVT_LINT1     0x360
+#define LAPIC_LVT_ERROR     0x370
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+#define LAPIC_SVR_ENABLE    0x100
+#define LAPIC_LVT_MASKED    0x10000
+
+/* LAPIC_ICR_LOW fields */
+#define LAPIC_ICR_FIXED     0x00000
+#define LAPIC_ICR_INIT      0x00500
+#define LAPIC_ICR_STARTUP   0x00600
+#define LAPIC_ICR_PENDING   0x01000     /* Delivery status: not sent yet */
+#define LAPIC_ICR_ASSERT    0x04000
+#define LAPIC_ICR_LEVEL     0x08000
+#define LAPIC_ICR_SEND_SPINS 100000     /* Polls of the delivery status before giving up */
+
+/* IO-APIC registers, reached through the IOREGSEL/IOWIN window */
+#define IOAPIC_IOREGSEL     0x00
+#define IOAPIC_IOWIN        0x10
+#define IOAPIC_REG_ID       0x00
+#define IOAPIC_REG_VERSION  0x01
+#define IOAPIC_REG_REDTBL   0x10    /* Two registers per pin */
+
+#define IOAPIC_REDIR_LEVEL      (1 << 15)
+#define IOAPIC_REDIR_ACTIVE_LOW (1 << 13)
+#define IOAPIC_REDIR_MASKED     (1 << 16)
+
+#define APIC_MSR_BASE           0x1B
+#define APIC_MSR_BASE_ENABLE    (1 << 11)
+#define APIC_CPUID_FEATURE      (1 << 9)    /* CPUID.1:EDX */
+
+#define APIC_DEFAULT_IOAPIC_ADDR 0xFEC00000
+#define APIC_SPURIOUS_VECTOR    0xFF
+#define APIC_ISA_IRQS           16
+#define APIC_IRQ_BASE_VECTOR    32
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+class APIC {
+    private:
+        static bool enabled;
+        static volatile uint32_t *lapic;
+        static volatile uint32_t *ioapic;
+        static physical_addr ioapicPhys;
+        static uint8_t ioapicPins;
+        /* Global system interrupt (IO-APIC pin) each ISA IRQ is wired to. */
+        static uint8_t irqToGsi[APIC_ISA_IRQS];
+
+        static uint32_t ioapicRead(uint8_t reg);
+        static void ioapicWrite(uint8_t reg, uint32_t value);
+        static void maskPic();
+        static void setPicMask(uint8_t irq, bool masked);
+    public:
+        /*
+         * Switches interrupt delivery to the APIC if the CPU has one and
+         * 'use_apic' is set. Otherwise the PIC stays in charge.
+         * @return true if the APIC is now in use.
+         */
+        static bool init(VirtualMemoryManager *vmm, bool use_apic);
+        /*
+         * Software-enables the Local APIC of the calling CPU. init() does it
+         * for the boot CPU, every other CPU calls it when it starts.
+         */
+        static void initCpu();
+        static bool isEnabled() { return enabled; }
+
+        /* Signals the end of the interrupt raised on 'idt_index'. */
+        static void eoi(uint32_t idt_index) {
+            if (enabled) {
+                lapic[LAPIC_EOI / 4] = 0;
+                return;
+            }
+            // The slave PIC needs an EOI for its own lines, the master always does.
+            if (idt_index >= APIC_IRQ_BASE_VECTOR + 8)
+                outb(0xA0, 0x20);
+            outb(0x20, 0x20);
+        }
+
+        /* Direct Local APIC register access. Only valid once isEnabled(). */
+        static uint32_t lapicRead(uint32_t reg) { return lapic[reg / 4]; }
+        static void lapicWrite(uint32_t reg, uint32_t value) { lapic[reg / 4] = value; }
+        static uint8_t lapicId() { return enabled ? lapicRead(LAPIC_ID) >> 24 : 0; }
+
+        /*
+         * Sends an inter-processor interrupt to the CPU whose Local APIC id is
+         * 'apic_id'. 'command' holds the LAPIC_ICR_LOW delivery mode and vector.
+         * @return true once the Local APIC has sent it.
+         */
+        static bool sendIpi(uint8_t apic_id, uint32_t command);
+
+        /* Records that ISA 'irq' is wired to IO-APIC input 'gsi'. Call before init. */
+        static void setIrqOverride(uint8_t irq, uint8_t gsi);
+        /* Uses the IO-APIC at 'paddr' instead of the usual one. Call before init. */
+        static void setIoapicAddress(physical_addr paddr) { ioapicPhys = paddr; }
+        /* Sends ISA 'irq' to 'vector' on the CPU whose Local APIC id is 'apic_id'. */
+        static bool routeIrq(uint8_t irq, uint8_t vector, uint8_t apic_id);
+        static void maskIrq(uint8_t irq);
+        static void unmaskIrq(uint8_t irq);
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _KERNEL_APIC_H_
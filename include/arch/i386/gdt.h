@@ -1,17 +1,67 @@
 #ifndef _KERNEL_GDT_H_
 #define _KERNEL_GDT_H_
 
+#include <stdint.h>
+
 /*       Pr   R 1 E D/C RW A */
 /* Code: 1  000 1 1 0   1  0 --> 0x9A*/
 /* Data: 1  000 1 0 0   1  0 --> 0x92*/
 #define CODE_SELECTOR 0x9A
 #define DATA_SELECTOR 0x92
+/* Same with ring level 3 */
+#define USER_CODE_SELECTOR 0xFA
+#define USER_DATA_SELECTOR 0xF2
+/*       Pr   R 0 Type (32 bit available TSS) */
+/* TSS:  1  000 0 1001 --> 0x89*/
+#define TSS_SELECTOR 0x89
 
 /*                   G D 0 A SegLen */
 /* Flat-Model Priv:  1 1 0 1   1111 --> 0xCF*/
 #define FLATMODEL_GRAN  0xCF
 
+/*
+ * Offsets of the descriptors in the GDT, with the requested privilege level
+ * in the low bits. SYSENTER/SYSEXIT require this exact order: kernel code,
+ * kernel data, user code, user data.
+ */
+#define KERNEL_CODE_SEGMENT 0x08
+#define KERNEL_DATA_SEGMENT 0x10
+#define USER_CODE_SEGMENT   0x1B
+#define USER_DATA_SEGMENT   0x23
+#define TSS_SEGMENT         0x28
+#define PERCPU_SEGMENT      0x30    /* gs, see percpu.h */
+
+/* Number of CPUs with a GDT and TSS of their own, see smp.h */
+#define GDT_MAX_CPUS        16
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
 /* Sets up the GDT, should be called on early initialization */
 void gdt_install();
 
-#endif  // _KERNEL_GDT_H_
\ No newline at end of file
+/*
+ * Builds the GDT and TSS of 'cpu' and loads them on the calling CPU. 'esp0'
+ * is the stack it enters ring 0 on. gdt_install does this for CPU 0.
+ */
+void gdt_install_cpu(uint32_t cpu, uint32_t esp0);
+
+/*
+ * Points the per-CPU segment of 'cpu' at 'base' and reloads gs. Must run on
+ * that CPU.
+ */
+void gdt_set_percpu_base(uint32_t cpu, uint32_t base);
+
+/*
+ * Sets the stack 'cpu' switches to when an interrupt or a system call arrives
+ * while running in ring 3.
+ */
+void gdt_set_kernel_stack(uint32_t cpu, uint32_t esp0);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _KERNEL_GDT_H_
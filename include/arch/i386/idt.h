@@ -35,7 +35,22 @@
  * 19-31 - Reserved
  */
 
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
 /* Sets up the IDT, should be called on early initialization */
 void idt_install();
 
+/* Loads the IDT built by idt_install on the calling CPU. */
+void idt_load_cpu();
+
+/* Points IDT entry 'num' at 'handler'. 'flags' holds the gate type. */
+void set_idt_entry(uint8_t num, uint64_t handler, uint16_t sel, uint8_t flags);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif  // _KERNEL_IDT_H_
\ No newline at end of file
@@ -0,0 +1,64 @@
+#ifndef _KERNEL_INTERRUPT_STATS_H_
+#define _KERNEL_INTERRUPT_STATS_H_
+
+#include <arch/i386/idt.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Per-vector interrupt statistics.
+ *
+ * The interrupt stub reads the TSC right after saving the registers and the
+ * dispatcher reads it again once the handler and the EOI are done. The
+ * difference, in cycles, is recorded for the vector: how often it fired, how
+ * long it took in total and at worst, and a log2 histogram (bucket n counts
+ * interrupts that took [2^n, 2^(n+1)) cycles). Deferred work that runs on the
+ * way out is not included, it runs with interrupts enabled.
+ *
+ * Every CPU counts into its own per-CPU copy, so recording never touches a
+ * cache line another CPU writes. snapshot() and dump() add up all CPUs.
+ *
+ * A storming device shows up as a high count, a slow handler as a long tail
+ * in its histogram. dump() prints every vector that fired to the serial port:
+ *
+ *   # openos interrupt stats v1
+ *   V <vector> count <n> cycles <total> max <max> hist <bucket>:<n> ...
+ *   # end
+ */
+
+#define INTERRUPT_STATS_BUCKETS 24  // The last bucket also holds everything slower
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+    uint32_t histogram[INTERRUPT_STATS_BUCKETS];
+} interrupt_vector_stats_t;
+
+class InterruptStats {
+    public:
+        /*
+         * Accounts one interrupt on 'vector' that took 'cycles', on the
+         * current CPU. Interrupts must be off.
+         */
+        static void record(uint32_t vector, uint64_t cycles);
+        /*
+         * Stores the statistics of 'vector', summed over every CPU, in 'out'.
+         * Safe with interrupts on.
+         */
+        static void snapshot(uint32_t vector, interrupt_vector_stats_t *out);
+        /* Clears every vector on every CPU. */
+        static void reset();
+        /* Writes every vector that fired to the serial port. */
+        static void dump();
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _KERNEL_INTERRUPT_STATS_H_
@@ -5,6 +5,8 @@
 #include <string.h>
 #include <stddef.h>
 #include <arch/i386/idt.h>
+#include <libk/rcu.h>
+#include <libk/spinlock.h>
 
 #define TIMER_IDT_INDEX 32
 #define KEYBOARD_IDT_INDEX 33
@@ -23,19 +25,97 @@ struct regs {
   uint32_t eip, cs, eflags, useresp, ss;            /* pushed automatically by CPU */
 };
 
-typedef void (*interrupt_handler_t)(struct regs* r);
+/* Number of vectors reserved for CPU exceptions */
+#define EXCEPTION_NUM_ENTRIES 32
+/* Vectors of the 16 legacy IRQs, see APIC_IRQ_BASE_VECTOR */
+#define IRQ_FIRST_IDT_INDEX 32
+#define IRQ_LAST_IDT_INDEX 47
+/* Handlers that can be registered at once, over all vectors */
+#define INTERRUPT_MAX_ACTIONS 64
 
+/* What an interrupt handler tells the dispatcher. */
+enum interrupt_result {
+  INTERRUPT_NOT_HANDLED = 0,  /* Not my device, try the next handler */
+  INTERRUPT_HANDLED = 1
+};
+
+typedef void (*exception_handler_t)(struct regs* r);
+typedef interrupt_result (*interrupt_handler_t)(struct regs* r, void* data);
+typedef void (*interrupt_dispatch_t)(struct regs* r);
+
+/* One handler on the chain of a vector. */
+struct interrupt_action {
+  interrupt_handler_t handler;
+  void* data;                 /* Passed back to the handler */
+  interrupt_action* next;
+  struct rcu_head rcu;        /* Back to the pool after a grace period */
+};
+
+/*
+ * Several devices may share one interrupt line, so every vector has a chain
+ * of handlers. Each handler checks whether its device raised the interrupt
+ * and says so. All handlers on the chain run, an edge-triggered line may
+ * have been raised by more than one device. An interrupt nobody claims is
+ * counted as unhandled.
+ *
+ * Every vector also has its own dispatch function, chosen whenever its chain
+ * changes: exceptions, an IRQ with no, one or several handlers, and other
+ * vectors with no, one or several handlers. runInterruptHandler makes one
+ * indirect call through that table instead of checking ranges on every
+ * interrupt.
+ *
+ * The chains are read under RCU: a handler runs with interrupts disabled,
+ * which is a read-side section, and takes no lock. Changes are serialized by
+ * chainLock and published with rcu_assign_pointer, the chain first and the
+ * dispatch function after it. A removed link goes back to the pool only after
+ * a grace period, so a CPU still walking it finds its 'next' intact.
+ */
 class InterruptHandler {
   private:
-    /* Hold upto 256 interrupt handlers. */
-    static interrupt_handler_t interrupt_handlers[IDT_NUM_ENTRIES];
-    static void fault_handler(struct regs *r);
-    static void irq_handler(struct regs *r);
+    static exception_handler_t exception_handlers[EXCEPTION_NUM_ENTRIES];
+    /* Handler chain of every vector, in registration order */
+    static interrupt_action* chains[IDT_NUM_ENTRIES];
+    /* Entry path of every vector. Filled by the constructor. */
+    static interrupt_dispatch_t dispatch[IDT_NUM_ENTRIES];
+    /* Interrupts no handler claimed, per vector */
+    static uint32_t unhandled[IDT_NUM_ENTRIES];
+    /* Chain links are taken from here, the heap may not exist yet */
+    static interrupt_action actionPool[INTERRUPT_MAX_ACTIONS];
+    static interrupt_action* freeActions;
+    static spinlock_t chainLock;
+
+    /* Picks the dispatch function matching the chain of 'idt_index'. */
+    static void updateDispatch(uint32_t idt_index);
+    static bool runChain(struct regs* r);
+    static void releaseAction(struct rcu_head* head);
+
+    static void dispatchException(struct regs* r);
+    static void dispatchFatal(struct regs* r);
+    static void dispatchIrqNone(struct regs* r);
+    static void dispatchIrqSingle(struct regs* r);
+    static void dispatchIrqShared(struct regs* r);
+    static void dispatchNone(struct regs* r);
+    static void dispatchSingle(struct regs* r);
+    static void dispatchShared(struct regs* r);
   public:
     InterruptHandler();
-    static void runInterruptHandler(struct regs* r);
+    static void runInterruptHandler(struct regs* r) { dispatch[r->idt_index](r); }
+    /* Installs the handler for CPU exception 'idt_index'. There is only one. */
+    static bool register_exception_handler(uint32_t idt_index,
+                              exception_handler_t handler);
+    /*
+     * Adds 'handler' to the end of the chain of 'idt_index'. The same
+     * handler may be added again with different 'data'.
+     */
     static bool register_interrupt_handler(uint32_t idt_index,
-	                            interrupt_handler_t handler);
+	                            interrupt_handler_t handler, void* data = 0);
+    /* Removes the handler added with the same 'handler' and 'data'. */
+    static bool unregister_interrupt_handler(uint32_t idt_index,
+	                            interrupt_handler_t handler, void* data = 0);
+    /* Interrupts on 'idt_index' that no handler claimed */
+    static uint32_t get_unhandled_count(uint32_t idt_index) {
+      return idt_index < IDT_NUM_ENTRIES ? unhandled[idt_index] : 0;
+    }
   protected:
     static void divideByZeroExceptionHandler(struct regs* r);
     static void debugExceptionHandler(struct regs* r);                      /* Trap  */
@@ -58,7 +138,11 @@ class InterruptHandler {
     static void machineCheckExceptionHandler(struct regs* r);               /* Abort */
 };
 
-void run_interrupt_handler(struct regs* r);
+/*
+ * Entry point from the assembly stubs.
+ * @param entry_tsc The TSC read by the stub right after saving the registers.
+ */
+void run_interrupt_handler(struct regs* r, uint64_t entry_tsc);
 
 #ifdef __cplusplus
 }
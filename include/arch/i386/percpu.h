@@ -0,0 +1,120 @@
+#ifndef _KERNEL_PERCPU_H_
+#define _KERNEL_PERCPU_H_
+
+#include <arch/i386/gdt.h>
+#include <arch/i386/smp.h>
+#include <libk/cache.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Per-CPU variables.
+ *
+ * DEFINE_PER_CPU puts a variable in the .data.percpu section. The linker
+ * gathers them into a template that is never written to, and every CPU works
+ * on its own copy: the boot CPU's is reserved in .bss by the linker script,
+ * the others are allocated before their CPU starts.
+ *
+ * gs points at the copy. Each CPU's GDT has a PERCPU_SEGMENT whose base is
+ * the distance from the template to that CPU's copy, so '%gs:var' reaches the
+ * CPU's own var. The selector is the same everywhere, the interrupt and
+ * system call stubs just load it.
+ *
+ *     DEFINE_PER_CPU(uint32_t, wakeups);
+ *     this_cpu_inc(wakeups);                  // incl %gs:per_cpu__wakeups
+ *
+ * this_cpu_read/write/add/inc/dec are a single instruction each, so an interrupt
+ * on the same CPU sees them whole, and no lock is needed: no other CPU writes
+ * there. They work on 1, 2 and 4 byte variables, anything else fails to link.
+ * this_cpu_ptr gives the address of the current CPU's copy of anything else;
+ * the thread must not move to another CPU while it uses the pointer, keep
+ * interrupts or preemption off around it. per_cpu(var, cpu) reaches the copy
+ * of another CPU, e.g. to add up counters.
+ *
+ * Copies are taken of the template as it was linked, so per-CPU variables
+ * must be initialized statically, without constructors.
+ */
+
+#define PERCPU_SECTION __attribute__((section(".data.percpu")))
+
+#define DEFINE_PER_CPU(type, name) \
+    PERCPU_SECTION __typeof__(type) per_cpu__##name
+#define DECLARE_PER_CPU(type, name) \
+    extern __typeof__(type) per_cpu__##name
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Never defined: a per-CPU access of an unsupported size fails to link. */
+void __bad_percpu_size(void);
+
+/* Bounds of the template and the boot CPU's copy, see linker.ld */
+extern uint8_t __per_cpu_start[];
+extern uint8_t __per_cpu_end[];
+extern uint8_t __per_cpu_boot[];
+
+#define percpu_from_op(var) ({                                              \
+    __typeof__(var) ret__;                                                  \
+    switch (sizeof(var)) {                                                  \
+        case 1: asm volatile("movb %%gs:%1, %0" : "=q"(ret__) : "m"(var)); break; \
+        case 2: asm volatile("movw %%gs:%1, %0" : "=r"(ret__) : "m"(var)); break; \
+        case 4: asm volatile("movl %%gs:%1, %0" : "=r"(ret__) : "m"(var)); break; \
+        default: __bad_percpu_size();                                       \
+    }                                                                       \
+    ret__;                                                                  \
+})
+
+#define percpu_to_op(op, var, val) do {                                     \
+    __typeof__(var) val__ = (val);                                          \
+    switch (sizeof(var)) {                                                  \
+        case 1: asm volatile(op "b %1, %%gs:%0" : "+m"(var) : "qi"(val__)); break; \
+        case 2: asm volatile(op "w %1, %%gs:%0" : "+m"(var) : "ri"(val__)); break; \
+        case 4: asm volatile(op "l %1, %%gs:%0" : "+m"(var) : "ri"(val__)); break; \
+        default: __bad_percpu_size();                                       \
+    }                                                                       \
+} while (0)
+
+#define this_cpu_read(name)         percpu_from_op(per_cpu__##name)
+#define this_cpu_write(name, val)   percpu_to_op("mov", per_cpu__##name, val)
+#define this_cpu_add(name, val)     percpu_to_op("add", per_cpu__##name, val)
+#define this_cpu_inc(name)          this_cpu_add(name, 1)
+#define this_cpu_dec(name)          this_cpu_add(name, -1)
+
+#define this_cpu_ptr(name) \
+    ((__typeof__(per_cpu__##name) *)((uint32_t)&per_cpu__##name + this_cpu_read(this_cpu_off)))
+#define per_cpu(name, cpu) \
+    (*(__typeof__(per_cpu__##name) *)((uint32_t)&per_cpu__##name + PerCpu::getOffset(cpu)))
+
+/* Every CPU's index and the base of its gs segment, in its own copy */
+DECLARE_PER_CPU(uint32_t, cpu_number);
+DECLARE_PER_CPU(uint32_t, this_cpu_off);
+
+class PerCpu {
+    private:
+        /* Distance from the template to each CPU's copy */
+        static uint32_t offsets[SMP_MAX_CPUS];
+
+        static void fill(uint8_t *copy, uint32_t cpu);
+    public:
+        /* Sets up the boot CPU's copy and loads gs. Call right after gdt_install. */
+        static void initBoot();
+        /* Makes the copy of another CPU, before it starts. */
+        static bool allocate(uint32_t cpu);
+        /* Loads the copy of 'cpu' into gs. Must run on that CPU. */
+        static void load(uint32_t cpu) { gdt_set_percpu_base(cpu, offsets[cpu]); }
+
+        static uint32_t getOffset(uint32_t cpu) { return offsets[cpu]; }
+        /* True once 'cpu' has a copy. No copy is ever the template itself. */
+        static bool hasArea(uint32_t cpu) { return cpu < SMP_MAX_CPUS && offsets[cpu] != 0; }
+        static uint32_t getSize() { return __per_cpu_end - __per_cpu_start; }
+        /* Index of the CPU this runs on, as in SMP::getCpu */
+        static uint32_t currentCpu() { return this_cpu_read(cpu_number); }
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _KERNEL_PERCPU_H_
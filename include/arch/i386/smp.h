@@ -0,0 +1,292 @@
+#ifndef _KERNEL_SMP_H_
+#define _KERNEL_SMP_H_
+
+#include <arch/i386/gdt.h>
+#include <libk/virt_mem.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Multiprocessor bring-up.
+ *
+ * The firmware starts one CPU, the bootstrap processor (BSP). The others,
+ * the application processors (APs), wait for an INIT-SIPI-SIPI sequence from
+ * its Local APIC. The startup IPI makes an AP begin in real mode at a page
+ * below 1MB, so a small trampoline (smp_asm.S) is copied to
+ * SMP_TRAMPOLINE_PADDR. It loads a flat GDT, enables protected mode and
+ * paging with the kernel's page directory, switches to the stack the BSP
+ * allocated for it and calls smp_ap_main in the higher half.
+ *
+ * The CPUs are found in the ACPI MADT, or in the older MP table when there is
+ * no ACPI. The same tables say where the IO-APIC is and how ISA IRQs are
+ * wired to it, which APIC::init needs, so they are read before it runs.
+ *
+ * Every AP gets its own GDT, TSS and per-CPU area (percpu.h), loads the
+ * shared IDT, enables its Local APIC and becomes the idle thread of its own
+ * run queue (thread.h). Its idle loop runs or steals threads while there are
+ * any, and otherwise takes work one call at a time through its mailbox:
+ * call() fills it in and wakes the AP with SMP_CALL_VECTOR.
+ * Interrupts from devices keep going to the BSP.
+ *
+ * APs are started one at a time, since they share the trampoline. Booting
+ * with "nosmp" leaves them asleep.
+ */
+
+#define SMP_MAX_CPUS            GDT_MAX_CPUS
+#define SMP_AP_STACK_SIZE       16384
+#define SMP_CALL_VECTOR         0xF0
+
+/* Delays of the INIT-SIPI-SIPI sequence, from the MP specification */
+#define SMP_INIT_DELAY_US       10000
+#define SMP_SIPI_DELAY_US       200
+/* How long a started AP has to report in */
+#define SMP_AP_TIMEOUT_US       100000
+
+/* ACPI Root System Description Pointer and MP floating pointer search areas */
+#define SMP_EBDA_SEGMENT_PTR    0x40E
+#define SMP_EBDA_SEARCH_LEN     1024
+#define SMP_BIOS_ROM_START      0xE0000
+#define SMP_BIOS_ROM_END        0x100000
+#define SMP_ACPI_MAX_TABLES     64  // RSDT entries looked at
+
+/* MADT entry types */
+#define MADT_LAPIC              0
+#define MADT_IOAPIC             1
+#define MADT_ISO                2   /* Interrupt source override */
+#define MADT_LAPIC_ENABLED      (1 << 0)
+#define MADT_LAPIC_ONLINE_CAPABLE (1 << 1)
+
+/* MP configuration table entry types */
+#define MP_ENTRY_PROCESSOR      0
+#define MP_ENTRY_BUS            1
+#define MP_ENTRY_IOAPIC         2
+#define MP_ENTRY_IO_INTERRUPT   3
+#define MP_PROCESSOR_ENABLED    (1 << 0)
+#define MP_IOAPIC_ENABLED       (1 << 0)
+#define MP_MAX_BUSES            32
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* ACPI structures, packed as the firmware lays them out */
+struct acpi_rsdp {
+    char signature[8];          /* "RSD PTR " */
+    uint8_t checksum;
+    char oemId[6];
+    uint8_t revision;
+    uint32_t rsdtAddress;
+} __attribute__((packed));
+
+struct acpi_header {
+    char signature[4];
+    uint32_t length;            /* Of the whole table, header included */
+    uint8_t revision;
+    uint8_t checksum;
+    char oemId[6];
+    char oemTableId[8];
+    uint32_t oemRevision;
+    uint32_t creatorId;
+    uint32_t creatorRevision;
+} __attribute__((packed));
+
+struct acpi_madt {
+    struct acpi_header header;  /* "APIC" */
+    uint32_t lapicAddress;
+    uint32_t flags;
+} __attribute__((packed));
+
+struct madt_entry {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed));
+
+struct madt_lapic {
+    struct madt_entry entry;
+    uint8_t acpiId;
+    uint8_t apicId;
+    uint32_t flags;
+} __attribute__((packed));
+
+struct madt_ioapic {
+    struct madt_entry entry;
+    uint8_t ioapicId;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsiBase;
+} __attribute__((packed));
+
+struct madt_iso {
+    struct madt_entry entry;
+    uint8_t bus;
+    uint8_t source;             /* ISA IRQ */
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__((packed));
+
+/* MP specification structures */
+struct mp_floating {
+    char signature[4];          /* "_MP_" */
+    uint32_t configAddress;
+    uint8_t length;             /* In 16 byte units */
+    uint8_t revision;
+    uint8_t checksum;
+    uint8_t features[5];
+} __attribute__((packed));
+
+struct mp_config {
+    char signature[4];          /* "PCMP" */
+    uint16_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oemId[8];
+    char productId[12];
+    uint32_t oemTable;
+    uint16_t oemTableSize;
+    uint16_t entryCount;
+    uint32_t lapicAddress;
+    uint16_t extendedLength;
+    uint8_t extendedChecksum;
+    uint8_t reserved;
+} __attribute__((packed));
+
+struct mp_processor {
+    uint8_t type;
+    uint8_t apicId;
+    uint8_t apicVersion;
+    uint8_t flags;
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} __attribute__((packed));
+
+struct mp_bus {
+    uint8_t type;
+    uint8_t busId;
+    char busType[6];            /* "ISA   ", "PCI   ", ... */
+} __attribute__((packed));
+
+struct mp_ioapic {
+    uint8_t type;
+    uint8_t apicId;
+    uint8_t apicVersion;
+    uint8_t flags;
+    uint32_t address;
+} __attribute__((packed));
+
+struct mp_io_interrupt {
+    uint8_t type;
+    uint8_t interruptType;      /* 0: vectored through the IO-APIC */
+    uint16_t flags;
+    uint8_t sourceBus;
+    uint8_t sourceIrq;
+    uint8_t destApic;
+    uint8_t destPin;
+} __attribute__((packed));
+
+/*
+ * Filled in by the BSP before each startup IPI, read by the trampoline. The
+ * layout must match smp_trampoline_data in smp_asm.S.
+ */
+struct smp_trampoline_params {
+    uint16_t gdtLimit;          /* lgdt operand */
+    uint32_t gdtBase;
+    uint32_t protectedEntry;    /* ljmp operand: 32 bit code, and its selector */
+    uint16_t codeSelector;
+    uint32_t cr3;               /* Kernel page directory */
+    uint32_t cr4;
+    uint32_t stack;             /* Top of the AP's stack */
+    uint32_t cpu;               /* Passed to smp_ap_main */
+} __attribute__((packed));
+
+typedef void (*smp_call_t)(void *arg);
+
+struct cpu_info {
+    uint8_t apicId;
+    volatile bool online;
+    uint8_t *stack;             /* Lowest address of its stack, 0 for the BSP */
+    /* Mailbox, see SMP::call */
+    volatile uint32_t busy;
+    smp_call_t volatile func;
+    void *volatile arg;
+    volatile uint32_t calls;    /* Calls it has run */
+};
+
+class SMP {
+    private:
+        static cpu_info cpus[SMP_MAX_CPUS];
+        static uint32_t cpuCount;
+        static volatile uint32_t onlineCount;
+        static VirtualMemoryManager *vmm;
+
+        /*
+         * Makes 'length' bytes of the table at 'paddr' readable. Tables above
+         * the first MB go through the SMP_TABLE_VIRT_ADDR window, which the
+         * next call reuses. @return 0 if the table is too big for the window.
+         */
+        static const void *mapTable(physical_addr paddr, uint32_t length);
+        /* True if the bytes of a firmware table add up to 0 */
+        static bool checksumOk(const void *table, uint32_t length);
+        /* Finds 'length' bytes starting with 'signature' on a 16 byte boundary. */
+        static physical_addr scan(physical_addr start, physical_addr end,
+                                  const char *signature, uint32_t length);
+        /* scan() through the places the firmware leaves its tables. */
+        static physical_addr findInBios(const char *signature, uint32_t length);
+        static bool parseMadt(physical_addr rsdt);
+        static bool parseMpTable(physical_addr floating);
+        static void addCpu(uint8_t apic_id);
+
+        static void delayUs(uint32_t us);
+        static void installTrampoline();
+        static bool startAp(uint32_t cpu);
+        static void apIdle(cpu_info *self) __attribute__((noreturn));
+    public:
+        /*
+         * Finds the CPUs and the interrupt routing in the firmware tables and
+         * passes the routing on to the APIC. Call before APIC::init.
+         */
+        static void detect(VirtualMemoryManager *vmm);
+        /*
+         * Starts every AP found by detect(). Needs the APIC, the heap and the
+         * ClockSource. @return the number of CPUs online, the BSP included.
+         */
+        static uint32_t bootAps();
+        /* First C++ code run by an AP, called by the trampoline. */
+        static void apMain(uint32_t cpu) __attribute__((noreturn));
+        /*
+         * Runs func(arg) on the AP 'cpu' from its idle loop, i.e. once it
+         * has no thread to run, with interrupts enabled. Returns without
+         * waiting for it.
+         * @return false if the CPU is offline or still busy with a call.
+         */
+        static bool call(uint32_t cpu, smp_call_t func, void *arg);
+        /*
+         * Wakes 'cpu' from hlt, without a call, e.g. to run a thread queued
+         * for it. Does nothing if it is offline.
+         */
+        static void kick(uint32_t cpu);
+        /* Acknowledges SMP_CALL_VECTOR, see smp_call_entry. */
+        static void callInterrupt();
+
+        static uint32_t getCpuCount() { return cpuCount; }
+        static uint32_t getOnlineCount() { return onlineCount; }
+        static bool isOnline(uint32_t cpu) { return cpu < cpuCount && cpus[cpu].online; }
+        static const cpu_info *getCpu(uint32_t cpu) { return cpu < cpuCount ? &cpus[cpu] : 0; }
+};
+
+/* Entry points from the assembly, see smp_asm.S */
+void smp_ap_main(uint32_t cpu) __attribute__((noreturn));
+void smp_call_interrupt(void);
+void smp_call_entry(void);
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_gdt[];
+extern uint8_t smp_trampoline_data[];
+extern uint8_t smp_trampoline_protected[];
+extern uint8_t smp_trampoline_end[];
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _KERNEL_SMP_H_
@@ -0,0 +1,112 @@
+#ifndef _KERNEL_SYSCALL_H_
+#define _KERNEL_SYSCALL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * System calls.
+ *
+ * The call number goes in eax and up to five arguments in ebx, ecx, edx, esi
+ * and edi. The result comes back in eax, a negative value is an error
+ * (-SYSCALL_ENOSYS for an unknown number).
+ *
+ * There are two ways in:
+ * - 'int $0x80' works on every CPU. It is a trap gate, so the call runs with
+ *   interrupts enabled, and its stub only saves the registers a system call
+ *   can see: no segment reloads, no interrupt statistics, no deferred work.
+ * - SYSENTER, if CPUID says the CPU has it. It skips the IDT and the stack
+ *   frame of an interrupt entirely. SYSEXIT returns to the eip in edx with
+ *   the esp in ecx, so the caller has to tell the kernel where to go back:
+ *
+ *       push %ebp
+ *       push $1f           # Return address
+ *       mov  %esp, %ebp    # The kernel finds both through ebp
+ *       sysenter
+ *   1:                     # ebp and esp are back, ecx and edx are clobbered
+ *
+ * All data segments are flat, so the kernel runs a system call on the user's
+ * ds/es instead of saving and reloading them.
+ */
+
+#define SYSCALL_MAX 64      // Size of the system call table
+
+/* System call numbers */
+#define SYSCALL_NOP     0   // Does nothing, measures the round trip
+#define SYSCALL_WRITE   1   // write(const char* buf, size_t len) to the terminal
+#define SYSCALL_UPTIME  2   // Timer ticks since boot
+
+/* Returned (negated) for numbers without a handler */
+#define SYSCALL_ENOSYS  38
+
+/* SYSENTER model specific registers */
+#define MSR_SYSENTER_CS     0x174
+#define MSR_SYSENTER_ESP    0x175
+#define MSR_SYSENTER_EIP    0x176
+
+#define SYSCALL_CPUID_SEP   (1 << 11)   /* CPUID.1:EDX */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* The registers saved by both entry stubs, in push order */
+struct syscall_frame {
+  uint32_t ebx, ecx, edx, esi, edi, ebp, eax;   /* pushed by the stub */
+  uint32_t eip, cs, eflags, useresp, ss;        /* pushed by the CPU, or the SYSENTER stub */
+};
+
+typedef int32_t (*syscall_handler_t)(uint32_t arg1, uint32_t arg2, uint32_t arg3,
+                                     uint32_t arg4, uint32_t arg5);
+
+class Syscall {
+    private:
+        static syscall_handler_t table[SYSCALL_MAX];
+        static bool fastPath;
+
+        static int32_t sysNop(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+        static int32_t sysWrite(uint32_t buf, uint32_t len, uint32_t, uint32_t, uint32_t);
+        static int32_t sysUptime(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+    public:
+        /*
+         * Fills the table with the built in calls and enables SYSENTER if
+         * the CPU supports it. 'int $0x80' is installed by idt_install.
+         */
+        static void init();
+        /*
+         * Sets up the SYSENTER registers of the calling CPU, with 'esp0' as
+         * its kernel stack. init() does it for the boot CPU, every AP calls
+         * it once while it comes up.
+         */
+        static void initCpu(uint32_t esp0);
+        /* True when SYSENTER is set up */
+        static bool hasFastPath() { return fastPath; }
+        /* Installs 'handler' as system call 'number', replacing the old one. */
+        static bool registerSyscall(uint32_t number, syscall_handler_t handler);
+        /*
+         * Sets the kernel stack used by both entry paths on the calling CPU.
+         * Must be updated whenever a different thread may enter the kernel
+         * from ring 3.
+         */
+        static void setKernelStack(uint32_t esp0);
+        /* Runs the call described by 'frame' and stores its result in frame->eax. */
+        static void dispatch(struct syscall_frame* frame) {
+            uint32_t number = frame->eax;
+            syscall_handler_t handler = number < SYSCALL_MAX ? table[number] : 0;
+            frame->eax = handler ? (uint32_t)handler(frame->ebx, frame->ecx, frame->edx,
+                                                     frame->esi, frame->edi)
+                                 : (uint32_t)-SYSCALL_ENOSYS;
+        }
+};
+
+/* Entry points from the assembly stubs */
+void syscall_dispatch(struct syscall_frame* frame);
+void syscall_int80_entry(void);
+void syscall_sysenter_entry(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _KERNEL_SYSCALL_H_
@@ -3,10 +3,23 @@
 
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * VGA text console. Output is serialized by a spinlock, so it may be used
+ * from interrupt handlers and from any CPU.
+ */
 void terminal_initialize(void);
 void t_backspace();
 void t_putchar(char c);
 void t_write(const char* data, size_t size);
 void t_writestring(const char* data);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif  // _KERNEL_TTY_H
@@ -0,0 +1,27 @@
+#ifndef _DS_INTRUSIVE_
+#define _DS_INTRUSIVE_
+
+#include <stdint.h>
+
+/*
+ * Intrusive containers do not allocate. Every object that can be stored in one
+ * embeds a link field (ListNode, RBNode, MinHeapNode) and the container only
+ * strings those fields together. Given a link, containerOf walks back to the
+ * object that holds it.
+ *
+ * An object needs one link field per container it can be in at the same time.
+ */
+template <typename T, typename Node>
+inline T *containerOf(Node *node, Node T::*member) {
+    // Offset of 'member' inside T, taken on a dummy address rather than null.
+    const uintptr_t base = 0x1000;
+    uintptr_t offset = (uintptr_t)&(((T*)base)->*member) - base;
+    return (T*)((uintptr_t)node - offset);
+}
+
+template <typename T, typename Node>
+inline const T *containerOf(const Node *node, Node T::*member) {
+    return containerOf((Node*)node, member);
+}
+
+#endif  // _DS_INTRUSIVE_
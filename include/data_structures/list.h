@@ -0,0 +1,118 @@
+#ifndef _DS_LIST_
+#define _DS_LIST_
+
+#include <data_structures/intrusive.h>
+#include <stddef.h>
+
+/*
+ * Circular doubly linked list link. An unlinked node points at itself, so
+ * removing a node never needs to know which list it is on.
+ *
+ * The constructors are constexpr so that lists with static storage are
+ * initialized at compile time. Global constructors only run after
+ * kernel_early, which is too late for anything used during boot. GCC still
+ * initializes static *arrays* of lists at run time, so avoid those in code
+ * that runs before kernel_main.
+ */
+struct ListNode {
+    ListNode *prev;
+    ListNode *next;
+
+    constexpr ListNode() : prev(this), next(this) {}
+    bool isLinked() const { return next != this; }
+};
+
+/*
+ * A doubly linked list of T, threaded through the ListNode member 'Link'.
+ * Every operation is O(1) and none allocates.
+ *
+ *     struct Foo { ListNode node; ... };
+ *     IntrusiveList<Foo, &Foo::node> foos;
+ *     for (Foo *foo = foos.front(); foo; foo = foos.next(foo)) ...
+ *
+ * Removing the current element while walking is fine as long as next() was
+ * taken before the removal.
+ */
+template <typename T, ListNode T::*Link>
+class IntrusiveList {
+    private:
+        ListNode head;
+        size_t size;
+
+        static ListNode *nodeOf(T *item) { return &(item->*Link); }
+        static T *itemOf(ListNode *node) { return containerOf(node, Link); }
+
+        /* Links 'node' in between the adjacent 'prev' and 'next'. */
+        void link(ListNode *node, ListNode *prev, ListNode *next) {
+            node->prev = prev;
+            node->next = next;
+            prev->next = node;
+            next->prev = node;
+            size++;
+        }
+        /* Item after 'node', or 0 at the head. */
+        T *itemOrNull(ListNode *node) { return node == &head ? 0 : itemOf(node); }
+
+        /* Lists link to their own head, they cannot be copied. */
+        IntrusiveList(const IntrusiveList&);
+        IntrusiveList& operator=(const IntrusiveList&);
+    public:
+        constexpr IntrusiveList() : head(), size(0) {}
+
+        void pushFront(T *item) { link(nodeOf(item), &head, head.next); }
+        void pushBack(T *item) { link(nodeOf(item), head.prev, &head); }
+        /* Inserts 'item' right after 'pos', which must be on this list. */
+        void insertAfter(T *pos, T *item) { link(nodeOf(item), nodeOf(pos), nodeOf(pos)->next); }
+        /* Inserts 'item' right before 'pos', which must be on this list. */
+        void insertBefore(T *pos, T *item) { link(nodeOf(item), nodeOf(pos)->prev, nodeOf(pos)); }
+
+        /* Unlinks 'item', which must be on this list. */
+        void remove(T *item) {
+            ListNode *node = nodeOf(item);
+            node->prev->next = node->next;
+            node->next->prev = node->prev;
+            node->prev = node->next = node;
+            size--;
+        }
+
+        T *popFront() {
+            T *item = front();
+            if (item)
+                remove(item);
+            return item;
+        }
+        T *popBack() {
+            T *item = back();
+            if (item)
+                remove(item);
+            return item;
+        }
+
+        /* Moves every item of 'other' to the end of this list. */
+        void splice(IntrusiveList &other) {
+            if (other.isEmpty())
+                return;
+            ListNode *first = other.head.next, *last = other.head.prev;
+            first->prev = head.prev;
+            head.prev->next = first;
+            last->next = &head;
+            head.prev = last;
+            size += other.size;
+            other.head.prev = other.head.next = &other.head;
+            other.size = 0;
+        }
+
+        T *front() { return itemOrNull(head.next); }
+        T *back() { return itemOrNull(head.prev); }
+        /* The item after/before 'item', or 0 at either end. */
+        T *next(T *item) { return itemOrNull(nodeOf(item)->next); }
+        T *prev(T *item) { return itemOrNull(nodeOf(item)->prev); }
+
+        /* True if 'item' is on any list through 'Link'. */
+        static bool isLinked(T *item) { return nodeOf(item)->isLinked(); }
+
+        size_t getSize() const { return size; }
+        bool isEmpty() const { return head.next == &head; }
+};
+
+#endif  // _DS_LIST_
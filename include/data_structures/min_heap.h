@@ -0,0 +1,121 @@
+#ifndef _DS_MIN_HEAP_
+#define _DS_MIN_HEAP_
+
+#include <data_structures/intrusive.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MIN_HEAP_UNLINKED 0xFFFFFFFF
+
+/*
+ * Link for a MinHeap. It records where the object sits in the heap array so
+ * that an arbitrary object (a cancelled timer, say) can be removed or re-keyed
+ * in O(log n) without searching for it.
+ */
+struct MinHeapNode {
+    uint32_t index;
+
+    constexpr MinHeapNode() : index(MIN_HEAP_UNLINKED) {}
+    bool isLinked() const { return index != MIN_HEAP_UNLINKED; }
+};
+
+/*
+ * A binary min-heap of at most Capacity pointers to T, ordered by Compare's
+ * operator()(const T*, const T*). The smallest item is always at the top.
+ * The pointer array lives inside the heap object, so nothing is allocated.
+ *
+ * insert, pop, remove and update are O(log n), top is O(1).
+ */
+template <typename T, MinHeapNode T::*Link, typename Compare, size_t Capacity>
+class MinHeap {
+    private:
+        T *items[Capacity];
+        size_t size;
+        Compare less_than;
+
+        static uint32_t &indexOf(T *item) { return (item->*Link).index; }
+
+        void place(T *item, size_t i) {
+            items[i] = item;
+            indexOf(item) = i;
+        }
+
+        /* Moves the item at i towards the root while it is smaller than its parent. */
+        void siftUp(size_t i) {
+            T *item = items[i];
+            while (i > 0) {
+                size_t parent = (i - 1) / 2;
+                if (!less_than(item, items[parent]))
+                    break;
+                place(items[parent], i);
+                i = parent;
+            }
+            place(item, i);
+        }
+
+        /* Moves the item at i towards the leaves while a child is smaller. */
+        void siftDown(size_t i) {
+            T *item = items[i];
+            while (true) {
+                size_t child = 2 * i + 1;
+                if (child >= size)
+                    break;
+                if (child + 1 < size && less_than(items[child + 1], items[child]))
+                    child++;
+                if (!less_than(items[child], item))
+                    break;
+                place(items[child], i);
+                i = child;
+            }
+            place(item, i);
+        }
+    public:
+        constexpr MinHeap() : items(), size(0), less_than() {}
+
+        /* Returns false when the heap is full. */
+        bool insert(T *item) {
+            if (size == Capacity)
+                return false;
+            items[size] = item;
+            siftUp(size++);
+            return true;
+        }
+
+        /* The smallest item, or 0. */
+        T *top() { return size ? items[0] : 0; }
+
+        /* Removes and returns the smallest item, or 0. */
+        T *pop() {
+            T *item = top();
+            if (item)
+                remove(item);
+            return item;
+        }
+
+        /* Unlinks 'item', which must be in this heap. */
+        void remove(T *item) {
+            size_t i = indexOf(item);
+            indexOf(item) = MIN_HEAP_UNLINKED;
+            if (i == --size)
+                return;
+            place(items[size], i);
+            update(items[i]);
+        }
+
+        /* Restores the order after the key of 'item' changed. */
+        void update(T *item) {
+            size_t i = indexOf(item);
+            if (i > 0 && less_than(item, items[(i - 1) / 2]))
+                siftUp(i);
+            else
+                siftDown(i);
+        }
+
+        static bool isLinked(T *item) { return (item->*Link).isLinked(); }
+
+        size_t getSize() const { return size; }
+        static size_t getCapacity() { return Capacity; }
+        bool isEmpty() const { return size == 0; }
+};
+
+#endif  // _DS_MIN_HEAP_
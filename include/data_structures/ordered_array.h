@@ -1,54 +1,131 @@
 #ifndef _DS_ORDERED_ARRAY_
 #define _DS_ORDERED_ARRAY_
 
-#include <libk/memlayout.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 /*
  * This array is insertion sorted - it always remains in a sorted state (between calls).
- * It can store anything that can be cast to a void* -- so a int32_t, or any pointer.
+ *
+ * T is the element type, Compare a functor type whose operator()(a, b) returns
+ * true when a must come before b, and Capacity the maximum number of elements.
+ * The comparator is a type rather than a function pointer so every call to it
+ * is inlined.
+ *
+ * The array does not own its storage. It is handed a buffer of at least
+ * Capacity elements, which lets the heap keep its index inside the heap area
+ * before any allocator exists.
+ *
+ * Positions are found by binary search and elements are shifted with memmove,
+ * so T must be trivially copyable (pointers and integers are what we store).
+ * Lookups by key, e.g. "the first hole of at least n bytes", work with any Key
+ * for which Compare also provides operator()(T, Key).
  */
-typedef void* type_t;
-
-/* https://stackoverflow.com/questions/12662891/how-can-i-pass-a-member-function-where-a-free-function-is-expected */
-typedef uint8_t (*lessthan_predicate_t)(type_t, type_t);
-
 
 /* A standard less than predicate. */
-uint8_t standardLessthanPredicate(type_t a, type_t b);
+template <typename T>
+struct StandardLessThan {
+    bool operator()(const T& a, const T& b) const { return a < b; }
+};
 
+template <typename T, typename Compare = StandardLessThan<T>, size_t Capacity = 1024>
 class OrderedArray {
     private:
-        type_t *array;
+        T *array;
         size_t size;
-        size_t max_size;
-        lessthan_predicate_t less_than;
+        Compare less_than;
+
+        /* Shifts [i, size) one slot to the right. */
+        void openGap(size_t i) {
+            memmove(&array[i + 1], &array[i], (size - i) * sizeof(T));
+        }
     public:
-        /* Only used when kmalloc available. It uses the standard lessthan predicate
-         * @param max_size The maximum size of ordered array
-         */
-        OrderedArray(size_t max_size);
-        /* Only used when kmalloc available
-         * @param max_size The maximum size of ordered array
-         * @param less_than A user supplied lessthan predicate
+        /* An array with no storage yet. Assign a bound one before use. */
+        OrderedArray() : array(0), size(0) {}
+        /*
+         * @param storage Room for Capacity elements. Its previous contents are ignored.
          */
-        OrderedArray(size_t max_size, lessthan_predicate_t less_than);
-        /* Only used when kmalloc is not working 
-         * @param addr The address where the heap must be located
-         * @param max_size The maximum size of ordered array
-         * @param less_than A user supplied lessthan predicate
+        explicit OrderedArray(T *storage) : array(storage), size(0) {}
+
+        /* Index of the first element that is not less than 'key', or getSize(). */
+        template <typename Key>
+        size_t lowerBound(const Key& key) const {
+            size_t lo = 0, hi = size;
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (less_than(array[mid], key))
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            return lo;
+        }
+
+        /* Index of the first element that 'node' is less than, or getSize(). */
+        size_t upperBound(const T& node) const {
+            size_t lo = 0, hi = size;
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (less_than(node, array[mid]))
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+            return lo;
+        }
+
+        /*
+         * Index of 'node' itself, or -1. Elements that compare equal to it are
+         * told apart with operator==.
          */
-        OrderedArray(virtual_addr *addr, size_t max_size, lessthan_predicate_t less_than);
+        int32_t find(const T& node) const {
+            for (size_t i = lowerBound(node); i < size && !less_than(node, array[i]); i++) {
+                if (array[i] == node)
+                    return i;
+            }
+            return -1;
+        }
+
+        /* Add an item into the list, after any equal ones. Returns false when full. */
+        bool insertNode(const T& node) {
+            if (size == Capacity)
+                return false;
+            size_t i = upperBound(node);
+            openGap(i);
+            array[i] = node;
+            size++;
+            return true;
+        }
+
         /* Deletes the item at location i from the list. */
-        void removeAtIndex(size_t i);
-        /* Returns Node at index i */
-        type_t findAtIndex(size_t i);
-        /* Add an item into the list. */
-        void insertNode(type_t node);
+        void removeAtIndex(size_t i) {
+            if (i >= size)
+                return;
+            size--;
+            memmove(&array[i], &array[i + 1], (size - i) * sizeof(T));
+        }
+
+        /* Deletes 'node' if present. Returns whether it was. */
+        bool erase(const T& node) {
+            int32_t i = find(node);
+            if (i < 0)
+                return false;
+            removeAtIndex(i);
+            return true;
+        }
 
-        size_t getSize() { return size; }
+        /* Returns Node at index i, or a value-initialized T when out of range. */
+        T findAtIndex(size_t i) const {
+            if (i < size)
+                return array[i];
+            return T();
+        }
 
-        ~OrderedArray() {}
+        size_t getSize() const { return size; }
+        static size_t getCapacity() { return Capacity; }
+        bool isEmpty() const { return size == 0; }
+        bool isFull() const { return size == Capacity; }
 };
 
-#endif  // _DS_ORDERED_ARRAY_
\ No newline at end of file
+#endif  // _DS_ORDERED_ARRAY_
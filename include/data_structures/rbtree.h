@@ -0,0 +1,349 @@
+#ifndef _DS_RBTREE_
+#define _DS_RBTREE_
+
+#include <data_structures/intrusive.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A red-black tree is a binary search tree that keeps itself balanced by
+ * colouring every node red or black and enforcing two rules: a red node has
+ * no red child, and every path from a node down to its leaves passes the same
+ * number of black nodes. The longest path is then at most twice the shortest,
+ * so lookup, insertion and removal are O(log n). Rebalancing after a change
+ * takes at most three rotations.
+ *
+ * *Augmentation
+ * Some trees need a summary of each subtree in every node, e.g. the largest
+ * free gap below a node so an allocator can find a fitting region in
+ * O(log n). The Augment functor recomputes that summary for one node from its
+ * own fields and its children:
+ *
+ *     struct MaxGap {
+ *         void operator()(RBNode *node) const {
+ *             Region *region = containerOf(node, &Region::rb);
+ *             region->max_gap = region->gap;
+ *             ... fold in the children's max_gap ...
+ *         }
+ *     };
+ *
+ * The tree calls it on both nodes of every rotation and on every node between
+ * a change and the root, children before parents.
+ */
+
+enum rb_color {
+    RB_RED,
+    RB_BLACK
+};
+
+struct RBNode {
+    RBNode *parent;
+    RBNode *left;
+    RBNode *right;
+    uint8_t color;
+
+    constexpr RBNode() : parent(0), left(0), right(0), color(RB_RED) {}
+};
+
+/* Augmentation for trees that do not need any. */
+struct RBNoAugment {
+    void operator()(RBNode *) const {}
+};
+
+/* The untyped part of the tree: rebalancing and iteration on bare nodes. */
+template <typename Augment>
+class RBTreeCore {
+    protected:
+        RBNode *root;
+        size_t size;
+        Augment augment;
+
+        constexpr RBTreeCore() : root(0), size(0), augment() {}
+
+        static bool isRed(RBNode *node) { return node && node->color == RB_RED; }
+
+        /* Puts 'node' where 'old' hangs off its parent. 'node' may be 0. */
+        void replaceChild(RBNode *old, RBNode *node) {
+            if (!old->parent)
+                root = node;
+            else if (old == old->parent->left)
+                old->parent->left = node;
+            else
+                old->parent->right = node;
+            if (node)
+                node->parent = old->parent;
+        }
+
+        void rotateLeft(RBNode *x) {
+            RBNode *y = x->right;
+            x->right = y->left;
+            if (y->left)
+                y->left->parent = x;
+            replaceChild(x, y);
+            y->left = x;
+            x->parent = y;
+            augment(x);
+            augment(y);
+        }
+
+        void rotateRight(RBNode *x) {
+            RBNode *y = x->left;
+            x->left = y->right;
+            if (y->right)
+                y->right->parent = x;
+            replaceChild(x, y);
+            y->right = x;
+            x->parent = y;
+            augment(x);
+            augment(y);
+        }
+
+        /* Recomputes the augmented data from 'node' up to the root. */
+        void propagate(RBNode *node) {
+            for (; node; node = node->parent)
+                augment(node);
+        }
+
+        /* Hangs a new leaf at '*link' below 'parent' and rebalances. */
+        void linkNode(RBNode *node, RBNode *parent, RBNode **link) {
+            node->parent = parent;
+            node->left = node->right = 0;
+            node->color = RB_RED;
+            *link = node;
+            size++;
+            propagate(node);
+
+            // Only a red node with a red parent breaks the rules.
+            while (isRed(node->parent)) {
+                RBNode *p = node->parent;
+                RBNode *g = p->parent;   // Exists, the root is black.
+                if (p == g->left) {
+                    RBNode *uncle = g->right;
+                    if (isRed(uncle)) {
+                        // Push the red up two levels and try again there.
+                        p->color = uncle->color = RB_BLACK;
+                        g->color = RB_RED;
+                        node = g;
+                        continue;
+                    }
+                    if (node == p->right) {
+                        rotateLeft(p);
+                        node = p;
+                        p = node->parent;
+                    }
+                    p->color = RB_BLACK;
+                    g->color = RB_RED;
+                    rotateRight(g);
+                } else {
+                    RBNode *uncle = g->left;
+                    if (isRed(uncle)) {
+                        p->color = uncle->color = RB_BLACK;
+                        g->color = RB_RED;
+                        node = g;
+                        continue;
+                    }
+                    if (node == p->left) {
+                        rotateRight(p);
+                        node = p;
+                        p = node->parent;
+                    }
+                    p->color = RB_BLACK;
+                    g->color = RB_RED;
+                    rotateLeft(g);
+                }
+            }
+            root->color = RB_BLACK;
+        }
+
+        void eraseNode(RBNode *z) {
+            RBNode *x, *parent;
+            uint8_t removed_color = z->color;
+
+            if (!z->left) {
+                x = z->right;
+                parent = z->parent;
+                replaceChild(z, x);
+            } else if (!z->right) {
+                x = z->left;
+                parent = z->parent;
+                replaceChild(z, x);
+            } else {
+                // Two children: the successor takes z's place and colour.
+                RBNode *y = minimum(z->right);
+                removed_color = y->color;
+                x = y->right;
+                if (y->parent == z) {
+                    parent = y;
+                } else {
+                    parent = y->parent;
+                    replaceChild(y, x);
+                    y->right = z->right;
+                    y->right->parent = y;
+                }
+                replaceChild(z, y);
+                y->left = z->left;
+                y->left->parent = y;
+                y->color = z->color;
+            }
+            size--;
+            z->parent = z->left = z->right = 0;
+            // Every node from the removal point up lost a descendant.
+            propagate(parent);
+
+            if (removed_color == RB_RED)
+                return;
+
+            // x carries an extra black. Move it up or absorb it by rotating.
+            while (x != root && !isRed(x)) {
+                if (x == parent->left) {
+                    RBNode *w = parent->right;
+                    if (isRed(w)) {
+                        w->color = RB_BLACK;
+                        parent->color = RB_RED;
+                        rotateLeft(parent);
+                        w = parent->right;
+                    }
+                    if (!isRed(w->left) && !isRed(w->right)) {
+                        w->color = RB_RED;
+                        x = parent;
+                        parent = x->parent;
+                        continue;
+                    }
+                    if (!isRed(w->right)) {
+                        w->left->color = RB_BLACK;
+                        w->color = RB_RED;
+                        rotateRight(w);
+                        w = parent->right;
+                    }
+                    w->color = parent->color;
+                    parent->color = RB_BLACK;
+                    w->right->color = RB_BLACK;
+                    rotateLeft(parent);
+                } else {
+                    RBNode *w = parent->left;
+                    if (isRed(w)) {
+                        w->color = RB_BLACK;
+                        parent->color = RB_RED;
+                        rotateRight(parent);
+                        w = parent->left;
+                    }
+                    if (!isRed(w->left) && !isRed(w->right)) {
+                        w->color = RB_RED;
+                        x = parent;
+                        parent = x->parent;
+                        continue;
+                    }
+                    if (!isRed(w->left)) {
+                        w->right->color = RB_BLACK;
+                        w->color = RB_RED;
+                        rotateLeft(w);
+                        w = parent->left;
+                    }
+                    w->color = parent->color;
+                    parent->color = RB_BLACK;
+                    w->left->color = RB_BLACK;
+                    rotateRight(parent);
+                }
+                x = root;
+            }
+            if (x)
+                x->color = RB_BLACK;
+        }
+
+    public:
+        static RBNode *minimum(RBNode *node) {
+            while (node && node->left)
+                node = node->left;
+            return node;
+        }
+        static RBNode *maximum(RBNode *node) {
+            while (node && node->right)
+                node = node->right;
+            return node;
+        }
+        /* In-order successor/predecessor, or 0. */
+        static RBNode *successor(RBNode *node) {
+            if (node->right)
+                return minimum(node->right);
+            while (node->parent && node == node->parent->right)
+                node = node->parent;
+            return node->parent;
+        }
+        static RBNode *predecessor(RBNode *node) {
+            if (node->left)
+                return maximum(node->left);
+            while (node->parent && node == node->parent->left)
+                node = node->parent;
+            return node->parent;
+        }
+
+        /* The root, for augmented searches that walk the tree themselves. */
+        RBNode *getRoot() { return root; }
+        size_t getSize() const { return size; }
+        bool isEmpty() const { return root == 0; }
+};
+
+/*
+ * A red-black tree of T, threaded through the RBNode member 'Link' and ordered
+ * by Compare, whose operator()(const T*, const T*) is a strict less than.
+ * Equal items are kept in insertion order.
+ *
+ * lowerBound() and find() search by any Key for which Compare provides
+ * operator()(const T*, Key); find() also needs operator()(Key, const T*).
+ */
+template <typename T, RBNode T::*Link, typename Compare, typename Augment = RBNoAugment>
+class RBTree : public RBTreeCore<Augment> {
+    private:
+        typedef RBTreeCore<Augment> Core;
+        Compare less_than;
+
+        static T *itemOrNull(RBNode *node) { return node ? itemOf(node) : 0; }
+    public:
+        static T *itemOf(RBNode *node) { return containerOf(node, Link); }
+
+        void insert(T *item) {
+            RBNode **link = &this->root, *parent = 0;
+            while (*link) {
+                parent = *link;
+                if (less_than(item, itemOf(parent)))
+                    link = &parent->left;
+                else
+                    link = &parent->right;
+            }
+            this->linkNode(&(item->*Link), parent, link);
+        }
+
+        /* Unlinks 'item', which must be in this tree. */
+        void remove(T *item) { this->eraseNode(&(item->*Link)); }
+
+        /* The first item that is not less than 'key', or 0. */
+        template <typename Key>
+        T *lowerBound(const Key& key) {
+            RBNode *node = this->root, *best = 0;
+            while (node) {
+                if (less_than((const T*)itemOf(node), key)) {
+                    node = node->right;
+                } else {
+                    best = node;
+                    node = node->left;
+                }
+            }
+            return itemOrNull(best);
+        }
+
+        /* The first item equal to 'key', or 0. */
+        template <typename Key>
+        T *find(const Key& key) {
+            T *item = lowerBound(key);
+            if (item && !less_than(key, (const T*)item))
+                return item;
+            return 0;
+        }
+
+        T *first() { return itemOrNull(Core::minimum(this->root)); }
+        T *last() { return itemOrNull(Core::maximum(this->root)); }
+        T *next(T *item) { return itemOrNull(Core::successor(&(item->*Link))); }
+        T *prev(T *item) { return itemOrNull(Core::predecessor(&(item->*Link))); }
+};
+
+#endif  // _DS_RBTREE_
@@ -0,0 +1,233 @@
+#ifndef _DS_RING_
+#define _DS_RING_
+
+#include <libk/cache.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bounded lock-free rings of Capacity items of T, for handing data from
+ * interrupt handlers to deferred work and threads: neither side takes a lock
+ * or disables interrupts.
+ *
+ * SpscRing has a single producer and a single consumer, e.g. one device's
+ * interrupt handler and the deferred work draining it. MpscRing lets any
+ * number of producers (handlers on several CPUs, threads) push to a single
+ * consumer. "Single" means the calls of that side never overlap: if the
+ * producer is an interrupt handler, a thread of the same side must push with
+ * interrupts disabled.
+ *
+ * The producer's and the consumer's indices sit on cache lines of their own,
+ * so the two sides only share a line when one looks at the other's index,
+ * which SpscRing does only when its cached copy says the ring is full or
+ * empty. pushBatch() and popBatch() move several items for a single index
+ * update.
+ *
+ * T is copied with '=', it should be a small plain type. Capacity must be a
+ * power of two. The indices only ever count up and are compared through
+ * their difference, so they may wrap. All zeroes is an empty ring: static
+ * ones need no constructor.
+ */
+template <typename T, size_t Capacity>
+class SpscRing {
+    private:
+        /* Next free slot, and the producer's last look at 'tail' */
+        volatile uint32_t head __cacheline_aligned;
+        uint32_t cachedTail;
+        /* Next item to pop, and the consumer's last look at 'head' */
+        volatile uint32_t tail __cacheline_aligned;
+        uint32_t cachedHead;
+        T items[Capacity] __cacheline_aligned;
+
+        static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+        /* Producer only: slots free, from the cached tail first. */
+        uint32_t freeSlots(uint32_t h, uint32_t wanted) {
+            uint32_t free = Capacity - (h - cachedTail);
+            if (free < wanted) {
+                cachedTail = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+                free = Capacity - (h - cachedTail);
+            }
+            return free;
+        }
+        /* Consumer only: items ready, from the cached head first. */
+        uint32_t readyItems(uint32_t t, uint32_t wanted) {
+            uint32_t ready = cachedHead - t;
+            if (ready < wanted) {
+                cachedHead = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+                ready = cachedHead - t;
+            }
+            return ready;
+        }
+    public:
+        void init() {
+            head = tail = 0;
+            cachedTail = cachedHead = 0;
+        }
+
+        /* Producer only. @return false if the ring is full. */
+        bool push(const T &item) {
+            uint32_t h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+            if (!freeSlots(h, 1))
+                return false;
+            items[h & (Capacity - 1)] = item;
+            // The consumer that sees the new head sees the item.
+            __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        /* Producer only. Pushes what fits of 'count' items. @return how many */
+        uint32_t pushBatch(const T *batch, uint32_t count) {
+            uint32_t h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+            uint32_t free = freeSlots(h, count);
+            if (count > free)
+                count = free;
+            for (uint32_t i = 0; i < count; i++)
+                items[(h + i) & (Capacity - 1)] = batch[i];
+            __atomic_store_n(&head, h + count, __ATOMIC_RELEASE);
+            return count;
+        }
+
+        /* Consumer only. @return false if the ring is empty. */
+        bool pop(T *item) {
+            uint32_t t = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+            if (!readyItems(t, 1))
+                return false;
+            *item = items[t & (Capacity - 1)];
+            // The slot is the producer's again once it sees the new tail.
+            __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        /* Consumer only. Pops up to 'count' items, oldest first. @return how many */
+        uint32_t popBatch(T *batch, uint32_t count) {
+            uint32_t t = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+            uint32_t ready = readyItems(t, count);
+            if (count > ready)
+                count = ready;
+            for (uint32_t i = 0; i < count; i++)
+                batch[i] = items[(t + i) & (Capacity - 1)];
+            __atomic_store_n(&tail, t + count, __ATOMIC_RELEASE);
+            return count;
+        }
+
+        /* Items in the ring. Exact for either side only while the other is still. */
+        uint32_t size() const { return head - tail; }
+        bool isEmpty() const { return head == tail; }
+};
+
+/*
+ * Every slot carries a sequence number, after Vyukov's bounded queue: a
+ * producer claims a slot by moving 'head' with a compare and swap, fills it
+ * and then bumps its sequence, which is what the consumer waits for. A slot
+ * claimed but not filled yet holds the consumer up, not the other
+ * producers.
+ *
+ * Sequences are kept relative to the slot's index, so that all zeroes is
+ * free for the first round: for position 'pos' the slot is free while its
+ * sequence is the round base (pos & ~(Capacity - 1)) and full at base + 1.
+ */
+template <typename T, size_t Capacity>
+class MpscRing {
+    private:
+        struct slot {
+            volatile uint32_t sequence;
+            T item;
+        };
+
+        /* Next position to claim. Written by every producer. */
+        volatile uint32_t head __cacheline_aligned;
+        /* Next position to pop. Written by the consumer only. */
+        volatile uint32_t tail __cacheline_aligned;
+        slot slots[Capacity] __cacheline_aligned;
+
+        static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+        static uint32_t base(uint32_t pos) { return pos & ~(uint32_t)(Capacity - 1); }
+        slot *slotAt(uint32_t pos) { return &slots[pos & (Capacity - 1)]; }
+        void publish(uint32_t pos, const T &item) {
+            slot *s = slotAt(pos);
+            s->item = item;
+            __atomic_store_n(&s->sequence, base(pos) + 1, __ATOMIC_RELEASE);
+        }
+    public:
+        void init() {
+            head = tail = 0;
+            for (uint32_t i = 0; i < Capacity; i++)
+                slots[i].sequence = 0;
+        }
+
+        /* Any producer. @return false if the ring is full. */
+        bool push(const T &item) {
+            uint32_t pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+            for (;;) {
+                uint32_t sequence = __atomic_load_n(&slotAt(pos)->sequence, __ATOMIC_ACQUIRE);
+                int32_t diff = (int32_t)(sequence - base(pos));
+                if (diff < 0)
+                    return false;   // Still holds the item of the round before
+                if (diff > 0) {
+                    // Another producer took 'pos' already.
+                    pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+                    continue;
+                }
+                if (__atomic_compare_exchange_n(&head, &pos, pos + 1, false,
+                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    break;
+            }
+            publish(pos, item);
+            return true;
+        }
+
+        /* Any producer. Pushes what fits of 'count' items, in one claim. @return how many */
+        uint32_t pushBatch(const T *batch, uint32_t count) {
+            uint32_t pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+            uint32_t claimed;
+            do {
+                // The consumer frees slots in order: all up to 'tail' plus
+                // Capacity are free. A stale tail only claims fewer.
+                uint32_t free = Capacity - (pos - __atomic_load_n(&tail, __ATOMIC_ACQUIRE));
+                claimed = count < free ? count : free;
+                if (!claimed)
+                    return 0;
+            } while (!__atomic_compare_exchange_n(&head, &pos, pos + claimed, false,
+                                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+            for (uint32_t i = 0; i < claimed; i++)
+                publish(pos + i, batch[i]);
+            return claimed;
+        }
+
+        /* Consumer only. @return false if the oldest item is not there yet. */
+        bool pop(T *item) {
+            uint32_t pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+            slot *s = slotAt(pos);
+            if (__atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE) != base(pos) + 1)
+                return false;
+            *item = s->item;
+            // Free for the next round, which starts Capacity positions on.
+            __atomic_store_n(&s->sequence, base(pos) + Capacity, __ATOMIC_RELEASE);
+            __atomic_store_n(&tail, pos + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        /* Consumer only. Pops up to 'count' items, oldest first. @return how many */
+        uint32_t popBatch(T *batch, uint32_t count) {
+            uint32_t pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+            uint32_t popped = 0;
+            while (popped < count) {
+                slot *s = slotAt(pos + popped);
+                if (__atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE) != base(pos + popped) + 1)
+                    break;
+                batch[popped] = s->item;
+                __atomic_store_n(&s->sequence, base(pos + popped) + Capacity, __ATOMIC_RELEASE);
+                popped++;
+            }
+            __atomic_store_n(&tail, pos + popped, __ATOMIC_RELEASE);
+            return popped;
+        }
+
+        /* Claimed positions not popped yet, filled or not. A snapshot. */
+        uint32_t size() const { return head - tail; }
+        bool isEmpty() const { return head == tail; }
+};
+
+#endif  // _DS_RING_
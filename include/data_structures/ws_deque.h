@@ -0,0 +1,110 @@
+#ifndef _DS_WS_DEQUE_
+#define _DS_WS_DEQUE_
+
+#include <libk/cache.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A work-stealing deque of at most Capacity pointers to T, after Chase and
+ * Lev, with the memory orderings worked out for it by Le et al.
+ *
+ * One CPU owns the deque. Only the owner may push() and pop(), both at the
+ * bottom end; calls of the owner must not interrupt each other (run them with
+ * interrupts disabled if interrupt handlers push too). Any CPU, the owner
+ * included, may steal() from the top end at any time. Nothing takes a lock:
+ * thieves only race each other, and the owner only when a single item is
+ * left.
+ *
+ * pop() returns the newest item, steal() the oldest. An owner that takes its
+ * items with steal() as well gets a FIFO queue that idle CPUs can still
+ * help with.
+ *
+ * The array is not grown, push() fails once it is full. Capacity must be a
+ * power of two. The indices only ever count up and are compared through their
+ * difference, so they may wrap. All zeroes is an empty deque: static ones
+ * need no constructor.
+ */
+template <typename T, size_t Capacity>
+class WorkStealingDeque {
+    private:
+        /* Next item to steal. Written by thieves, kept apart from the owner's side. */
+        volatile uint32_t top __cacheline_aligned;
+        /* Next free slot. Written by the owner only. */
+        volatile uint32_t bottom __cacheline_aligned;
+        T *items[Capacity];
+
+        static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+        T *slot(uint32_t index) const {
+            return __atomic_load_n(&items[index & (Capacity - 1)], __ATOMIC_RELAXED);
+        }
+    public:
+        void init() {
+            top = 0;
+            bottom = 0;
+        }
+
+        /* Owner only. @return false if the deque is full. */
+        bool push(T *item) {
+            uint32_t b = __atomic_load_n(&bottom, __ATOMIC_RELAXED);
+            uint32_t t = __atomic_load_n(&top, __ATOMIC_ACQUIRE);
+            // 't' may be stale, which only makes the deque look fuller.
+            if ((int32_t)(b - t) >= (int32_t)Capacity)
+                return false;
+            __atomic_store_n(&items[b & (Capacity - 1)], item, __ATOMIC_RELAXED);
+            // A thief that sees the new bottom sees the item.
+            __atomic_store_n(&bottom, b + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        /* Owner only. @return the newest item, or 0 if there is none. */
+        T *pop() {
+            uint32_t b = __atomic_load_n(&bottom, __ATOMIC_RELAXED) - 1;
+            __atomic_store_n(&bottom, b, __ATOMIC_RELAXED);
+            // The claim on the bottom item must be seen before top is read,
+            // or a thief and the owner could both take it.
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            uint32_t t = __atomic_load_n(&top, __ATOMIC_RELAXED);
+            int32_t left = (int32_t)(b - t);
+            if (left < 0) {
+                __atomic_store_n(&bottom, b + 1, __ATOMIC_RELAXED);
+                return 0;
+            }
+            T *item = slot(b);
+            if (left == 0) {
+                // The last item: whoever moves top first gets it.
+                if (!__atomic_compare_exchange_n(&top, &t, t + 1, false,
+                                                 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                    item = 0;
+                __atomic_store_n(&bottom, b + 1, __ATOMIC_RELAXED);
+            }
+            return item;
+        }
+
+        /*
+         * Any CPU. @return the oldest item, or 0 if there is none or another
+         * CPU took it first. Try again while !isEmpty() to tell the two apart.
+         */
+        T *steal() {
+            uint32_t t = __atomic_load_n(&top, __ATOMIC_ACQUIRE);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            uint32_t b = __atomic_load_n(&bottom, __ATOMIC_ACQUIRE);
+            if ((int32_t)(b - t) <= 0)
+                return 0;
+            T *item = slot(t);
+            if (!__atomic_compare_exchange_n(&top, &t, t + 1, false,
+                                             __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                return 0;
+            return item;
+        }
+
+        /* Items in the deque. Exact for the owner, a snapshot for anyone else. */
+        uint32_t size() const {
+            int32_t n = (int32_t)(bottom - top);
+            return n > 0 ? n : 0;
+        }
+        bool isEmpty() const { return size() == 0; }
+};
+
+#endif  // _DS_WS_DEQUE_
@@ -0,0 +1,74 @@
+#ifndef _KERNEL_CLOCKEVENT_H_
+#define _KERNEL_CLOCKEVENT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * The device that raises the timer interrupt (TIMER_IDT_INDEX).
+ *
+ * It either fires periodically, or once after a given delay. The one-shot
+ * mode is what lets the idle loop stop the tick: instead of waking up every
+ * 10 ms it sleeps until the next timer is actually due.
+ *
+ * Two devices can do this:
+ * - PIT channel 0: mode 3 (square wave) for periodic, mode 0 (interrupt on
+ *   terminal count) for one-shot. Its 16 bit counter limits a one-shot delay
+ *   to about 55 ms.
+ * - The Local APIC timer, when the APIC and a calibrated TSC are available.
+ *   It is timed against the TSC at init and reaches much longer delays. The
+ *   PIT is masked when it is in use.
+ */
+
+#define CLOCKEVENT_PIT_MAX_COUNT    0xFFFF
+#define CLOCKEVENT_LAPIC_MAX_NS     1000000000ULL   // Keep the calibration error small
+#define CLOCKEVENT_LAPIC_CALIBRATE_NS 10000000      // 10 ms
+
+/* LAPIC_LVT_TIMER modes */
+#define LAPIC_TIMER_ONESHOT     0x00000
+#define LAPIC_TIMER_PERIODIC    0x20000
+#define LAPIC_TIMER_DIVIDE_16   0x3
+
+enum clockevent_device {
+    CLOCKEVENT_PIT,
+    CLOCKEVENT_LAPIC
+};
+
+class ClockEvent {
+    private:
+        static clockevent_device device;
+        static uint32_t lapicKhz;   /* LAPIC timer counts per ms, after the divider */
+
+        static bool calibrateLapic();
+        /* Converts a delay in ns to device counts, clamped to [1, max]. */
+        static uint32_t nsToCount(uint64_t ns);
+    public:
+        /* Picks the device. Call after APIC::init and ClockSource::init. */
+        static void init();
+        static clockevent_device getDevice() { return device; }
+        static const char* getName() { return device == CLOCKEVENT_LAPIC ? "lapic" : "pit"; }
+        /* Fires 'hz' times a second until reprogrammed. */
+        static void setPeriodic(uint32_t hz);
+        /*
+         * The tick of an AP, which only the Local APIC timer can give: every
+         * CPU has its own. Both do nothing with the PIT, whose interrupt only
+         * reaches the BSP, or before init().
+         */
+        static void startLocalTick(uint32_t hz);
+        static void stopLocalTick();
+        /* Fires once, 'ns' from now (rounded up to at least one count). */
+        static void setOneShot(uint64_t ns);
+        /* Longest delay setOneShot can do */
+        static uint64_t getMaxDeltaNs();
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _KERNEL_CLOCKEVENT_H_
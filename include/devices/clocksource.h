@@ -0,0 +1,78 @@
+#ifndef _KERNEL_CLOCKSOURCE_H_
+#define _KERNEL_CLOCKSOURCE_H_
+
+#include <asm.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Monotonic nanosecond clock.
+ *
+ * At boot the TSC is timed against PIT channel 2, which counts at a known
+ * 1.193182 MHz and is not used for anything else. From then on a reading is
+ * one rdtsc and two multiplications:
+ *
+ *   ns = (tsc - base) * mult >> shift
+ *
+ * The TSC is not used, and the clock falls back to the timer tick (10 ms
+ * resolution), when the CPU has no TSC, when the calibration runs disagree
+ * with each other (an emulator or an SMI storm got in the way), or when
+ * booted with "notsc".
+ */
+
+#define PIT_FREQUENCY       1193182
+#define NSEC_PER_SEC        1000000000ULL
+#define NSEC_PER_MSEC       1000000
+
+#define CLOCK_CALIBRATE_MS      10  // Length of one calibration run
+#define CLOCK_CALIBRATE_RUNS    3
+#define CLOCK_CALIBRATE_SPREAD  256 // Runs must agree to within 1/256
+
+#define CLOCK_CPUID_TSC         (1 << 4)    /* CPUID.1:EDX */
+#define CLOCK_CPUID_INVARIANT   (1 << 8)    /* CPUID.80000007:EDX */
+
+class ClockSource {
+    private:
+        static bool tsc;            /* Reading the TSC, not the tick */
+        static bool invariant;      /* The TSC rate survives power states */
+        static uint64_t tscBase;    /* TSC at time 0 */
+        static uint32_t tscKhz;
+        static uint32_t mult;
+        static uint32_t shift;
+
+        /* TSC cycles in one CLOCK_CALIBRATE_MS run, 0 if the PIT is dead. */
+        static uint64_t calibrationRun();
+        static bool calibrate();
+        static uint64_t tickNs();
+    public:
+        /* Picks and calibrates the clock. Call once, with interrupts off. */
+        static void init(bool allow_tsc);
+        /* Nanoseconds since init(). Never goes backwards. */
+        static uint64_t nowNs() {
+            return tsc ? cyclesToNs(rdtsc() - tscBase) : tickNs();
+        }
+        /*
+         * Converts a TSC difference to nanoseconds. The 64 bit product is
+         * split in two 32x32 bit ones, i386 has no 64x64 multiply.
+         */
+        static uint64_t cyclesToNs(uint64_t cycles) {
+            uint32_t hi = cycles >> 32;
+            uint32_t lo = (uint32_t)cycles;
+            return (((uint64_t)hi * mult) << (32 - shift)) + (((uint64_t)lo * mult) >> shift);
+        }
+        static bool usesTsc() { return tsc; }
+        static bool isInvariant() { return invariant; }
+        /* Calibrated TSC rate, 0 when the TSC is not used */
+        static uint32_t getTscKhz() { return tscKhz; }
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _KERNEL_CLOCKSOURCE_H_
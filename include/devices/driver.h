@@ -1,40 +1,119 @@
 #ifndef _KERNEL_DRIVER_H_
 #define _KERNEL_DRIVER_H_
 
+#include <data_structures/list.h>
+#include <libk/spinlock.h>
+#include <libk/task_group.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Drivers one driver may depend on
+#define DRIVER_MAX_DEPS 4
+
+// initialize() must run on the CPU calling initializeAll, e.g. because it
+// programs that CPU's Local APIC
+#define DRIVER_BOOT_CPU 0x1
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+enum driver_state {
+    DRIVER_REGISTERED,  /* Added, not initialized yet */
+    DRIVER_READY,       /* initialize() succeeded */
+    DRIVER_FAILED,      /* initialize() failed */
+    DRIVER_SKIPPED      /* A dependency failed or never came up */
+};
+
+class DriverManager;
+
 /*
  * The base class for all drivers.
+ *
+ * A driver does its setup in initialize(), not in its constructor, and
+ * names the drivers it needs with dependsOn() before it is added:
+ * initialize() only runs once theirs succeeded. Drivers that do not depend
+ * on each other are initialized at the same time, on the worker threads
+ * (see libk/task_group.h), so initialize() must not block and must not
+ * assume which CPU it runs on unless the driver has DRIVER_BOOT_CPU.
+ *
+ * Drivers live as long as the kernel, they are never deleted.
  */
 class Driver {
-    public:
-        Driver() {}
+    friend class DriverManager;
+    private:
+        const char *name;
+        uint32_t flags;
+        DriverManager *manager;
+        Driver *deps[DRIVER_MAX_DEPS];
+        uint32_t numDeps;
+        driver_state state;
+        /* Dependencies that have not come up yet, see DriverManager::finish */
+        volatile uint32_t waitingFor;
+        volatile bool depFailed;
+        /* Runs initialize() on a worker */
+        parallel_task task;
+        /* Next DRIVER_BOOT_CPU driver ready to initialize */
+        Driver *readyNext;
+        /* Time initialize() took */
+        uint64_t initNs;
+    protected:
         ~Driver() {}
-        void initialize();
-        void reset();
-        void destroy();
+    public:
+        /* Links the driver into the DriverManager's list. */
+        ListNode link;
+
+        Driver(const char *name, uint32_t flags = 0);
+        /* @return false if the driver already has DRIVER_MAX_DEPS */
+        bool dependsOn(Driver *driver);
+        const char *getName() const { return name; }
+        driver_state getState() const { return state; }
+        uint64_t getInitNs() const { return initNs; }
+
+        /* Finds and sets up the device. @return false if it is not usable. */
+        virtual bool initialize();
+        virtual void reset();
+        virtual void destroy();
 };
 
 class DriverManager {
     private:
-        /* The number of drivers currently loaded */
-        int numDrivers;
+        /* The drivers currently loaded, in the order they were added */
+        IntrusiveList<Driver, &Driver::link> drivers;
+        /* Runs the drivers' initialize() during initializeAll */
+        TaskGroup group;
+        /* DRIVER_BOOT_CPU drivers whose dependencies are up */
+        spinlock_t readyLock;
+        Driver *bootReady;
+        /* Drivers not finished, and those of them ready or initializing */
+        volatile uint32_t remaining;
+        volatile uint32_t inFlight;
 
-        // TODO: This restricts us to only 256 drivers. Replace this with a linked list in the future
-        Driver* drivers[256];
+        bool isLoaded(Driver *driver);
+        /* All its dependencies are done: queues 'driver' for initialize(). */
+        void makeReady(Driver *driver);
+        void run(Driver *driver);
+        /* 'driver' is done: the drivers waiting for it may go on. */
+        void finish(Driver *driver);
+        Driver *takeBootReady();
+        static void runTask(void *arg);
     public:
         DriverManager();
         /* Adds a new driver */
         void addDriver(Driver* driver);
-        /* Initializes all drivers */
-        void initializeAll();
+        /*
+         * Initializes all drivers, each after its dependencies and the
+         * independent ones concurrently. Returns once every driver is done.
+         * @return the number of drivers that are not DRIVER_READY
+         */
+        uint32_t initializeAll();
+        /* The number of drivers currently loaded */
+        size_t getNumDrivers() const { return drivers.getSize(); }
 };
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif  // _KERNEL_DRIVER_H_
\ No newline at end of file
+#endif  // _KERNEL_DRIVER_H_
@@ -1,13 +1,28 @@
 #ifndef _KERNEL_KB_H_
 #define _KERNEL_KB_H_
 
+#include <data_structures/ring.h>
+#include <devices/driver.h>
+#include <libk/async.h>
+#include <libk/deferred_work.h>
+#include <libk/wait_queue.h>
+
+// Characters typed but not yet echoed. Must be a power of two.
+#define KEYBOARD_BUFFER_SIZE 64
+// Characters echoed but not yet read, see getChar. Must be a power of two.
+#define KEYBOARD_INPUT_SIZE 256
+
+// Commands to the keyboard and its replies, see updateLeds
+#define KEYBOARD_CMD_SET_LEDS   0xED
+#define KEYBOARD_LED_CAPS_LOCK  0x04
+#define KEYBOARD_ACK            0xFA
+#define KEYBOARD_RESEND         0xFE
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-#include <devices/driver.h>
-
 class Keyboard : public Driver{
     private:
     struct KeyboardState {
@@ -16,14 +31,44 @@ class Keyboard : public Driver{
     };
 
     static KeyboardState state;
+
+    /* Filled by the interrupt handler, drained by echoWork. */
+    static SpscRing<char, KEYBOARD_BUFFER_SIZE> buffer;
+    static DeferredWork echoWork;
+    /*
+     * Filled by echoWork, emptied by getChar. Readers sleep on 'readers'
+     * while it is empty.
+     */
+    static volatile char input[KEYBOARD_INPUT_SIZE];
+    static volatile uint32_t inputHead;
+    static volatile uint32_t inputTail;
+    static wait_queue_t readers;
+    /*
+     * Echoes the buffered characters to the console and passes them on to
+     * the readers. Runs as deferred work.
+     */
+    static void echo(void *data);
+
+    /* Reply to the last command sent, completed by the interrupt handler. */
+    static AsyncCompletion reply;
+    /* Caps Lock toggled since the LEDs were last set. */
+    static volatile bool ledsChanged;
+    /* updateLeds is running. Deferred work only. */
+    static bool ledsBusy;
+    /* Sends 'byte' and waits for the reply. @return the reply */
+    static Task<int32_t> sendCommand(uint8_t byte);
+    /* Sets the LEDs until they match the state. Spawned by echo. */
+    static Task<void> updateLeds();
     public:
-        Keyboard(InterruptHandler* interruptHandler);
-        void initialize();
+        /* Waits for the next character typed. Threads only. */
+        static char getChar();
+        Keyboard();
+        bool initialize();
         void reset();
         void destroy();
 
     protected:
-        static void keyboardHandler(struct regs *r);
+        static interrupt_result keyboardHandler(struct regs *r, void *data);
 
 
 };
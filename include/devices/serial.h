@@ -0,0 +1,39 @@
+#ifndef _KERNEL_SERIAL_H_
+#define _KERNEL_SERIAL_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define SERIAL_COM1_PORT 0x3F8
+
+/*
+ * Polled output on the first serial port (115200 8N1). It is used to get
+ * bulk diagnostic data (traces, statistics) out of the machine, e.g. with
+ * qemu's -serial file:out.txt, where the VGA console would be useless.
+ * It needs no interrupts and no memory, so it works from the very start.
+ */
+class Serial {
+    private:
+        static bool ready;
+        static void waitTransmitEmpty();
+    public:
+        /* Programs the UART. Safe to call more than once. */
+        static void init();
+        static void putchar(char c);
+        static void write(const char* data);
+        /* Writes 'value' as 0x-prefixed hex. */
+        static void writeHex(uint32_t value);
+        static void writeHex64(uint64_t value);
+        /* Writes 'value' in decimal. */
+        static void writeDec(uint32_t value);
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _KERNEL_SERIAL_H_
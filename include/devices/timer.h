@@ -1,29 +1,67 @@
 #ifndef _KERNEL_TIMER_H_
 #define _KERNEL_TIMER_H_
 
+#include <arch/i386/interrupts.h>
+#include <devices/driver.h>
+#include <libk/seqlock.h>
+#include <stdint.h>
+
+#define TICKS_PER_SECOND 100
+#define TICK_NSEC (1000000000 / TICKS_PER_SECOND)
+// No timer is pending, see Timer::idle_enter
+#define TIMER_NO_EVENT 0xFFFFFFFFFFFFFFFFULL
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-#include <devices/driver.h>
-
-// Sets up the system clock
+/*
+ * Sets up the system clock.
+ *
+ * The tick runs at TICKS_PER_SECOND while the system is busy. When the idle
+ * loop finds nothing to do it calls idle_enter, which stops the periodic tick
+ * and programs a single interrupt for the next pending event instead. The
+ * first interrupt after that, whatever it is, restarts the tick and advances
+ * timer_ticks by the time spent asleep, read from the ClockSource. Without a
+ * TSC the tick is the clock itself and is never stopped.
+ */
 class Timer : public Driver{
     private:
         // Holds how many ticks that the system has been running for
-        static int timer_ticks;
+        static volatile uint64_t timer_ticks;
+        // Lets get_ticks read the 64 bits whole. The writers all run with
+        // interrupts disabled on the CPU that takes the tick.
+        static seqcount_t ticks_seq;
+        // The periodic tick is stopped, a one-shot interrupt is pending
+        static bool tick_stopped;
+        // Times idle_enter stopped the tick
+        static uint32_t tick_stops;
         // Sets the frequency of system timer
         void timer_phase(int hz);
+        // Catches timer_ticks up with the clock and restarts the tick
+        static void restart_tick();
     public:
-        Timer(InterruptHandler* interruptHandler);
-        void initialize();
+        Timer();
+        // Programs this CPU's tick, hence DRIVER_BOOT_CPU
+        bool initialize();
         void reset();
         void destroy();
+        // Ticks since the timer was installed
+        static uint64_t get_ticks();
+        static uint32_t get_tick_stops() { return tick_stops; }
+        /*
+         * Called by the idle loop, with interrupts disabled, right before it
+         * halts. Stops the tick until 'next_event_ns' (ClockSource time), or
+         * as long as the device allows for TIMER_NO_EVENT.
+         */
+        static void idle_enter(uint64_t next_event_ns);
+        // Called by the idle loop when the halt returns
+        static void idle_exit();
 
     protected:
         // IRQ Handler for the timer. Called at every clock tick
-        static void timer_handler(struct regs *r);
+        static interrupt_result timer_handler(struct regs *r, void *data);
 };
 
 #ifdef __cplusplus
@@ -0,0 +1,354 @@
+#ifndef _LIBK_ASYNC_H_
+#define _LIBK_ASYNC_H_ 1
+
+#include <arch/i386/interrupts.h>
+#include <assert.h>
+#include <libk/coroutine.h>
+#include <libk/deferred_work.h>
+#include <libk/irqflags.h>
+#include <libk/spinlock.h>
+#include <libk/timer_wheel.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Asynchronous driver code as coroutines. A driver that issues a command,
+ * waits for the device's interrupt and reads the status back would
+ * otherwise be a state machine spread over the interrupt handler and
+ * deferred work; as a coroutine it reads top to bottom:
+ *
+ *     Task<int32_t> Disk::read(uint32_t sector) {
+ *         outb(DISK_COMMAND, DISK_READ | sector);
+ *         co_await irq;
+ *         co_return inb(DISK_STATUS);
+ *     }
+ *
+ *     Task<void> Disk::probe() {
+ *         if (co_await read(0) != DISK_OK)
+ *             co_return;
+ *         co_await AsyncSleep(10);
+ *         ...
+ *     }
+ *
+ *     Executor::spawn(disk.probe());
+ *
+ * A Task is lazy: calling the function only builds the frame, it runs when
+ * it is awaited or spawned. Awaiting a Task runs it and resumes the caller
+ * where it completes, without going through the executor (symmetric
+ * transfer), so chains of calls cost no more than function calls.
+ *
+ * Coroutines suspend on events (AsyncEvent, AsyncIrq), completions
+ * (AsyncCompletion) and timers (AsyncSleep). What ends the wait, mostly an
+ * interrupt handler, posts the coroutine to the Executor, which resumes it
+ * from deferred work: all coroutines run on the boot CPU with interrupts
+ * enabled, one at a time. They must not block, but need no lock against
+ * each other or against other deferred work.
+ *
+ * Frames come from CoroutinePool, a few fixed size classes carved out of a
+ * static arena, never from the heap: spawning is safe in interrupt handlers.
+ * When the pool is exhausted the coroutine function returns an invalid Task
+ * (see Task::valid) instead of running.
+ *
+ * The kernel is built without exceptions, an exception in a coroutine
+ * cannot happen.
+ */
+
+/* Frame sizes: COROUTINE_POOL_MIN_SIZE, doubled for each further class */
+#define COROUTINE_POOL_CLASSES  4
+#define COROUTINE_POOL_MIN_SIZE 128
+/* Frames in each size class */
+#define COROUTINE_POOL_BLOCKS   16
+
+template <typename T = void>
+class Task;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* A coroutine waiting for the executor. Owned by whatever it waits on. */
+struct async_node {
+    struct async_node *next;
+    std::coroutine_handle<> handle;
+};
+
+class CoroutinePool {
+    private:
+        /* A free block links to the next one of its class. */
+        struct block {
+            block *next;
+        };
+        static spinlock_t lock;
+        static block *freeList[COROUTINE_POOL_CLASSES];
+        /* Blocks of each class handed out of the arena so far */
+        static uint32_t carved[COROUTINE_POOL_CLASSES];
+        static uint32_t inUse[COROUTINE_POOL_CLASSES];
+        static uint32_t failures;
+
+        static uint32_t classFor(size_t size);
+    public:
+        /* Smallest free block of at least 'size' bytes. @return 0 if there is none. */
+        static void *allocate(size_t size);
+        /* Returns 'ptr', allocated with the same 'size'. */
+        static void free(void *ptr, size_t size);
+        static uint32_t getInUse(uint32_t size_class) { return inUse[size_class]; }
+        static uint32_t getFailures() { return failures; }
+};
+
+class Executor {
+    private:
+        static spinlock_t lock;
+        /* Posted coroutines, oldest first */
+        static async_node *head;
+        static async_node *tail;
+        static DeferredWork runWork;
+        static uint32_t resumed;
+
+        /* Resumes everything posted so far. Runs as deferred work. */
+        static void run(void *data);
+    public:
+        /* Resumes node->handle from deferred work. Safe from any context and CPU. */
+        static void post(async_node *node);
+        /*
+         * Starts 'task' and lets it run to the end by itself, its frame is
+         * freed when it does. Safe from any context and CPU.
+         * @return false if the task could not be allocated.
+         */
+        static bool spawn(Task<void> &&task);
+        static uint32_t getResumed() { return resumed; }
+};
+
+/*
+ * A counting event: each signal() lets one co_await through, oldest waiter
+ * first. Signals nobody waits for are kept. All zeroes is a valid event
+ * without signals.
+ */
+class AsyncEvent {
+    private:
+        spinlock_t lock;
+        uint32_t count;
+        async_node *head;
+        async_node *tail;
+    public:
+        struct Awaiter : async_node {
+            AsyncEvent *event;
+
+            bool await_ready();
+            bool await_suspend(std::coroutine_handle<> waiter);
+            void await_resume() {}
+        };
+
+        /* Wakes the oldest waiter, or keeps the signal. Safe from any context and CPU. */
+        void signal();
+        Awaiter operator co_await() {
+            Awaiter awaiter;
+            awaiter.event = this;
+            return awaiter;
+        }
+};
+
+/*
+ * The end of one operation, e.g. a DMA transfer, and its status. A single
+ * coroutine waits for it; complete() may come before or after the co_await,
+ * which returns the status. reset() before reusing it.
+ */
+class AsyncCompletion {
+    private:
+        spinlock_t lock;
+        volatile bool done;
+        int32_t status;
+        async_node *waiter;
+    public:
+        struct Awaiter : async_node {
+            AsyncCompletion *completion;
+
+            bool await_ready() { return completion->done; }
+            bool await_suspend(std::coroutine_handle<> waiter);
+            int32_t await_resume() { return completion->status; }
+        };
+
+        /* Ends the operation. Safe from any context and CPU. */
+        void complete(int32_t status);
+        /* Starts a new operation. Nobody may be waiting. */
+        void reset();
+        bool isDone() const { return done; }
+        Awaiter operator co_await() {
+            Awaiter awaiter;
+            awaiter.completion = this;
+            return awaiter;
+        }
+};
+
+/*
+ * Claims the interrupt for the device in 'data' and quiets it, in the
+ * interrupt handler. @return false if the device did not raise it.
+ */
+typedef bool (*async_irq_ack_t)(void *data);
+
+/*
+ * A device interrupt to co_await. Each interrupt the device raises lets one
+ * co_await through; one that nobody waits for yet is kept.
+ */
+class AsyncIrq {
+    private:
+        AsyncEvent event;
+        uint32_t idtIndex;
+        async_irq_ack_t ack;
+        void *data;
+
+        static interrupt_result handler(struct regs *r, void *self);
+    public:
+        /* Adds the handler to the chain of 'idt_index'. */
+        bool attach(uint32_t idt_index, async_irq_ack_t ack, void *data);
+        bool detach();
+        AsyncEvent::Awaiter operator co_await() { return event.operator co_await(); }
+};
+
+/* co_await AsyncSleep(ms) resumes after at least 'ms' milliseconds. */
+class AsyncSleep : async_node {
+    private:
+        KTimer timer;
+        uint32_t ms;
+
+        static void expired(void *data);
+    public:
+        explicit AsyncSleep(uint32_t ms) : ms(ms) {}
+        bool await_ready() { return ms == 0; }
+        void await_suspend(std::coroutine_handle<> waiter);
+        void await_resume() {}
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+/* What every Task promise has, whatever it returns. */
+struct task_promise_base {
+    /* Resumed when the coroutine completes */
+    std::coroutine_handle<> continuation;
+    /* Spawned: nobody awaits it, it frees its own frame */
+    bool detached;
+    /* Posts the start of a spawned coroutine */
+    async_node start;
+
+    struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> self) noexcept {
+            task_promise_base &promise = self.promise();
+            if (promise.continuation)
+                return promise.continuation;
+            if (promise.detached)
+                self.destroy();
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    task_promise_base() : continuation(), detached(false) {}
+
+    static void *operator new(size_t size) noexcept { return CoroutinePool::allocate(size); }
+    static void operator delete(void *ptr, size_t size) { CoroutinePool::free(ptr, size); }
+
+    std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+    final_awaiter final_suspend() noexcept { return final_awaiter(); }
+    void unhandled_exception() { halt_forever(); }
+};
+
+/* The return value is kept in the promise until the awaiter takes it. */
+template <typename T>
+struct task_promise : task_promise_base {
+    T value;
+
+    Task<T> get_return_object();
+    static Task<T> get_return_object_on_allocation_failure() { return Task<T>(); }
+    void return_value(T result) { value = result; }
+    T result() { return static_cast<T &&>(value); }
+};
+
+template <>
+struct task_promise<void> : task_promise_base {
+    Task<void> get_return_object();
+    static Task<void> get_return_object_on_allocation_failure();
+    void return_void() {}
+    void result() {}
+};
+
+/*
+ * A coroutine returning T. Owns the frame until it is awaited (or spawned,
+ * see Executor::spawn); co_await runs it and returns its co_return value.
+ * T must be default constructible.
+ */
+template <typename T>
+class Task {
+    public:
+        typedef task_promise<T> promise_type;
+        typedef std::coroutine_handle<promise_type> handle_t;
+
+        struct Awaiter {
+            handle_t handle;
+
+            bool await_ready() { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+                handle.promise().continuation = caller;
+                return handle;
+            }
+            T await_resume() { return handle.promise().result(); }
+        };
+
+        Task() : handle() {}
+        explicit Task(handle_t handle) : handle(handle) {}
+        Task(Task &&other) : handle(other.handle) { other.handle = handle_t(); }
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+        ~Task() {
+            if (handle)
+                handle.destroy();
+        }
+
+        /* False if the frame could not be allocated: the coroutine never ran. */
+        bool valid() const { return (bool)handle; }
+        /* Gives up the frame, e.g. to the executor. */
+        handle_t release() {
+            handle_t released = handle;
+            handle = handle_t();
+            return released;
+        }
+        /* The task must be valid, and each is awaited once. */
+        Awaiter operator co_await() {
+            assert(handle && !handle.done());
+            Awaiter awaiter;
+            awaiter.handle = handle;
+            return awaiter;
+        }
+    private:
+        handle_t handle;
+};
+
+template <typename T>
+inline Task<T> task_promise<T>::get_return_object() {
+    return Task<T>(Task<T>::handle_t::from_promise(*this));
+}
+
+inline Task<void> task_promise<void>::get_return_object() {
+    return Task<void>(Task<void>::handle_t::from_promise(*this));
+}
+
+inline Task<void> task_promise<void>::get_return_object_on_allocation_failure() {
+    return Task<void>();
+}
+
+inline bool Executor::spawn(Task<void> &&task) {
+    if (!task.valid())
+        return false;
+    Task<void>::handle_t handle = task.release();
+    task_promise<void> &promise = handle.promise();
+    promise.detached = true;
+    promise.start.handle = handle;
+    post(&promise.start);
+    return true;
+}
+
+#endif  // _LIBK_ASYNC_H_
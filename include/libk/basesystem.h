@@ -10,13 +10,28 @@ extern "C"
 {
 #endif
 
+/*
+ * Kernel command line options. The command line is read before paging is
+ * enabled: the page directory does not map where the boot loader left it.
+ */
+struct boot_options {
+    bool noapic;
+    bool notsc;
+    bool nosmp;
+};
+
 class BaseSystem {
     private:
+        boot_options options;
+
         void print_early_boot_info(multiboot_info* mb);
+        void read_boot_options(multiboot_info* mb);
+        /* True if 'option' is a word of the kernel command line */
+        bool has_boot_option(multiboot_info* mb, const char* option);
         bool init_gdt();
         bool init_idt();
         bool init_isr();
-        bool initializeDrivers(DriverManager* driverManager,  InterruptHandler* interruptHandler);
+        bool initializeDrivers(DriverManager* driverManager);
         bool init_irq();
     public:
         void init(multiboot_info* mb);
@@ -0,0 +1,11 @@
+#ifndef _LIBK_CACHE_H_
+#define _LIBK_CACHE_H_
+
+/*
+ * Data written by different CPUs should not share a cache line, or every
+ * write takes the line away from the other CPU (false sharing).
+ */
+#define CACHE_LINE_SIZE         64
+#define __cacheline_aligned     __attribute__((aligned(CACHE_LINE_SIZE)))
+
+#endif  // _LIBK_CACHE_H_
@@ -0,0 +1,135 @@
+#ifndef _LIBK_COROUTINE_H_
+#define _LIBK_COROUTINE_H_ 1
+
+#include <stddef.h>
+
+/*
+ * The part of <coroutine> the compiler needs to build coroutines. We have no
+ * C++ runtime, so the header is not available (see libk/new.h); GCC looks
+ * these names up in namespace std, with the layout below, and implements
+ * them through its __builtin_coro_* functions.
+ *
+ * Kernel code uses it through libk/async.h, not directly.
+ */
+
+namespace std {
+
+template <typename R, typename = void>
+struct __coroutine_traits_impl {};
+
+template <typename R>
+struct __coroutine_traits_impl<R, decltype((void)sizeof(typename R::promise_type))> {
+    typedef typename R::promise_type promise_type;
+};
+
+/* The promise of a coroutine returning R is R::promise_type. */
+template <typename R, typename...>
+struct coroutine_traits : __coroutine_traits_impl<R> {};
+
+template <typename Promise = void>
+struct coroutine_handle;
+
+/* A suspended coroutine of any promise type. */
+template <>
+struct coroutine_handle<void> {
+    public:
+        constexpr coroutine_handle() noexcept : frame(0) {}
+        constexpr coroutine_handle(decltype(nullptr)) noexcept : frame(0) {}
+
+        constexpr void *address() const noexcept { return frame; }
+        static constexpr coroutine_handle from_address(void *address) noexcept {
+            coroutine_handle handle;
+            handle.frame = address;
+            return handle;
+        }
+
+        constexpr explicit operator bool() const noexcept { return frame != 0; }
+        bool done() const noexcept { return __builtin_coro_done(frame); }
+        void operator()() const { resume(); }
+        void resume() const { __builtin_coro_resume(frame); }
+        void destroy() const { __builtin_coro_destroy(frame); }
+    protected:
+        void *frame;
+};
+
+template <typename Promise>
+struct coroutine_handle : coroutine_handle<void> {
+    public:
+        constexpr coroutine_handle() noexcept {}
+        constexpr coroutine_handle(decltype(nullptr)) noexcept {}
+
+        static coroutine_handle from_promise(Promise &promise) {
+            coroutine_handle handle;
+            handle.frame = __builtin_coro_promise((char *)&promise, __alignof(Promise), true);
+            return handle;
+        }
+        static constexpr coroutine_handle from_address(void *address) noexcept {
+            coroutine_handle handle;
+            handle.frame = address;
+            return handle;
+        }
+
+        Promise &promise() const {
+            void *promise = __builtin_coro_promise(frame, __alignof(Promise), false);
+            return *static_cast<Promise *>(promise);
+        }
+};
+
+inline bool operator==(coroutine_handle<> a, coroutine_handle<> b) noexcept {
+    return a.address() == b.address();
+}
+
+inline bool operator!=(coroutine_handle<> a, coroutine_handle<> b) noexcept {
+    return a.address() != b.address();
+}
+
+/* Resuming it does nothing: where symmetric transfer has nowhere to go. */
+struct noop_coroutine_promise {};
+
+/* A frame laid out like the compiler's, for resume and destroy to call. */
+inline void __noop_coroutine_resume_destroy() {}
+
+struct __noop_coroutine_frame {
+    void (*resume)();
+    void (*destroy)();
+    noop_coroutine_promise promise;
+};
+
+inline __noop_coroutine_frame __noop_coroutine_fr = {
+    __noop_coroutine_resume_destroy, __noop_coroutine_resume_destroy, {}
+};
+
+template <>
+struct coroutine_handle<noop_coroutine_promise> : coroutine_handle<void> {
+    public:
+        constexpr explicit operator bool() const noexcept { return true; }
+        constexpr bool done() const noexcept { return false; }
+        void operator()() const noexcept {}
+        void resume() const noexcept {}
+        void destroy() const noexcept {}
+    private:
+        friend coroutine_handle noop_coroutine() noexcept;
+        coroutine_handle() noexcept { frame = &__noop_coroutine_fr; }
+};
+
+typedef coroutine_handle<noop_coroutine_promise> noop_coroutine_handle;
+
+inline noop_coroutine_handle noop_coroutine() noexcept {
+    return noop_coroutine_handle();
+}
+
+struct suspend_always {
+    constexpr bool await_ready() const noexcept { return false; }
+    constexpr void await_suspend(coroutine_handle<>) const noexcept {}
+    constexpr void await_resume() const noexcept {}
+};
+
+struct suspend_never {
+    constexpr bool await_ready() const noexcept { return true; }
+    constexpr void await_suspend(coroutine_handle<>) const noexcept {}
+    constexpr void await_resume() const noexcept {}
+};
+
+}  // namespace std
+
+#endif  // _LIBK_COROUTINE_H_
@@ -0,0 +1,108 @@
+#ifndef _LIBK_DEFERRED_WORK_H_
+#define _LIBK_DEFERRED_WORK_H_
+
+#include <libk/spinlock.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Interrupt handlers run with interrupts disabled, so everything they do adds
+ * to the latency of every other interrupt. A handler should only do what
+ * cannot wait (read the device, acknowledge it) and push the rest, e.g.
+ * drawing a character on the console, into a DeferredWork item.
+ *
+ * Pending items sit in one FIFO per priority. They are run, highest priority
+ * first and with interrupts enabled:
+ * - when the outermost interrupt handler returns, at most
+ *   DEFERRED_WORK_BATCH items per interrupt,
+ * - and by the idle loop in kernel_main, which drains whatever is left.
+ *
+ * Work runs on the boot CPU. Any CPU may schedule it, the others wake the
+ * boot CPU up to look at it.
+ *
+ * Scheduling an item that is already pending does nothing, so an item runs
+ * once however many interrupts asked for it. Its function must therefore
+ * consume all the work that has piled up (e.g. a whole input buffer).
+ */
+
+#define DEFERRED_WORK_BATCH 16
+
+enum deferred_priority {
+    DEFERRED_PRIORITY_HIGH,
+    DEFERRED_PRIORITY_NORMAL,
+    DEFERRED_PRIORITY_LOW,
+    DEFERRED_PRIORITY_COUNT
+};
+
+typedef void (*deferred_func_t)(void *data);
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* A unit of deferred work. It is owned by its user and never allocated here. */
+struct DeferredWork {
+    DeferredWork *next;         /* Next item in the same queue. */
+    deferred_func_t func;
+    void *data;                 /* Passed to func. */
+    uint8_t priority;
+    volatile bool pending;      /* Queued and not yet started. */
+};
+
+/* Fills in a work item. It must not be pending. */
+inline void deferred_work_init(DeferredWork *work, deferred_func_t func, void *data,
+                               deferred_priority priority) {
+    work->next = 0;
+    work->func = func;
+    work->data = data;
+    work->priority = priority;
+    work->pending = false;
+}
+
+class DeferredWorkQueue {
+    private:
+        /* Singly linked FIFO per priority. Plain pointers, so zero is empty. */
+        struct queue_t {
+            DeferredWork *head;
+            DeferredWork *tail;
+        };
+        static queue_t queues[DEFERRED_PRIORITY_COUNT];
+        /* Guards the queues and 'pending' of the items in them */
+        static spinlock_t lock;
+        /* Bit n is set while queue n is not empty. */
+        static volatile uint32_t pendingMask;
+        /* Set while some context is running work. */
+        static volatile bool running;
+        static uint32_t runCount[DEFERRED_PRIORITY_COUNT];
+
+        /* Takes the first item of the highest priority queue, or 0. */
+        static DeferredWork *dequeue();
+    public:
+        /*
+         * Queues 'work' unless it is already pending. Safe to call from
+         * interrupt handlers, with interrupts enabled and from any CPU.
+         * @return false if it was already pending.
+         */
+        static bool schedule(DeferredWork *work);
+        /*
+         * Runs up to 'budget' items. Must be called with interrupts enabled.
+         * Does nothing if called while work is already running.
+         * @return true if work is still pending.
+         */
+        static bool runPending(uint32_t budget);
+        static bool hasPending() { return pendingMask != 0; }
+        /*
+         * Called by the interrupt dispatcher after the handler and the EOI.
+         * Briefly enables interrupts to run a batch of pending work.
+         */
+        static void irqExit();
+        /* Number of items that ran at 'priority'. */
+        static uint32_t getRunCount(deferred_priority priority) { return runCount[priority]; }
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _LIBK_DEFERRED_WORK_H_
@@ -3,6 +3,7 @@
 
 #include <data_structures/ordered_array.h>
 #include <libk/memlayout.h>
+#include <libk/spinlock.h>
 #include <libk/virt_mem.h>
 #include <stddef.h>
 
@@ -71,16 +72,73 @@ extern "C"
  * - If the footer is the last in the heap ( footer_location+sizeof(footer_t) == end_address ):
  *     - Contract.
  * - Insert the header into the hole array unless the flag described in Unify left is set.
+ *
+ * * Large objects
+ * Requests of HEAP_LARGE_ALLOC_THRESHOLD bytes or more never enter the hole heap.
+ * Carving them out of holes would leave alignment holes in front of them and
+ * pin whole pages of the heap behind a header/footer pair. Instead:
+ * - Find a free page-granular range in the [HEAP_LARGE_VIRT_ADDR_START,
+ *   HEAP_LARGE_VIRT_ADDR_END) window, first fit, leaving HEAP_LARGE_GUARD_PAGES
+ *   unmapped pages behind every object so an overrun faults instead of
+ *   corrupting the neighbour.
+ * - Back every page with a frame from the PMM through the VMM.
+ * - Record (base, pages) in a small side table kept sorted by base address.
+ * Freeing such a pointer (recognised by its address alone) unmaps every page,
+ * hands the frames back to the PMM and drops the side table entry, so nothing
+ * of a large object outlives it. While the side table is full, large requests
+ * are served page aligned from the hole heap instead.
+ *
+ * * Locking
+ * Every public entry point takes the heap's spinlock with interrupts disabled,
+ * so interrupt handlers and other CPUs may allocate too. Growing the heap calls
+ * into the VMM and PMM with the lock held: the order is heap, then PMM.
  * 
  * References:
  * - https://wiki.osdev.org/Heap
  * - http://www.jamesmolloy.co.uk/tutorial_html/7.-The%20Heap.html
  */
 
+/*
+ * Subsystems that allocate from the kernel heap. Every allocation is charged
+ * to exactly one of them so that memory growth can be traced back to its owner.
+ */
+enum heap_tag {
+    HEAP_TAG_GENERAL = 0,
+    HEAP_TAG_MEMORY,
+    HEAP_TAG_INTERRUPTS,
+    HEAP_TAG_DRIVERS,
+    HEAP_TAG_SCHED,
+    HEAP_TAG_TIMERS,
+    HEAP_TAG_COUNT
+};
+
+/* Size histogram buckets: bucket i counts requests in [2^i, 2^(i+1)), the last one is open ended. */
+#define HEAP_HISTOGRAM_BUCKETS 16
+
+/* Live statistics for one heap_tag. Byte counts include header/footer and page rounding. */
+typedef struct {
+    uint32_t live_bytes;    /* Bytes currently held. */
+    uint32_t peak_bytes;    /* Highest live_bytes ever seen. */
+    uint32_t allocs;        /* Successful allocations. */
+    uint32_t frees;         /* Releases. */
+    uint32_t histogram[HEAP_HISTOGRAM_BUCKETS]; /* Requested sizes, log2 buckets. */
+} heap_tag_stats_t;
+
+/* Snapshot of how fragmented the heap is. */
+typedef struct {
+    uint32_t heap_bytes;    /* Size of the hole heap, end_address - start_address. */
+    uint32_t free_bytes;    /* Sum of all holes. */
+    uint32_t holes;         /* Number of holes in the index. */
+    uint32_t largest_hole;  /* Biggest single hole; 1 - largest_hole/free_bytes is the fragmentation. */
+    uint32_t large_objects; /* Live large objects. */
+    uint32_t large_pages;   /* Pages mapped for them. */
+} heap_frag_stats_t;
+
 /* Size information for a hole/block */
 typedef struct {
    uint32_t magic;      /* Magic number, used for error checking and identification. */
    bool is_hole;        /* 1 if this is a hole. 0 if this is a block. */
+   uint8_t tag;         /* heap_tag the block is charged to. Fits in the padding after is_hole. */
    uint32_t size;       /* size of the block, including the end footer. */
 } header_t;
 
@@ -89,32 +147,100 @@ typedef struct {
    header_t *header;    /* Pointer to the block header. */
 } footer_t;
 
+/* Orders the hole index by size. Also compares a hole against a wanted size. */
+struct HoleSizeLessThan {
+    bool operator()(const header_t *a, const header_t *b) const { return a->size < b->size; }
+    bool operator()(const header_t *a, uint32_t size) const { return a->size < size; }
+};
+
+typedef OrderedArray<header_t*, HoleSizeLessThan, HEAP_INDEX_SIZE> heap_index_t;
+
+/* Side table entry describing one large object. */
+typedef struct {
+   virtual_addr base;   /* First mapped page, also the pointer handed out. */
+   uint32_t pages;      /* Number of mapped pages, guard pages excluded. */
+   uint8_t tag;         /* heap_tag the object is charged to. */
+} large_alloc_t;
+
 class HeapMemoryManager {
     private:
         VirtualMemoryManager *virtualMemoryManager;
-        OrderedArray* indexTable;
+        heap_index_t indexTable;
         uint32_t start_address; /* The start of our allocated space. */
         uint32_t end_address;   /* The end of our allocated space. May be expanded up to max_address. */
         uint32_t max_address;   /* The maximum address the heap can be expanded to. */
         bool supervisor;        /* Should extra pages requested by us be mapped as supervisor-only? */
         bool readonly;          /* Should extra pages requested by us be mapped as read-only? */
 
+        /* Large objects, sorted ascending by base address. */
+        large_alloc_t largeAllocs[HEAP_LARGE_MAX_ALLOCS];
+        size_t numLargeAllocs;
+
+        heap_tag_stats_t tagStats[HEAP_TAG_COUNT];
+
+        spinlock_t lock;
+
+        /* alloc and free with the lock held. */
+        void *allocUnlocked(size_t size, bool page_align, heap_tag tag);
+        void freeUnlocked(void *p);
         int32_t findSmallestHole(size_t size, bool page_align);
+        /* Takes a hole out of the index. It must be there. */
+        void removeHole(header_t *hole);
+        /* Bytes to skip from a hole at 'location' so the block data lands on a page boundary. */
+        static uint32_t alignOffset(uint32_t location);
         void expand(size_t new_size);
         size_t contract(size_t new_size);
 
+        /* Maps a fresh page-granular range for 'size' bytes. Returns 0 on failure. */
+        void *allocLarge(size_t size, uint8_t tag);
+        /* Unmaps a range returned by allocLarge and gives its frames back. */
+        void freeLarge(void *p);
+        /* Index of the side table entry starting at 'base', or -1. */
+        int32_t findLarge(virtual_addr base);
+        static bool isLarge(void *p) {
+            return (uintptr_t)p >= HEAP_LARGE_VIRT_ADDR_START &&
+                   (uintptr_t)p < HEAP_LARGE_VIRT_ADDR_END;
+        }
+
+        /* Book keeping for the tagStats table. */
+        void chargeAlloc(uint8_t tag, size_t requested, uint32_t bytes);
+        void chargeFree(uint8_t tag, uint32_t bytes);
+
     public:
         HeapMemoryManager(VirtualMemoryManager *virtualMemoryManager, uint32_t start, uint32_t end, 
                             uint32_t max, bool supervisor, bool readonly);
         /* 
          * Allocates a contiguous region of memory 'size' in size. 
+         * Sizes of HEAP_LARGE_ALLOC_THRESHOLD and up are served by the large-object
+         * path, or the hole heap while its table is full, and are always page aligned.
          * @param page_alaign If true, it creates that block starting on a page boundary. 
+         * @param tag The subsystem the allocation is charged to.
          */
-        void *alloc(size_t size, bool page_align);
+        void *alloc(size_t size, bool page_align, heap_tag tag = HEAP_TAG_GENERAL);
         /* Releases a block allocated with 'alloc'. */
         void free(void *p); 
+
+        /* Live statistics of one subsystem. */
+        const heap_tag_stats_t *getTagStats(heap_tag tag) { return &tagStats[tag]; }
+        /* Prints the statistics of every subsystem that ever allocated. */
+        void printStats();
+        /* Fills 'stats' with the current hole layout. Walks the whole index. */
+        void getFragmentation(heap_frag_stats_t *stats);
 };
 
+/* The heap BaseSystem hands to the rest of the kernel. */
+extern HeapMemoryManager *kernel_heap;
+
+/* Allocates from the kernel heap, charging 'tag'. */
+void *kmalloc(size_t size, heap_tag tag = HEAP_TAG_GENERAL);
+/* Page-aligned variant of kmalloc. */
+void *kmalloc_aligned(size_t size, heap_tag tag = HEAP_TAG_GENERAL);
+/* Releases memory returned by kmalloc or kmalloc_aligned. */
+void kfree(void *p);
+
+/* Printable name of a heap_tag. */
+const char *heap_tag_name(heap_tag tag);
+
 #ifdef __cplusplus
 }
 #endif
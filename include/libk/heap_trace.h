@@ -0,0 +1,72 @@
+#ifndef _LIBK_HEAP_TRACE_H_
+#define _LIBK_HEAP_TRACE_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Allocation trace recorder for the kernel heap.
+ *
+ * When enabled, every HeapMemoryManager::alloc/free appends one compact record
+ * to a fixed ring buffer. Once the ring is full the oldest records are
+ * overwritten, so a dump always holds the most recent HEAP_TRACE_RING_SIZE
+ * operations. dump() writes the ring to the serial port as text, one record
+ * per line, in the format read by tools/heap_replay:
+ *
+ *   # openos heap trace v1
+ *   # records <total> dropped <overwritten>
+ *   A <size> <align> <tag> <id> <timestamp>
+ *   F <size> 0 <tag> <id> <timestamp>
+ *
+ * 'id' is the address handed out by alloc. It only pairs a free with its
+ * allocation; the replay maps it to whatever address its own heap returns.
+ * 'timestamp' is the raw TSC value. For frees 'size' is the block size
+ * including header and footer, which is what the heap knows at that point.
+ */
+
+#define HEAP_TRACE_RING_SIZE 2048
+
+enum heap_trace_op {
+    HEAP_TRACE_ALLOC = 1,
+    HEAP_TRACE_FREE = 2
+};
+
+typedef struct {
+    uint8_t op;         /* heap_trace_op */
+    uint8_t align;      /* 1 if a page-aligned block was requested */
+    uint8_t tag;        /* heap_tag the block is charged to */
+    uint8_t reserved;
+    uint32_t size;      /* Requested size (allocs) or block size (frees) */
+    uint32_t id;        /* Address of the block */
+    uint64_t timestamp; /* TSC when the operation completed */
+} __attribute__((packed)) heap_trace_record_t;
+
+class HeapTracer {
+    private:
+        static heap_trace_record_t ring[HEAP_TRACE_RING_SIZE];
+        static uint32_t total;  /* Records written since the last start() */
+    public:
+        /* Checked inline by the heap, so a disabled tracer costs one load. */
+        static bool enabled;
+
+        /* Clears the ring and starts recording. */
+        static void start();
+        /* Stops recording, the ring is kept for dump(). */
+        static void stop();
+        static void record(uint8_t op, uint32_t size, bool align, uint8_t tag, uint32_t id);
+        /* Number of records lost because the ring wrapped. */
+        static uint32_t dropped();
+        /* Writes the ring, oldest record first, to the serial port. */
+        static void dump();
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _LIBK_HEAP_TRACE_H_
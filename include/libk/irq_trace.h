@@ -0,0 +1,78 @@
+#ifndef _LIBK_IRQ_TRACE_H_
+#define _LIBK_IRQ_TRACE_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Interrupts-off latency tracer.
+ *
+ * While interrupts are disabled, nothing else can be serviced, so the longest
+ * such window bounds how late a timer tick or a keystroke can be handled.
+ * When enabled, the tracer timestamps (TSC) every transition of the interrupt
+ * flag that goes through local_irq_* (libk/irqflags.h) and the interrupt
+ * entry/exit path, and accounts each closed window:
+ * - a log2 histogram of window lengths in cycles,
+ * - the worst window, with the EIP that opened it. For a window opened by an
+ *   interrupt that is the interrupted EIP, and 'vector' says which one.
+ *
+ * dump() writes the result to the serial port:
+ *
+ *   # openos irqsoff trace v1
+ *   windows <n> worst <cycles> eip <eip> vector <vector or -> at <tsc>
+ *   hist <bucket>:<n> ...
+ *   # end
+ */
+
+#define IRQ_TRACE_BUCKETS 24            // The last bucket also holds everything longer
+#define IRQ_TRACE_NO_VECTOR 0xFFFFFFFF  // The window was opened by local_irq_*
+
+typedef struct {
+    uint64_t cycles;    /* Length of the window */
+    uint64_t start;     /* TSC when it opened */
+    uint32_t eip;       /* Code that opened it */
+    uint32_t vector;    /* Interrupt that opened it, or IRQ_TRACE_NO_VECTOR */
+} irq_trace_window_t;
+
+class IrqOffTracer {
+    private:
+        static bool open;           /* A window is being timed */
+        static uint64_t openedAt;
+        static uint32_t openedEip;
+        static uint32_t openedVector;
+        static uint32_t windows;
+        static uint32_t histogram[IRQ_TRACE_BUCKETS];
+        static irq_trace_window_t worst;
+
+        static void openWindow(uint32_t eip, uint32_t vector, uint64_t tsc);
+    public:
+        /* Checked inline by local_irq_*, so a disabled tracer costs one load. */
+        static bool enabled;
+
+        /* Clears the statistics and starts tracing. */
+        static void start();
+        static void stop();
+
+        /* Interrupts were just disabled by the caller of local_irq_*. */
+        static void irqsOff() __attribute__((noinline));
+        /* Interrupts are about to be enabled. */
+        static void irqsOn();
+        /* The interrupt stub entered at 'tsc', interrupting 'eip'. */
+        static void interruptEntry(uint32_t vector, uint32_t eip, uint64_t tsc);
+        /* About to iret to a context whose EFLAGS are 'eflags'. */
+        static void interruptExit(uint32_t eflags);
+
+        static void getWorst(irq_trace_window_t *out);
+        static void dump();
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _LIBK_IRQ_TRACE_H_
@@ -0,0 +1,76 @@
+#ifndef _LIBK_IRQFLAGS_H_
+#define _LIBK_IRQFLAGS_H_ 1
+
+#include <asm.h>
+#include <libk/irq_trace.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Interrupt flag control for kernel code. Critical sections that must not be
+ * interrupted look like
+ *
+ *     uint32_t flags = local_irq_save();
+ *     ...
+ *     local_irq_restore(flags);
+ *
+ * which nests: an inner pair leaves interrupts disabled for the outer one.
+ * Every transition is reported to the IrqOffTracer when it is enabled.
+ */
+
+#define EFLAGS_IF 0x200
+
+inline bool irqs_disabled_flags(uint32_t flags) { return !(flags & EFLAGS_IF); }
+
+inline bool irqs_disabled(void) { return irqs_disabled_flags(read_eflags()); }
+
+inline void local_irq_disable(void) {
+  if (IrqOffTracer::enabled && !irqs_disabled()) {
+    disable_interrupts();
+    IrqOffTracer::irqsOff();
+    return;
+  }
+  disable_interrupts();
+}
+
+inline void local_irq_enable(void) {
+  if (IrqOffTracer::enabled) IrqOffTracer::irqsOn();
+  enable_interrupts();
+}
+
+/* Disables interrupts and returns the flags to hand to local_irq_restore. */
+inline uint32_t local_irq_save(void) {
+  uint32_t flags = read_eflags();
+  disable_interrupts();
+  if (IrqOffTracer::enabled && !irqs_disabled_flags(flags)) IrqOffTracer::irqsOff();
+  return flags;
+}
+
+/* Re-enables interrupts if they were enabled when 'flags' was saved. */
+inline void local_irq_restore(uint32_t flags) {
+  if (irqs_disabled_flags(flags)) return;
+  local_irq_enable();
+}
+
+/*
+ * Enables interrupts and halts until the next one. sti only takes effect
+ * after the following instruction, so an interrupt cannot slip in between
+ * and leave the CPU asleep with work to do.
+ */
+inline void safe_halt(void) {
+  if (IrqOffTracer::enabled) IrqOffTracer::irqsOn();
+  asm volatile("sti\n\thlt" : : : "memory");
+}
+
+/*
+ * Stops the calling CPU for good, e.g. after a fatal exception. Unlike a
+ * busy loop, a halted CPU draws next to no power and leaves the bus alone.
+ * Only an NMI ends the hlt, and then it halts again.
+ */
+inline void __attribute__((noreturn)) halt_forever(void) {
+  disable_interrupts();
+  for (;;)
+    asm volatile("hlt" : : : "memory");
+}
+
+#endif  // _LIBK_IRQFLAGS_H_
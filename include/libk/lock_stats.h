@@ -0,0 +1,80 @@
+#ifndef _LIBK_LOCK_STATS_H_
+#define _LIBK_LOCK_STATS_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Lock contention statistics.
+ *
+ * A spinlock can carry a lock_stats record. While the statistics are enabled
+ * every acquisition of such a lock is counted and, when the lock was already
+ * held, the cycles (TSC) spent waiting for it. The counters are updated by
+ * the holder, so the lock itself serializes them.
+ *
+ *     DEFINE_LOCK_STATS(heap_lock_stats, "heap");
+ *     spinlock_t heap_lock = SPINLOCK_INIT_STATS(&heap_lock_stats);
+ *
+ * DEFINE_LOCK_STATS puts the record in the .data.lockstats section, which the
+ * linker script gathers into one array, so dump() finds every record without
+ * any registration:
+ *
+ *   # openos lock stats v1
+ *   <name> acquired <n> contended <n> wait <cycles> max <cycles>
+ *   # end
+ */
+
+struct lock_stats {
+    const char *name;
+    uint32_t acquisitions;
+    uint32_t contended;         /* Acquisitions that had to wait */
+    uint32_t reserved;          /* Keeps the 64 bit counters aligned */
+    uint64_t waitCycles;        /* Total time spent waiting */
+    uint64_t maxWaitCycles;     /* Longest single wait */
+} __attribute__((aligned(8)));
+
+/*
+ * The alignment is given on the variable too: without it the compiler may
+ * align larger objects further and leave holes in the array.
+ */
+#define DEFINE_LOCK_STATS(var, name) \
+    __attribute__((section(".data.lockstats"), aligned(8))) \
+    struct lock_stats var = { name, 0, 0, 0, 0, 0 }
+
+/* Bounds of the array, see linker.ld */
+extern struct lock_stats __lock_stats_start[];
+extern struct lock_stats __lock_stats_end[];
+
+class LockStats {
+    public:
+        /* Checked inline by the lock functions, so disabled stats cost one load. */
+        static bool enabled;
+
+        /* Clears every record and starts counting. */
+        static void start();
+        static void stop();
+        static void reset();
+
+        /* Called by the holder right after taking the lock. */
+        static void acquired(struct lock_stats *stats) { stats->acquisitions++; }
+        static void waited(struct lock_stats *stats, uint64_t cycles) {
+            stats->contended++;
+            stats->waitCycles += cycles;
+            if (cycles > stats->maxWaitCycles)
+                stats->maxWaitCycles = cycles;
+        }
+
+        /* Writes every record that was acquired at least once to the serial port. */
+        static void dump();
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _LIBK_LOCK_STATS_H_
@@ -32,6 +32,32 @@
 #define HEAP_INDEX_SIZE   0x20000
 #define HEAP_MAGIC        0x123890AB
 #define HEAP_MIN_SIZE     0x70000
+#define HEAP_MAX_ADDR     0xCFFFF000
+
+// Constants to the large-object allocator. Allocations of at least
+// HEAP_LARGE_ALLOC_THRESHOLD bytes are mapped page by page in their own
+// virtual window instead of being carved out of the hole heap.
+#define HEAP_LARGE_ALLOC_THRESHOLD  PAGE_SIZE
+#define HEAP_LARGE_VIRT_ADDR_START  0xD0000000
+#define HEAP_LARGE_VIRT_ADDR_END    0xE0000000
+#define HEAP_LARGE_MAX_ALLOCS       256
+#define HEAP_LARGE_GUARD_PAGES      1   // unmapped pages left after every large object
+
+// Fixed virtual addresses for memory mapped device registers. Each gets
+// one uncached page right after the large-object window.
+#define MMIO_VIRT_ADDR_START        0xE0000000
+#define APIC_LAPIC_VIRT_ADDR        (MMIO_VIRT_ADDR_START + 0x0000)
+#define APIC_IOAPIC_VIRT_ADDR       (MMIO_VIRT_ADDR_START + 0x1000)
+// Window the firmware's CPU tables (ACPI, MP) are mapped into while they
+// are read, see arch/i386/smp.h.
+#define SMP_TABLE_VIRT_ADDR         (MMIO_VIRT_ADDR_START + 0x10000)
+#define SMP_TABLE_WINDOW_PAGES      16
+
+// Low memory the other CPUs start executing from, in real mode. It must be
+// page aligned and below 1MB, it is reserved from the Physical Memory Manager.
+#define SMP_TRAMPOLINE_PADDR        0x8000
+// The first MB stays identity mapped, see VirtualMemoryManager
+#define LOW_MEMORY_END              0x100000
 
 // Functions to
 #define ALIGN_BLOCK(addr) (addr) - ((addr) % PHYS_BLOCK_SIZE);
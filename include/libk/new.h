@@ -0,0 +1,14 @@
+#ifndef _LIBK_NEW_H_
+#define _LIBK_NEW_H_ 1
+
+#include <stddef.h>
+
+/*
+ * Placement new. We have no C++ runtime, so <new> is not available; this is
+ * all that is needed to run a constructor on memory we already own, e.g.
+ * objects that must be built at runtime but outlive the function doing it.
+ */
+inline void* operator new(size_t, void* p) noexcept { return p; }
+inline void* operator new[](size_t, void* p) noexcept { return p; }
+
+#endif  // _LIBK_NEW_H_
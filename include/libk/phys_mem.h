@@ -2,6 +2,7 @@
 #define _LIBK_KPHYS_MEM_H_
 
 #include <libk/memlayout.h>
+#include <libk/spinlock.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -11,7 +12,23 @@ extern "C"
 {
 #endif
 
+/*
+ * Physical memory is split in zones by address, following the usual x86 limits:
+ * ISA DMA can only reach the first 16MB, and frames above 896MB can not be kept
+ * permanently mapped next to the kernel.
+ */
+enum phys_zone {
+    PHYS_ZONE_DMA = 0,      /* [0, 16MB) */
+    PHYS_ZONE_NORMAL,       /* [16MB, 896MB) */
+    PHYS_ZONE_HIGH,         /* [896MB, 4GB) */
+    PHYS_ZONE_COUNT
+};
+
+#define PHYS_ZONE_DMA_END     0x01000000
+#define PHYS_ZONE_NORMAL_END  0x38000000
 
+/* Bitmap words per chunk when counting free frames on several CPUs (512MB) */
+#define PHYS_COUNT_GRAIN_WORDS 4096
 
 class PhysicalMemoryManager {
     private:
@@ -19,6 +36,8 @@ class PhysicalMemoryManager {
     static uint32_t phys_mem_size_kb_;
     static uint32_t used_blocks_;
     static uint32_t total_blocks_;
+    // Guards the bitmap once the kernel runs, the boot time setup goes without
+    static spinlock_t lock_;
 
         // Functions to manipulate the bitmap
         static void map_set(int bit) {
@@ -33,6 +52,9 @@ class PhysicalMemoryManager {
             return phys_memory_map_[bit / 32] & (1 << (bit % 32));
         }
 
+        // Counts the clear bits in the block range [first, last)
+        static uint32_t count_free(uint32_t first, uint32_t last);
+
         int find_free_block();
         int find_free_blocks(uint32_t count);
         void allocate_chunk(int base_addr, int length);
@@ -53,6 +75,15 @@ class PhysicalMemoryManager {
         void free_blocks(physical_addr, uint32_t count);
 
         bool is_alloced(physical_addr);
+
+        // Statistics, all in blocks of PHYS_BLOCK_SIZE bytes
+        static uint32_t get_used_blocks() { return used_blocks_; }
+        static uint32_t get_total_blocks() { return total_blocks_; }
+        static uint32_t get_free_blocks() { return total_blocks_ - used_blocks_; }
+        static uint32_t get_zone_free_blocks(phys_zone zone);
+        static uint32_t get_largest_free_run();
+        static const char* zone_name(phys_zone zone);
+        static void print_stats();
 };
 
 #ifdef __cplusplus
@@ -0,0 +1,136 @@
+#ifndef _LIBK_RCU_H_
+#define _LIBK_RCU_H_ 1
+
+#include <arch/i386/percpu.h>
+#include <libk/deferred_work.h>
+#include <libk/spinlock.h>
+#include <libk/thread.h>
+#include <stdint.h>
+
+/*
+ * Read-copy-update, quiescent state based.
+ *
+ * Readers of an RCU protected structure take no lock and write nothing
+ * shared:
+ *
+ *     rcu_read_lock();
+ *     entry = rcu_dereference(table[i]);
+ *     ... use entry ...
+ *     rcu_read_unlock();
+ *
+ * An updater builds the new version aside, publishes it with
+ * rcu_assign_pointer and frees the old one only once no reader can hold it
+ * any more: after a grace period, through Rcu::call() or Rcu::synchronize().
+ * Updaters still serialize among themselves, e.g. with a spinlock.
+ *
+ * A read-side section must not sleep or yield. rcu_read_lock only disables
+ * preemption, so a context switch proves that the CPU left all of its
+ * sections: it is a quiescent state. So is the idle loop. A grace period
+ * starts with the set of CPUs that are online and not idle, and ends when
+ * each has reported a quiescent state (Rcu::noteQs, from schedule() and the
+ * idle loops). Idle CPUs are not waited for, they hold no references; an
+ * interrupt taking a CPU out of idle makes it count again, see irqEnter.
+ *
+ * Code that already runs with preemption or interrupts disabled, e.g. an
+ * interrupt handler, is a read-side section as it is and needs no
+ * rcu_read_lock.
+ *
+ * Callbacks run from a DeferredWork item on the boot CPU, in the order they
+ * were queued, with interrupts enabled.
+ */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct rcu_head;
+typedef void (*rcu_callback_t)(struct rcu_head *head);
+
+/* Embedded in the object to be freed, see Rcu::call */
+struct rcu_head {
+    struct rcu_head *next;
+    rcu_callback_t func;
+};
+
+/* Set while the CPU is idle, see Rcu::idleEnter */
+DECLARE_PER_CPU(uint32_t, rcu_idle);
+
+inline void rcu_read_lock(void) { Scheduler::preemptDisable(); }
+inline void rcu_read_unlock(void) { Scheduler::preemptEnable(); }
+
+/* Loads a pointer published with rcu_assign_pointer, in a read-side section. */
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_CONSUME)
+/* Publishes 'v': everything written to it before is seen by the readers. */
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+class Rcu {
+    private:
+        /* Guards the callback lists and the start and end of grace periods */
+        static spinlock_t lock;
+        /* Grace periods started and completed. Equal when none is running. */
+        static volatile uint32_t gpStarted;
+        static volatile uint32_t gpCompleted;
+        /* CPUs the running grace period still waits for */
+        static volatile uint32_t qsMask;
+        static volatile uint32_t onlineMask;
+
+        /*
+         * Callbacks queued after the running grace period started, those
+         * waiting for it, and those whose grace period is over.
+         */
+        static rcu_head *nextList;
+        static rcu_head **nextTail;
+        static rcu_head *waitList;
+        static rcu_head **waitTail;
+        static rcu_head *doneList;
+        static rcu_head **doneTail;
+        static DeferredWork callbackWork;
+        static uint32_t callbacksRun;
+
+        /* Starts a grace period for nextList. Lock held. */
+        static void startGp();
+        /* Clears 'mask' from qsMask and ends the grace period if it was the last. */
+        static void clearQs(uint32_t mask, bool locked);
+        static void completeGp();
+        static void reportQs();
+        static void runCallbacks(void *data);
+    public:
+        /* Called by every AP as it comes up, the boot CPU is online from the start. */
+        static void cpuOnline(uint32_t cpu);
+
+        /* The calling CPU is in a quiescent state. Cheap when nothing waits for it. */
+        static void noteQs() {
+            if (qsMask & (1u << PerCpu::currentCpu()))
+                reportQs();
+        }
+        /*
+         * Bracket the halt of an idle loop, with interrupts disabled. The
+         * CPU counts as quiescent until idleExit.
+         */
+        static void idleEnter();
+        static void idleExit();
+        /* Called on interrupt entry: handlers may read, the CPU is no longer idle. */
+        static void irqEnter() {
+            if (this_cpu_read(rcu_idle))
+                idleExit();
+        }
+
+        /*
+         * Runs func(head) after a grace period, i.e. once every reader that
+         * might have seen the object has left its section. Safe from any
+         * context and CPU.
+         */
+        static void call(rcu_head *head, rcu_callback_t func);
+        /* Waits for a grace period. Threads only, never the idle thread. */
+        static void synchronize();
+
+        static uint32_t getCompleted() { return gpCompleted; }
+        static uint32_t getCallbacksRun() { return callbacksRun; }
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _LIBK_RCU_H_
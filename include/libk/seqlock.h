@@ -0,0 +1,111 @@
+#ifndef _LIBK_SEQLOCK_H_
+#define _LIBK_SEQLOCK_H_ 1
+
+#include <asm.h>
+#include <libk/spinlock.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Sequence locks, for small data that is read far more often than written,
+ * such as the clock.
+ *
+ * Readers never write to the lock, so they don't take its cache line away
+ * from each other, and never make the writer wait. Instead they check that
+ * no write happened while they read and try again if one did:
+ *
+ *     uint32_t seq;
+ *     do {
+ *         seq = read_seqbegin(&lock);
+ *         copy = data;
+ *     } while (read_seqretry(&lock, seq));
+ *
+ * The writer makes the sequence odd for the duration of the update. A reader
+ * must not follow pointers it read in between, they may be stale; copy plain
+ * values out and use them after the loop.
+ *
+ * seqcount_t is the bare counter, for data whose writers are already
+ * serialized some other way. seqlock_t adds a spinlock for the writers.
+ * A reader spins while the sequence is odd, so a writer must not be
+ * interrupted by a reader on the same CPU: write with interrupts disabled if
+ * interrupt handlers read.
+ */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct {
+    volatile uint32_t sequence;
+} seqcount_t;
+
+#define SEQCOUNT_INIT { 0 }
+
+/*
+ * x86 keeps loads in order with loads and stores with stores, so the
+ * barriers the sequence needs only have to stop the compiler.
+ */
+inline uint32_t read_seqcount_begin(const seqcount_t *s) {
+    uint32_t seq;
+    while ((seq = s->sequence) & 1)
+        cpu_relax();
+    asm volatile("" : : : "memory");
+    return seq;
+}
+
+/* @return true if a write happened since read_seqcount_begin returned 'start'. */
+inline bool read_seqcount_retry(const seqcount_t *s, uint32_t start) {
+    asm volatile("" : : : "memory");
+    return s->sequence != start;
+}
+
+inline void write_seqcount_begin(seqcount_t *s) {
+    s->sequence = s->sequence + 1;
+    asm volatile("" : : : "memory");
+}
+
+inline void write_seqcount_end(seqcount_t *s) {
+    asm volatile("" : : : "memory");
+    s->sequence = s->sequence + 1;
+}
+
+typedef struct {
+    seqcount_t seq;
+    spinlock_t lock;
+} seqlock_t;
+
+#define SEQLOCK_INIT { SEQCOUNT_INIT, SPINLOCK_INIT }
+
+inline uint32_t read_seqbegin(const seqlock_t *sl) { return read_seqcount_begin(&sl->seq); }
+
+inline bool read_seqretry(const seqlock_t *sl, uint32_t start) {
+    return read_seqcount_retry(&sl->seq, start);
+}
+
+inline void write_seqlock(seqlock_t *sl) {
+    spin_lock(&sl->lock);
+    write_seqcount_begin(&sl->seq);
+}
+
+inline void write_sequnlock(seqlock_t *sl) {
+    write_seqcount_end(&sl->seq);
+    spin_unlock(&sl->lock);
+}
+
+inline uint32_t write_seqlock_irqsave(seqlock_t *sl) {
+    uint32_t flags = spin_lock_irqsave(&sl->lock);
+    write_seqcount_begin(&sl->seq);
+    return flags;
+}
+
+inline void write_sequnlock_irqrestore(seqlock_t *sl, uint32_t flags) {
+    write_seqcount_end(&sl->seq);
+    spin_unlock_irqrestore(&sl->lock, flags);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _LIBK_SEQLOCK_H_
@@ -0,0 +1,192 @@
+#ifndef _LIBK_SPINLOCK_H_
+#define _LIBK_SPINLOCK_H_ 1
+
+#include <asm.h>
+#include <libk/irqflags.h>
+#include <libk/lock_stats.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Spinlocks.
+ *
+ * A ticket lock: every CPU that wants the lock takes the next ticket and
+ * spins until 'owner' reaches it, so the lock is handed out in the order it
+ * was asked for and no CPU can be starved by the others. The waiters back off
+ * with pause in proportion to the number of tickets ahead of them.
+ *
+ *     static spinlock_t lock = SPINLOCK_INIT;
+ *
+ *     uint32_t flags = spin_lock_irqsave(&lock);
+ *     ...
+ *     spin_unlock_irqrestore(&lock, flags);
+ *
+ * Data that an interrupt handler touches as well must be locked with the
+ * irqsave (or irq) variants: an interrupt that wants the lock while the CPU
+ * it arrives on holds it would spin forever. Threads are only preempted on
+ * the way out of an interrupt, so those variants also keep the holder on the
+ * CPU. spin_lock() itself leaves interrupts and preemption alone; it is for
+ * code that already runs with interrupts disabled, e.g. interrupt handlers.
+ *
+ * Locks do not nest unless the code says in which order they are taken.
+ *
+ * rwlock_t lets any number of readers in at once, or one writer. A writer that
+ * has to wait stops new readers from coming in, so a stream of readers cannot
+ * starve it, and waiting writers are served in order. For data read far more
+ * often than it is written, seqlock.h is cheaper still.
+ */
+
+/* pause instructions per ticket ahead of us between two looks at the lock */
+#define SPIN_BACKOFF_PAUSES 32
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct spinlock {
+    union {
+        volatile uint32_t tickets;      /* Both halves, for spin_trylock */
+        struct {
+            volatile uint16_t owner;    /* Ticket being served */
+            volatile uint16_t next;     /* Next ticket to hand out */
+        };
+    };
+    struct lock_stats *stats;           /* Optional, see lock_stats.h */
+} spinlock_t;
+
+#define SPINLOCK_INIT                   { { 0 }, 0 }
+#define SPINLOCK_INIT_STATS(stats)      { { 0 }, stats }
+
+inline void spin_lock_init(spinlock_t *lock, struct lock_stats *stats = 0) {
+    lock->tickets = 0;
+    lock->stats = stats;
+}
+
+/* Waits for 'ticket' to be served, see spinlock.cpp. */
+void spin_lock_slow(spinlock_t *lock, uint16_t ticket);
+
+inline void spin_lock(spinlock_t *lock) {
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket)
+        spin_lock_slow(lock, ticket);
+    else if (lock->stats && LockStats::enabled)
+        LockStats::acquired(lock->stats);
+}
+
+/* Takes the lock only if nobody holds or waits for it. @return true if taken. */
+inline bool spin_trylock(spinlock_t *lock) {
+    uint32_t old = lock->tickets;
+    // Free when the next ticket is the one being served.
+    if ((old & 0xFFFF) != (old >> 16))
+        return false;
+    if (!__atomic_compare_exchange_n(&lock->tickets, &old, old + 0x10000, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return false;
+    if (lock->stats && LockStats::enabled)
+        LockStats::acquired(lock->stats);
+    return true;
+}
+
+inline void spin_unlock(spinlock_t *lock) {
+    // Only the holder writes 'owner', it is the waiters' signal.
+    __atomic_store_n(&lock->owner, (uint16_t)(lock->owner + 1), __ATOMIC_RELEASE);
+}
+
+inline bool spin_is_locked(spinlock_t *lock) {
+    uint32_t tickets = lock->tickets;
+    return (tickets & 0xFFFF) != (tickets >> 16);
+}
+
+/* Disables interrupts, takes the lock and returns the flags for spin_unlock_irqrestore. */
+inline uint32_t spin_lock_irqsave(spinlock_t *lock) {
+    uint32_t flags = local_irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+inline void spin_unlock_irqrestore(spinlock_t *lock, uint32_t flags) {
+    spin_unlock(lock);
+    local_irq_restore(flags);
+}
+
+/* For code that knows interrupts are enabled: spin_unlock_irq enables them. */
+inline void spin_lock_irq(spinlock_t *lock) {
+    local_irq_disable();
+    spin_lock(lock);
+}
+
+inline void spin_unlock_irq(spinlock_t *lock) {
+    spin_unlock(lock);
+    local_irq_enable();
+}
+
+/*
+ * Reader/writer lock. 'cnts' holds the readers, RW_LOCK_READER each, and the
+ * writer bits. Whoever cannot get in at once queues on 'wait', in order.
+ */
+#define RW_LOCK_LOCKED      0x0FF   /* A writer holds the lock */
+#define RW_LOCK_WAITING     0x100   /* A writer waits for the readers to leave */
+#define RW_LOCK_WRITER_MASK 0x1FF
+#define RW_LOCK_READER      0x200
+
+typedef struct {
+    volatile uint32_t cnts;
+    spinlock_t wait;
+} rwlock_t;
+
+#define RWLOCK_INIT { 0, SPINLOCK_INIT }
+
+/* Slow paths, see spinlock.cpp */
+void read_lock_slow(rwlock_t *lock);
+void write_lock_slow(rwlock_t *lock);
+
+inline void read_lock(rwlock_t *lock) {
+    uint32_t cnts = __atomic_add_fetch(&lock->cnts, RW_LOCK_READER, __ATOMIC_ACQUIRE);
+    if (cnts & RW_LOCK_WRITER_MASK)
+        read_lock_slow(lock);
+}
+
+inline void read_unlock(rwlock_t *lock) {
+    __atomic_fetch_sub(&lock->cnts, RW_LOCK_READER, __ATOMIC_RELEASE);
+}
+
+inline void write_lock(rwlock_t *lock) {
+    uint32_t expected = 0;
+    if (!__atomic_compare_exchange_n(&lock->cnts, &expected, RW_LOCK_LOCKED, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        write_lock_slow(lock);
+}
+
+inline void write_unlock(rwlock_t *lock) {
+    // Readers and a waiting writer may have set their bits meanwhile.
+    __atomic_fetch_sub(&lock->cnts, RW_LOCK_LOCKED, __ATOMIC_RELEASE);
+}
+
+inline uint32_t read_lock_irqsave(rwlock_t *lock) {
+    uint32_t flags = local_irq_save();
+    read_lock(lock);
+    return flags;
+}
+
+inline void read_unlock_irqrestore(rwlock_t *lock, uint32_t flags) {
+    read_unlock(lock);
+    local_irq_restore(flags);
+}
+
+inline uint32_t write_lock_irqsave(rwlock_t *lock) {
+    uint32_t flags = local_irq_save();
+    write_lock(lock);
+    return flags;
+}
+
+inline void write_unlock_irqrestore(rwlock_t *lock, uint32_t flags) {
+    write_unlock(lock);
+    local_irq_restore(flags);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _LIBK_SPINLOCK_H_
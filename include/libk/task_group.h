@@ -0,0 +1,108 @@
+#ifndef _LIBK_TASK_GROUP_H_
+#define _LIBK_TASK_GROUP_H_ 1
+
+#include <libk/spinlock.h>
+#include <libk/wait_queue.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Fork-join parallelism for bulk kernel work: zeroing frames, scanning the
+ * frame bitmap, checksumming a ramdisk.
+ *
+ * A TaskGroup runs tasks and waits for all of them:
+ *
+ *     TaskGroup group;
+ *     parallel_task tasks[2];
+ *     group.spawn(&tasks[0], zero_frames, &lower_half);
+ *     group.spawn(&tasks[1], zero_frames, &upper_half);
+ *     group.wait();
+ *
+ * parallel_for() cuts a range of indices into chunks of 'grain' indices and
+ * runs func(begin, end, arg) on every chunk:
+ *
+ *     parallel_for(0, words, 1024, count_words, &totals);
+ *
+ * Tasks run on the worker threads, one per CPU, that WorkerPool::init()
+ * starts once the APs are up. wait() does not sleep: the waiter runs queued
+ * tasks itself until there are none left and then spins until the workers
+ * are done with theirs, so the boot CPU's init code may wait as well as any
+ * thread. Before WorkerPool::init(), and on a single CPU, nothing is
+ * queued: spawn() runs the task on the spot and parallel_for() runs the
+ * whole range as a single chunk.
+ *
+ * Tasks must not block, and may not wait for another group: they may run
+ * in the idle loop of the CPU that waits.
+ */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef void (*task_func_t)(void *arg);
+/* Runs over indices [begin, end) */
+typedef void (*parallel_for_func_t)(uint32_t begin, uint32_t end, void *arg);
+
+class TaskGroup;
+
+/* A task of a group. It is owned by its user and never allocated here. */
+struct parallel_task {
+    struct parallel_task *next;     /* In the pool's queue */
+    task_func_t func;
+    void *arg;                      /* Passed to func */
+    TaskGroup *group;
+};
+
+class TaskGroup {
+    private:
+        /* Spawned tasks that have not finished */
+        volatile uint32_t pending;
+    public:
+        TaskGroup() : pending(0) {}
+        /* Runs func(arg) as 'task', which must stay put until wait() returns. */
+        void spawn(parallel_task *task, task_func_t func, void *arg);
+        /* Returns once every task spawned so far has finished. */
+        void wait();
+        /* Called by whoever ran a task of the group. */
+        void taskDone() { __atomic_sub_fetch(&pending, 1, __ATOMIC_RELEASE); }
+};
+
+class WorkerPool {
+    private:
+        static spinlock_t lock;
+        /* Tasks not started yet, oldest first */
+        static parallel_task *head;
+        static parallel_task *tail;
+        static volatile uint32_t queued;
+        /* Idle workers sleep here */
+        static wait_queue_t idle;
+        static uint32_t workers;
+        static uint32_t tasksRun;
+
+        static void workerMain(void *arg);
+        static parallel_task *take();
+    public:
+        /* Starts a worker per CPU online. Call once, after SMP::bootAps. */
+        static void init();
+        /* Queues 'task' for a worker. Safe from any context and CPU. */
+        static void submit(parallel_task *task);
+        /* Runs the oldest queued task. @return false if there was none. */
+        static bool runOne();
+        /* Worker threads, 0 while tasks run on the spot */
+        static uint32_t getWorkers() { return workers; }
+        static uint32_t getTasksRun() { return tasksRun; }
+};
+
+/*
+ * Runs func over [begin, end) in chunks of at most 'grain' indices, on as
+ * many CPUs as there are chunks, and returns once it covered the range.
+ */
+void parallel_for(uint32_t begin, uint32_t end, uint32_t grain,
+                  parallel_for_func_t func, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _LIBK_TASK_GROUP_H_
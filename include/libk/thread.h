@@ -0,0 +1,249 @@
+#ifndef _LIBK_THREAD_H_
+#define _LIBK_THREAD_H_
+
+#include <arch/i386/percpu.h>
+#include <data_structures/ws_deque.h>
+#include <libk/cache.h>
+#include <libk/spinlock.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Kernel threads.
+ *
+ * Every thread has its own kernel stack. A switch saves the callee-saved
+ * registers and EFLAGS on the old stack, swaps stack pointers and pops the
+ * same registers from the new one (switch_context in switch.S).
+ *
+ * Threads run on every CPU that is online. Each CPU has its own run queue, a
+ * work-stealing deque (data_structures/ws_deque.h): the CPU queues its ready
+ * threads at the bottom and takes them from the top, round robin, and a CPU
+ * with nothing to run steals from the top of another's queue without taking
+ * a lock. Only the owner may add to a deque, so other CPUs hand it threads
+ * through its inbox, a short list under a spinlock that it drains on every
+ * switch. Each CPU's boot context becomes its idle thread, which runs the
+ * idle loop (kernel_main on the boot CPU, SMP::apIdle on the others) and is
+ * picked only when there is nothing to run or to steal.
+ *
+ * wake() puts a thread back on the CPU it last ran on, whose caches may still
+ * hold its data, unless that CPU's queue is SCHED_WAKE_IMBALANCE threads
+ * longer than the waker's. A CPU queueing a thread it cannot run right away
+ * kicks an idle CPU over to steal it. Every SCHED_BALANCE_TICKS ticks, each
+ * CPU that ticks also looks for threads waiting while some CPU idles, in
+ * case a kick was missed.
+ *
+ * Threads are preempted round robin: the timer tick counts down the running
+ * thread's time slice and, once it is used up, the switch happens on the way
+ * out of the interrupt, when no other interrupt is being handled. The APs
+ * tick with their Local APIC timer while they run a thread; with the PIT as
+ * the timer they have no tick and their threads run until they block or
+ * yield. A thread can also give up the CPU at any time with yield(), or
+ * block() until another context wake()s it. preemptDisable()/preemptEnable()
+ * keep the current thread on its CPU.
+ *
+ * A thread that was switched away from stays 'onCpu' until the switch is
+ * over: only then is it queued again (preempted), handed to RCU to be freed
+ * (dead), or handed to its waker (blocked), so no other CPU can pick it while
+ * its stack is in use.
+ */
+
+#define THREAD_STACK_SIZE       16384
+#define THREAD_STACK_MAGIC      0x57AC4B1D  // At the bottom of every stack
+#define SCHED_TIMESLICE_TICKS   2
+#define SCHED_QUEUE_SIZE        256         // Threads a CPU's deque holds, a power of two
+#define SCHED_WAKE_IMBALANCE    2
+#define SCHED_BALANCE_TICKS     10
+
+enum thread_state {
+    THREAD_RUNNING,
+    THREAD_READY,       /* On a run queue */
+    THREAD_BLOCKED,     /* Waiting for wake() */
+    THREAD_DEAD,        /* Waiting for its stack to be freed */
+    THREAD_STATE_MASK = 0x3,
+    /* Or'ed in by a wake() that found the thread awake, see block() */
+    THREAD_WAKEUP = 0x100
+};
+
+typedef void (*thread_func_t)(void *arg);
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Thread control block */
+struct Thread {
+    uint32_t esp;               /* Saved stack pointer. Must stay first, see switch.S */
+    uint32_t id;
+    volatile uint32_t state;    /* A thread_state, and THREAD_WAKEUP */
+    const char *name;
+    uint8_t *stack;             /* Lowest address of the stack, 0 for idle threads */
+    thread_func_t func;
+    void *arg;                  /* Passed to func */
+    Thread *queueNext;          /* In an inbox, see sched_cpu */
+    uint32_t cpu;               /* CPU it runs or last ran on */
+    volatile bool onCpu;        /* Running, or still being switched away from */
+    uint32_t sliceLeft;         /* Ticks until it is preempted */
+    uint32_t switches;          /* Times it was switched to */
+    uint64_t runtimeNs;         /* Time spent running, up to the last switch */
+};
+
+/* Per-CPU scheduler counters, see Scheduler::getStats */
+struct sched_stats {
+    uint32_t switches;          /* Context switches */
+    uint32_t migrations;        /* Switches to a thread that last ran elsewhere */
+    uint32_t steals;            /* Threads taken from another CPU's queue */
+    uint32_t wakeLocal;         /* Wakeups queued here by this CPU */
+    uint32_t wakeRemote;        /* Wakeups queued here by other CPUs */
+    uint32_t kicks;             /* Idle CPUs sent to steal from here */
+};
+
+/* A CPU's run queue. The owner is the only one to push to its deque. */
+struct sched_cpu {
+    WorkStealingDeque<Thread, SCHED_QUEUE_SIZE> queue;
+    spinlock_t inboxLock;
+    Thread *inbox;              /* Threads other CPUs queued here, oldest first */
+    Thread *inboxTail;
+    volatile uint32_t inboxCount;
+    Thread *idle;
+    /* The thread switched away from, until finishSwitch */
+    Thread *prev;
+    bool requeuePrev;
+    uint32_t balanceTicks;
+    uint64_t lastSwitchNs;
+    sched_stats stats;
+} __cacheline_aligned;
+
+/*
+ * Preemption is off while preempt_count > 0, it is raised while handling
+ * interrupts. need_resched asks the CPU's current thread to give it up at the
+ * next chance.
+ */
+DECLARE_PER_CPU(uint32_t, preempt_count);
+DECLARE_PER_CPU(uint8_t, need_resched);
+DECLARE_PER_CPU(Thread *, current_thread);
+
+/* Switches stacks, see switch.S. Interrupts must be disabled. */
+void switch_context(uint32_t *old_esp, uint32_t new_esp);
+
+class Scheduler {
+    private:
+        static sched_cpu cpus[SMP_MAX_CPUS];
+        /* CPUs that run threads, and those of them halted in their idle loop */
+        static volatile uint32_t onlineMask;
+        static volatile uint32_t idleMask;
+        static volatile uint32_t nextId;
+
+        static sched_cpu *thisRq() { return &cpus[PerCpu::currentCpu()]; }
+        /* Threads waiting on a CPU's queue and inbox */
+        static uint32_t queued(const sched_cpu *rq) { return rq->queue.size() + rq->inboxCount; }
+        /* Queues a thread on the calling CPU. Interrupts must be disabled. */
+        static void pushLocal(sched_cpu *rq, Thread *thread);
+        static void pushInbox(sched_cpu *rq, Thread *thread);
+        static Thread *popInbox(sched_cpu *rq);
+        /* Moves the inbox to the deque, as far as it has room. */
+        static void drainInbox(sched_cpu *rq);
+        static Thread *pickNext(uint32_t cpu, sched_cpu *rq);
+        static Thread *steal(uint32_t cpu, sched_cpu *rq);
+        /* Picks the CPU a woken thread is queued on. */
+        static uint32_t selectCpu(Thread *thread, uint32_t self);
+        /*
+         * A thread was just queued on 'cpu': wakes that CPU if it idles, or
+         * else sends an idle one over to steal it.
+         */
+        static void kickIdle(uint32_t cpu, sched_cpu *rq);
+        /* Kicks idle CPUs over to any queue that is not empty. */
+        static void balance();
+        /*
+         * The tail of every switch, run by the thread switched to: lets go of
+         * the previous thread. Interrupts must be disabled.
+         */
+        static void finishSwitch();
+        /* First code run by every new thread. */
+        static void threadStart();
+        static void sleepWake(void *data);
+    public:
+        /* Turns the boot context into the boot CPU's idle thread. Call once. */
+        static void init();
+        /* Same for an AP, from the AP. It starts taking threads right away. */
+        static void initCpu(uint32_t cpu);
+        /*
+         * Creates a thread that runs func(arg) and queues it on the calling
+         * CPU. @return the thread, or 0 if there is no memory for it.
+         */
+        static Thread *create(const char *name, thread_func_t func, void *arg);
+        /* Ends the current thread. */
+        static void exit() __attribute__((noreturn));
+        /* Lets the other ready threads run first. */
+        static void yield();
+        /*
+         * Puts the current thread to sleep until wake(). Must be called with
+         * interrupts disabled, and returns with interrupts disabled.
+         * A wake() that comes in after the condition was checked but before
+         * the thread blocked is not lost: block() returns right away. It may
+         * also return for a wake() meant for an earlier wait, so always
+         * check the condition again:
+         *
+         *     while (!done)
+         *         Scheduler::block();
+         */
+        static void block();
+        /*
+         * Makes a blocked thread ready. Safe from any context and CPU.
+         * A dead thread is freed only after an RCU grace period, so the
+         * caller may wake a thread that could have exited meanwhile as long
+         * as it runs with preemption or interrupts disabled from the moment
+         * the thread may see its condition, as every waker here does.
+         */
+        static void wake(Thread *thread);
+        /* Blocks the current thread for at least 'ms' milliseconds. */
+        static void sleepMs(uint32_t ms);
+        /*
+         * Switches to the next ready thread, or to the idle thread if there
+         * is none and the current one cannot run. Interrupts must be disabled.
+         */
+        static void schedule();
+
+        /* Called by the timer interrupt on every tick of the calling CPU. */
+        static void tick();
+        /* Bracket every interrupt, see run_interrupt_handler. */
+        static void irqEnter() { this_cpu_inc(preempt_count); }
+        static void irqExit() {
+            this_cpu_dec(preempt_count);
+            if (this_cpu_read(preempt_count) == 0 && this_cpu_read(need_resched))
+                schedule();
+        }
+        static void preemptDisable() {
+            this_cpu_inc(preempt_count);
+            asm volatile("" : : : "memory");
+        }
+        static void preemptEnable();
+        static bool preemptible() { return this_cpu_read(preempt_count) == 0; }
+
+        /*
+         * Bracket the halt of an idle loop, with interrupts disabled and
+         * before its last hasReady(): a CPU queueing work after it kicks
+         * this one.
+         */
+        static void idleEnter();
+        static void idleExit();
+        /* True while 'cpu' is in its idle loop and may be about to halt. */
+        static bool isIdle(uint32_t cpu) { return idleMask & (1u << cpu); }
+
+        static Thread *getCurrent() { return this_cpu_read(current_thread); }
+        /* Interrupts or preemption must be off. */
+        static bool isIdle() { return getCurrent() == thisRq()->idle; }
+        /* True if the calling CPU has a thread to run or to steal. */
+        static bool hasReady();
+
+        /* Copies the counters of 'cpu'. @return false if it does not schedule. */
+        static bool getStats(uint32_t cpu, sched_stats *stats);
+        /* Writes every CPU's counters to the serial port. */
+        static void dumpStats();
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _LIBK_THREAD_H_
@@ -0,0 +1,161 @@
+#ifndef _LIBK_TIMER_WHEEL_H_
+#define _LIBK_TIMER_WHEEL_H_
+
+#include <asm.h>
+#include <data_structures/list.h>
+#include <devices/clocksource.h>
+#include <devices/timer.h>
+#include <libk/spinlock.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Kernel timers on a hierarchical timing wheel.
+ *
+ * Timers expire on timer ticks (TICKS_PER_SECOND). The wheel has five
+ * levels: the first has a slot for each of the next 256 ticks, every further
+ * level has 64 slots that each cover all the slots of the level below. A
+ * timer goes into the slot of the finest level that reaches its expiry, so
+ * adding and cancelling are O(1). Whenever the first level wraps around, the
+ * next slot of the level above is emptied into it (cascading), each timer
+ * moves down at most four times.
+ *
+ * The timer interrupt only checks whether something may be due. Expired
+ * timers run from a DEFERRED_PRIORITY_HIGH work item, with interrupts
+ * enabled, in expiry order within a tick. A callback may re-add its own
+ * timer. Timers can be added and cancelled from any context and CPU,
+ * including interrupt handlers and callbacks; a spinlock guards the wheel.
+ *
+ * The idle loop asks for the next expiry to decide how long the tick may
+ * stay stopped, see Timer::idle_enter.
+ */
+
+#define TIMER_WHEEL_ROOT_BITS   8
+#define TIMER_WHEEL_LEVEL_BITS  6
+#define TIMER_WHEEL_ROOT_SIZE   (1 << TIMER_WHEEL_ROOT_BITS)
+#define TIMER_WHEEL_LEVEL_SIZE  (1 << TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_LEVELS      4   // Above the root level
+#define TIMER_WHEEL_SLOTS       (TIMER_WHEEL_ROOT_SIZE + TIMER_WHEEL_LEVELS * TIMER_WHEEL_LEVEL_SIZE)
+// Furthest a timer can be in the future, in ticks. Later ones are clamped.
+#define TIMER_WHEEL_MAX_DELTA   0xFFFFFFFFULL
+
+typedef void (*ktimer_func_t)(void *data);
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* A kernel timer. It is owned by its user and never allocated here. */
+struct KTimer {
+    ListNode entry;             /* Links the timer into its wheel slot */
+    uint64_t expires;           /* Tick at which it runs */
+    ktimer_func_t func;
+    void *data;                 /* Passed to func */
+    uint32_t slot;              /* Wheel slot while pending, private to the wheel */
+};
+
+/* Fills in a timer. It must not be pending. */
+inline void ktimer_init(KTimer *timer, ktimer_func_t func, void *data) {
+    timer->entry.prev = timer->entry.next = &timer->entry;
+    timer->expires = 0;
+    timer->func = func;
+    timer->data = data;
+    timer->slot = 0;
+}
+
+/* Ticks covering at least 'ms' milliseconds */
+inline uint64_t msecs_to_ticks(uint32_t ms) {
+    return div64_32((uint64_t)ms * TICKS_PER_SECOND + 999, 1000);
+}
+
+/*
+ * Polled timeouts, for drivers that spin on a status bit:
+ *
+ *     timeout_t timeout;
+ *     timeout_start(&timeout, 500);
+ *     while (!(inb(STATUS) & READY))
+ *         if (timeout_expired(&timeout)) return false;
+ *
+ * They read the ClockSource, so they work with interrupts disabled.
+ */
+typedef struct {
+    uint64_t deadline_ns;
+} timeout_t;
+
+inline void timeout_start(timeout_t *timeout, uint32_t us) {
+    timeout->deadline_ns = ClockSource::nowNs() + (uint64_t)us * 1000;
+}
+
+inline bool timeout_expired(const timeout_t *timeout) {
+    return ClockSource::nowNs() >= timeout->deadline_ns;
+}
+
+class TimerWheel {
+    private:
+        typedef IntrusiveList<KTimer, &KTimer::entry> slot_t;
+        /*
+         * The root level's slots come first, then those of every further
+         * level. Built by init(), arrays of lists are not initialized
+         * statically.
+         */
+        static slot_t *slots;
+        static spinlock_t lock;
+        /* Bit n is set while slot n is not empty. */
+        static uint32_t slotMap[TIMER_WHEEL_SLOTS / 32];
+        /* The next tick the wheel will process */
+        static uint64_t current;
+        /* No timer expires before this tick. A hint, it may be early. */
+        static uint64_t nextHint;
+        static uint32_t pending;
+
+        /* The slot a timer expiring at 'expires' belongs in, right now. */
+        static uint32_t slotFor(uint64_t expires);
+        static void enqueue(KTimer *timer);
+        static void dequeue(KTimer *timer);
+        /* Re-files every timer of slot 'index' of 'level' one level down. */
+        static uint32_t cascade(uint32_t level, uint32_t index);
+        /* Distance from 'start' to the first busy slot of a level, or 'size'. */
+        static uint32_t findBusySlot(uint32_t first, uint32_t size, uint32_t start);
+        static uint64_t findNextExpiry();
+        static void runExpired(void *data);
+        /* Kicks the boot CPU if it may sleep past a timer just added, see add. */
+        static void wakeTimekeeper(uint64_t expires, uint64_t hint);
+    public:
+        /* Builds the wheel. Call once, before the timer interrupt is enabled. */
+        static void init();
+        /* Arms 'timer' to run at tick 'expires'. It must not be pending. */
+        static void add(KTimer *timer, uint64_t expires);
+        /*
+         * Moves 'timer' to tick 'expires', arming it if needed.
+         * @return true if it was pending.
+         */
+        static bool mod(KTimer *timer, uint64_t expires);
+        /*
+         * Disarms 'timer'. A callback that already started still runs to the end.
+         * @return true if it was pending.
+         */
+        static bool cancel(KTimer *timer);
+        static bool isPending(KTimer *timer) { return timer->entry.isLinked(); }
+        static uint32_t getPending() { return pending; }
+
+        /* Called by the timer interrupt with the new tick count. */
+        static void tick(uint64_t ticks);
+        /* Runs every timer that expired up to and including tick 'ticks'. */
+        static void run(uint64_t ticks);
+        /* Earliest tick a timer may expire at, TIMER_NO_EVENT if none is pending. */
+        static uint64_t nextExpiry();
+        /* nextExpiry() as ClockSource time, for Timer::idle_enter. */
+        static uint64_t nextExpiryNs();
+        /*
+         * The tick to add a timer for that must wait at least 'ms'
+         * milliseconds. Safe on any CPU, also while the tick is stopped.
+         */
+        static uint64_t expiryAfterMs(uint32_t ms);
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _LIBK_TIMER_WHEEL_H_
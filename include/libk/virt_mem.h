@@ -369,6 +369,13 @@ class VirtualMemoryManager {
      */
     void free_page(virtual_addr addr);
 
+    /*
+     * Maps the device registers at physical page 'paddr' to 'vaddr' with
+     * caching disabled. The frame is not taken from the PMM and is never
+     * returned to it.
+     */
+    bool map_mmio(physical_addr paddr, virtual_addr vaddr);
+
     /* Converts a virtual address to a physical address */
     uint32_t virt_to_phys(virtual_addr addr);
 
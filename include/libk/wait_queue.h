@@ -0,0 +1,138 @@
+#ifndef _LIBK_WAIT_QUEUE_H_
+#define _LIBK_WAIT_QUEUE_H_ 1
+
+#include <libk/cache.h>
+#include <libk/spinlock.h>
+#include <libk/thread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Wait queues: threads sleep on one until the event they wait for happens,
+ * instead of spinning or halting in a loop.
+ *
+ * A waiter names its condition and sleeps until it holds:
+ *
+ *     wait_event(&queue, head != tail);
+ *
+ * Whoever makes the condition true wakes it:
+ *
+ *     tail++;
+ *     WaitQueue::wakeOne(&queue);
+ *
+ * The waiter queues itself before it checks the condition, under the queue's
+ * lock, and the waker takes the same lock after changing it: either the
+ * waiter sees the change, or the waker sees the waiter. A wakeup that comes
+ * between the check and the sleep is kept by the scheduler, see
+ * Scheduler::block. Waiters are woken oldest first. wakeOne suits events
+ * only one of them can consume (a character, a free slot), wakeAll the
+ * others.
+ *
+ * Futex offers the same keyed by a word in memory instead of a queue object:
+ * Futex::wait sleeps only while the word holds the expected value, and
+ * Futex::wake wakes the threads sleeping on that address. The waiters of all
+ * addresses share FUTEX_HASH_BUCKETS queues, hashed by address, so nothing
+ * has to be set up per address.
+ *
+ * Only threads may wait, never the idle threads or interrupt handlers. Waking
+ * is safe from any context and CPU, interrupt handlers and deferred work
+ * included.
+ */
+
+#define FUTEX_HASH_BITS         6
+#define FUTEX_HASH_BUCKETS      (1 << FUTEX_HASH_BITS)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* A sleeping thread. Lives on the waiter's stack, see wait_event. */
+struct wait_entry {
+    struct wait_entry *next;
+    Thread *thread;
+    uintptr_t key;              /* Futex address, 0 on a plain wait queue */
+    volatile bool woken;        /* Taken off the queue by a waker */
+};
+
+/* Waiters are kept in a singly linked FIFO. All zeroes is an empty queue. */
+typedef struct {
+    spinlock_t lock;
+    struct wait_entry *head;
+    struct wait_entry *tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { SPINLOCK_INIT, 0, 0 }
+
+inline void wait_queue_init(wait_queue_t *wq) {
+    spin_lock_init(&wq->lock);
+    wq->head = 0;
+    wq->tail = 0;
+}
+
+class WaitQueue {
+    friend class Futex;
+    private:
+        /* Queue lock held for all three. */
+        static void append(wait_queue_t *wq, wait_entry *entry);
+        static void unlink(wait_queue_t *wq, wait_entry *entry, wait_entry *prev);
+        static void wakeEntry(wait_queue_t *wq, wait_entry *entry, wait_entry *prev);
+    public:
+        /* Queues the current thread on 'wq', before it checks its condition. */
+        static void prepare(wait_queue_t *wq, wait_entry *entry);
+        /* Sleeps until a waker takes 'entry' off the queue. */
+        static void sleep(wait_entry *entry);
+        /* Leaves 'wq' once the condition holds, unless a waker took 'entry' already. */
+        static void finish(wait_queue_t *wq, wait_entry *entry);
+
+        /* Wakes the oldest waiter. @return false if there was none. */
+        static bool wakeOne(wait_queue_t *wq);
+        /* Wakes every waiter. @return how many there were. */
+        static uint32_t wakeAll(wait_queue_t *wq);
+        static bool hasWaiters(const wait_queue_t *wq) { return wq->head != 0; }
+};
+
+/*
+ * Sleeps on 'wq' until 'condition' is true. The condition is evaluated again
+ * after every wakeup, and may be evaluated any number of times.
+ */
+#define wait_event(wq, condition) do {                                      \
+    struct wait_entry wait__;                                               \
+    for (;;) {                                                              \
+        WaitQueue::prepare((wq), &wait__);                                  \
+        if (condition)                                                      \
+            break;                                                          \
+        WaitQueue::sleep(&wait__);                                          \
+    }                                                                       \
+    WaitQueue::finish((wq), &wait__);                                       \
+} while (0)
+
+/* Keeps the buckets apart: waiters on different addresses don't share a line. */
+struct futex_bucket {
+    wait_queue_t queue;
+} __cacheline_aligned;
+
+class Futex {
+    private:
+        static futex_bucket buckets[FUTEX_HASH_BUCKETS];
+
+        static wait_queue_t *bucketFor(volatile uint32_t *addr);
+    public:
+        /*
+         * Sleeps until Futex::wake(addr), if *addr still equals 'expected'.
+         * @return false if *addr had changed already and it did not sleep.
+         */
+        static bool wait(volatile uint32_t *addr, uint32_t expected);
+        /*
+         * Wakes up to 'count' threads waiting on 'addr', oldest first.
+         * Change the word before, or a waiter may go back to sleep.
+         * @return how many it woke.
+         */
+        static uint32_t wake(volatile uint32_t *addr, uint32_t count);
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _LIBK_WAIT_QUEUE_H_
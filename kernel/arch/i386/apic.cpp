@@ -0,0 +1,150 @@
+#include <arch/i386/apic.h>
+#include <asm.h>
+#include <stdio.h>
+
+bool APIC::enabled = false;
+volatile uint32_t *APIC::lapic = 0;
+volatile uint32_t *APIC::ioapic = 0;
+physical_addr APIC::ioapicPhys = APIC_DEFAULT_IOAPIC_ADDR;
+uint8_t APIC::ioapicPins = 0;
+// Identity wiring, except that on virtually every PC the PIT (IRQ 0) is wired
+// to pin 2. The ACPI MADT or the MP table lists such overrides, SMP::detect
+// applies them. Without either we assume the common one.
+uint8_t APIC::irqToGsi[APIC_ISA_IRQS] = {
+    2, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+uint32_t APIC::ioapicRead(uint8_t reg) {
+    ioapic[IOAPIC_IOREGSEL / 4] = reg;
+    return ioapic[IOAPIC_IOWIN / 4];
+}
+
+void APIC::ioapicWrite(uint8_t reg, uint32_t value) {
+    ioapic[IOAPIC_IOREGSEL / 4] = reg;
+    ioapic[IOAPIC_IOWIN / 4] = value;
+}
+
+void APIC::maskPic() {
+    outb(0x21, 0xFF);
+    outb(0xA1, 0xFF);
+}
+
+void APIC::setPicMask(uint8_t irq, bool masked) {
+    uint16_t port = irq < 8 ? 0x21 : 0xA1;
+    uint8_t bit = 1 << (irq & 7);
+    uint8_t mask = inb(port);
+    outb(port, masked ? (mask | bit) : (mask & ~bit));
+}
+
+bool APIC::init(VirtualMemoryManager *vmm, bool use_apic) {
+    if (!use_apic) {
+        printf("APIC disabled, using the 8259 PIC.\n");
+        return false;
+    }
+
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & APIC_CPUID_FEATURE)) {
+        printf("No APIC found, using the 8259 PIC.\n");
+        return false;
+    }
+
+    // The Local APIC base comes from its MSR, the IO-APIC from the firmware
+    // tables (see SMP::detect) or its usual place.
+    uint64_t base = rdmsr(APIC_MSR_BASE);
+    physical_addr lapic_phys = (physical_addr)base & 0xFFFFF000;
+    if (!vmm->map_mmio(lapic_phys, APIC_LAPIC_VIRT_ADDR) ||
+        !vmm->map_mmio(ioapicPhys, APIC_IOAPIC_VIRT_ADDR)) {
+        printf("Could not map the APIC, using the 8259 PIC.\n");
+        return false;
+    }
+    lapic = (volatile uint32_t *)APIC_LAPIC_VIRT_ADDR;
+    ioapic = (volatile uint32_t *)APIC_IOAPIC_VIRT_ADDR;
+    ioapicPins = ((ioapicRead(IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+
+    // From here on the 8259 must stay quiet.
+    maskPic();
+
+    initCpu();
+    enabled = true;
+
+    // Start with every pin masked, then route the ISA IRQs to this CPU.
+    for (uint8_t pin = 0; pin < ioapicPins; pin++) {
+        ioapicWrite(IOAPIC_REG_REDTBL + 2 * pin, IOAPIC_REDIR_MASKED);
+        ioapicWrite(IOAPIC_REG_REDTBL + 2 * pin + 1, 0);
+    }
+    uint8_t apic_id = lapicId();
+    for (uint8_t irq = 0; irq < APIC_ISA_IRQS; irq++) {
+        // IRQ 2 is the PIC cascade, it never fires on its own.
+        if (irq == 2)
+            continue;
+        routeIrq(irq, APIC_IRQ_BASE_VECTOR + irq, apic_id);
+    }
+
+    printf("APIC enabled: LAPIC %lx id %u, IO-APIC %lx %u pins.\n", lapic_phys, apic_id,
+           ioapicPhys, ioapicPins);
+    return true;
+}
+
+void APIC::initCpu() {
+    // Every CPU's Local APIC sits at the same physical address, so the one
+    // mapping reaches whichever CPU makes the access.
+    wrmsr(APIC_MSR_BASE, rdmsr(APIC_MSR_BASE) | APIC_MSR_BASE_ENABLE);
+    // Software-enable the Local APIC and accept every priority.
+    lapicWrite(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+    lapicWrite(LAPIC_TPR, 0);
+    lapicWrite(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+}
+
+bool APIC::sendIpi(uint8_t apic_id, uint32_t command) {
+    if (!enabled)
+        return false;
+    // Whatever the target is told to look at must be in memory first.
+    __sync_synchronize();
+    lapicWrite(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapicWrite(LAPIC_ICR_LOW, command);
+    for (uint32_t spin = 0; spin < LAPIC_ICR_SEND_SPINS; spin++) {
+        if (!(lapicRead(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING))
+            return true;
+        cpu_relax();
+    }
+    return false;
+}
+
+void APIC::setIrqOverride(uint8_t irq, uint8_t gsi) {
+    if (irq < APIC_ISA_IRQS)
+        irqToGsi[irq] = gsi;
+}
+
+bool APIC::routeIrq(uint8_t irq, uint8_t vector, uint8_t apic_id) {
+    if (!enabled || irq >= APIC_ISA_IRQS || irqToGsi[irq] >= ioapicPins)
+        return false;
+    uint8_t pin = irqToGsi[irq];
+    // ISA interrupts are edge triggered and active high: fixed delivery,
+    // physical destination, unmasked.
+    ioapicWrite(IOAPIC_REG_REDTBL + 2 * pin + 1, (uint32_t)apic_id << 24);
+    ioapicWrite(IOAPIC_REG_REDTBL + 2 * pin, vector);
+    return true;
+}
+
+void APIC::maskIrq(uint8_t irq) {
+    if (irq >= APIC_ISA_IRQS)
+        return;
+    if (!enabled) {
+        setPicMask(irq, true);
+        return;
+    }
+    uint8_t reg = IOAPIC_REG_REDTBL + 2 * irqToGsi[irq];
+    ioapicWrite(reg, ioapicRead(reg) | IOAPIC_REDIR_MASKED);
+}
+
+void APIC::unmaskIrq(uint8_t irq) {
+    if (irq >= APIC_ISA_IRQS)
+        return;
+    if (!enabled) {
+        setPicMask(irq, false);
+        return;
+    }
+    uint8_t reg = IOAPIC_REG_REDTBL + 2 * irqToGsi[irq];
+    ioapicWrite(reg, ioapicRead(reg) & ~IOAPIC_REDIR_MASKED);
+}
@@ -1,6 +1,7 @@
 #include <arch/i386/gdt.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 /* References: 
  * https://wiki.osdev.org/GDT_Tutorial
  * http://www.jamesmolloy.co.uk/tutorial_html/4.-The%20GDT%20and%20IDT.html 
@@ -62,46 +63,100 @@ struct gdt_ptr {
   uint32_t base;            /* The address of the first gdt_entry_t struct. */
 } __attribute__((packed));  /* prevents compiler to optimize struct */
 
-/* Our GDT, with 3 entries, and finally our special GDT pointer */
-struct gdt_entry gdt[3];
-struct gdt_ptr gp;
+/*
+ * Task State Segment. The kernel does not switch tasks in hardware, it only
+ * needs the TSS for 'ss0:esp0', the stack loaded on a switch from ring 3 to
+ * ring 0.
+ */
+struct tss_entry {
+  uint32_t prev_tss;
+  uint32_t esp0;          /* Kernel stack pointer */
+  uint32_t ss0;           /* Kernel stack segment */
+  uint32_t esp1, ss1, esp2, ss2;
+  uint32_t cr3, eip, eflags, eax, ecx, edx, ebx, esp, ebp, esi, edi;
+  uint32_t es, cs, ss, ds, fs, gs, ldt;
+  uint16_t trap;
+  uint16_t iomap_base;    /* Past the limit: no I/O permission bitmap */
+} __attribute__((packed));
+
+#define GDT_NUM_ENTRIES 7
+
+/*
+ * Our GDTs, the TSSs and finally our special GDT pointers. Every CPU has its
+ * own: the TSS holds the stack that CPU enters the kernel on, and loading it
+ * marks its descriptor busy, so it cannot be shared.
+ */
+struct gdt_entry gdt[GDT_MAX_CPUS][GDT_NUM_ENTRIES];
+struct tss_entry tss[GDT_MAX_CPUS];
+struct gdt_ptr gp[GDT_MAX_CPUS];
 
 /* Function kernel/arch/i386/gdt_asm.S, loads GDT from the pointer of a gdt_ptr */
 extern void gdt_flush(struct gdt_ptr* gdt_ptr_addr);
+/* Function kernel/arch/i386/gdt_asm.S, loads the task register */
+extern void tss_flush(uint16_t selector);
+
+/* Setup a descriptor in the Global Descriptor Table of 'cpu' */
+void gdt_set_gate(uint32_t cpu, int32_t num, uint32_t base, uint32_t limit,
+                  uint8_t access, uint8_t gran) {
+  struct gdt_entry* entry = &gdt[cpu][num];
 
-/* Setup a descriptor in the Global Descriptor Table */
-void gdt_set_gate(int32_t num, uint32_t base, uint32_t limit, uint8_t access,
-                  uint8_t gran) {
   /* Setup the descriptor base address */
-  gdt[num].base_low = (base & 0xFFFF);
-  gdt[num].base_middle = (base >> 16) & 0xFF;
-  gdt[num].base_high = (base >> 24) & 0xFF;
+  entry->base_low = (base & 0xFFFF);
+  entry->base_middle = (base >> 16) & 0xFF;
+  entry->base_high = (base >> 24) & 0xFF;
 
   /* Setup the descriptor limits */
-  gdt[num].limit_low = (limit & 0xFFFF);
-  gdt[num].granularity = ((limit >> 16) & 0x0F);
+  entry->limit_low = (limit & 0xFFFF);
+  entry->granularity = ((limit >> 16) & 0x0F);
 
   /* Finally, set up the granularity and access flags */
-  gdt[num].granularity |= (gran & 0xF0);
-  gdt[num].access = access;
+  entry->granularity |= (gran & 0xF0);
+  entry->access = access;
 }
 
 /* Should be called by the kernal on initializaiton. This will setup the
- * special GDT pointer, set up the first 3 entries in our GDT, and then
+ * special GDT pointer, set up the entries in our GDT, and then
  * finally call gdt_flush() in our assembler file in order to tell the
  * processor where the new GDT is and update the new segment registers
  */
 void gdt_install() {
+  gdt_install_cpu(0, 0);
+  printf("GDT flushed and loaded.\n");
+}
+
+void gdt_install_cpu(uint32_t cpu, uint32_t esp0) {
   /* Setup the GDT pointer and limit */
-  gp.limit = (sizeof(struct gdt_entry) * 3) - 1;
-  gp.base = (uint32_t)&gdt;
+  gp[cpu].limit = (sizeof(struct gdt_entry) * GDT_NUM_ENTRIES) - 1;
+  gp[cpu].base = (uint32_t)&gdt[cpu];
+
+  gdt_set_gate(cpu, 0, 0, 0, 0, 0);                                    /* Our NULL descriptor */
+  gdt_set_gate(cpu, 1, 0, 0xFFFFFFFF, CODE_SELECTOR, FLATMODEL_GRAN);  /* Kernel code segment */
+  gdt_set_gate(cpu, 2, 0, 0xFFFFFFFF, DATA_SELECTOR, FLATMODEL_GRAN);  /* Kernel data segment */
+  gdt_set_gate(cpu, 3, 0, 0xFFFFFFFF, USER_CODE_SELECTOR, FLATMODEL_GRAN);  /* User code segment */
+  gdt_set_gate(cpu, 4, 0, 0xFFFFFFFF, USER_DATA_SELECTOR, FLATMODEL_GRAN);  /* User data segment */
 
-  gdt_set_gate(0, 0, 0, 0, 0);                                    /* Our NULL descriptor */
-  gdt_set_gate(1, 0, 0xFFFFFFFF, CODE_SELECTOR, FLATMODEL_GRAN);  /* Kernel code segment */
-  gdt_set_gate(2, 0, 0xFFFFFFFF, DATA_SELECTOR, FLATMODEL_GRAN);  /* Kernel data segment */
+  /* The TSS is byte granular, its limit is its size minus one */
+  memset(&tss[cpu], 0, sizeof(struct tss_entry));
+  tss[cpu].esp0 = esp0;
+  tss[cpu].ss0 = KERNEL_DATA_SEGMENT;
+  tss[cpu].iomap_base = sizeof(struct tss_entry);
+  gdt_set_gate(cpu, 5, (uint32_t)&tss[cpu], sizeof(struct tss_entry) - 1, TSS_SELECTOR, 0x00);
+
+  /* Flat until gdt_set_percpu_base moves it to the CPU's per-CPU area */
+  gdt_set_gate(cpu, 6, 0, 0xFFFFFFFF, DATA_SELECTOR, FLATMODEL_GRAN);   /* Per-CPU segment */
 
   /* Flush out the old GDT and install the new changes! */
-  gdt_flush(&gp);
+  gdt_flush(&gp[cpu]);
+  tss_flush(TSS_SEGMENT);
+  asm volatile("mov %0, %%gs" : : "r"((uint16_t)PERCPU_SEGMENT));
+}
 
-  printf("GDT flushed and loaded.\n");
-}
\ No newline at end of file
+void gdt_set_percpu_base(uint32_t cpu, uint32_t base) {
+  gdt_set_gate(cpu, 6, base, 0xFFFFFFFF, DATA_SELECTOR, FLATMODEL_GRAN);
+  /* The CPU caches the descriptor, reloading gs picks up the new base */
+  asm volatile("mov %0, %%gs" : : "r"((uint16_t)PERCPU_SEGMENT) : "memory");
+}
+
+void gdt_set_kernel_stack(uint32_t cpu, uint32_t esp0) {
+  tss[cpu].esp0 = esp0;
+}
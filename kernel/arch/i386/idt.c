@@ -76,6 +76,12 @@ DECLARE_INTERRUPT_HANDLER(45);
 DECLARE_INTERRUPT_HANDLER(46);
 DECLARE_INTERRUPT_HANDLER(47);
 
+/* APIC spurious interrupt */
+DECLARE_INTERRUPT_HANDLER(255);
+
+/* System calls, kernel/arch/i386/syscall_asm.S */
+void syscall_int80_entry(void);
+
 void set_idt_entry(uint8_t num, uint64_t handler, uint16_t sel, uint8_t flags) {
   idt[num].handler_lo = handler & 0xFFFF;
   idt[num].handler_hi = (handler >> 16) & 0xFFFF;
@@ -133,6 +139,12 @@ void idt_install() {
   SET_IDT_ENTRY(46);
   SET_IDT_ENTRY(47);
 
+  /* APIC spurious interrupt, must not be acknowledged */
+  SET_IDT_ENTRY(255);
+
+  /* System calls: a trap gate (interrupts stay enabled) that ring 3 may use */
+  set_idt_entry(128, (uint32_t) &syscall_int80_entry, 0x08, 0xEF);  /* SYSCALL_IDT_INDEX */
+
   // Remap PICs.
   outb(0x20, 0x10);
   outb(0xA0, 0x10);
@@ -148,4 +160,8 @@ void idt_install() {
   // Points the processor's internal register to the new IDT
   idt_load(&idtp);
   printf("IDT installed.\n");
+}
+
+void idt_load_cpu() {
+  idt_load(&idtp);
 }
\ No newline at end of file
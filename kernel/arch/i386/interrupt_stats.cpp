@@ -0,0 +1,79 @@
+#include <arch/i386/interrupt_stats.h>
+#include <arch/i386/percpu.h>
+#include <devices/serial.h>
+#include <libk/irqflags.h>
+#include <string.h>
+
+static DEFINE_PER_CPU(interrupt_vector_stats_t[IDT_NUM_ENTRIES], interrupt_stats);
+
+void InterruptStats::record(uint32_t vector, uint64_t cycles) {
+    interrupt_vector_stats_t *s = &(*this_cpu_ptr(interrupt_stats))[vector & (IDT_NUM_ENTRIES - 1)];
+    s->count++;
+    s->total_cycles += cycles;
+
+    uint32_t clamped = cycles > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)cycles;
+    if (clamped > s->max_cycles)
+        s->max_cycles = clamped;
+
+    uint32_t bucket = 31 - __builtin_clz(clamped | 1);
+    if (bucket >= INTERRUPT_STATS_BUCKETS)
+        bucket = INTERRUPT_STATS_BUCKETS - 1;
+    s->histogram[bucket]++;
+}
+
+void InterruptStats::snapshot(uint32_t vector, interrupt_vector_stats_t *out) {
+    memset(out, 0, sizeof(interrupt_vector_stats_t));
+    // The 64 bit total is two stores, keep this CPU's handler out while
+    // adding. Another CPU's total may be caught halfway through an update.
+    uint32_t flags = local_irq_save();
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!PerCpu::hasArea(cpu))
+            continue;
+        const interrupt_vector_stats_t *s = &per_cpu(interrupt_stats, cpu)[vector & (IDT_NUM_ENTRIES - 1)];
+        out->count += s->count;
+        out->total_cycles += s->total_cycles;
+        if (s->max_cycles > out->max_cycles)
+            out->max_cycles = s->max_cycles;
+        for (uint32_t bucket = 0; bucket < INTERRUPT_STATS_BUCKETS; bucket++)
+            out->histogram[bucket] += s->histogram[bucket];
+    }
+    local_irq_restore(flags);
+}
+
+void InterruptStats::reset() {
+    uint32_t flags = local_irq_save();
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (PerCpu::hasArea(cpu))
+            memset(&per_cpu(interrupt_stats, cpu), 0, sizeof(per_cpu__interrupt_stats));
+    }
+    local_irq_restore(flags);
+}
+
+void InterruptStats::dump() {
+    Serial::write("# openos interrupt stats v1\n");
+    for (uint32_t vector = 0; vector < IDT_NUM_ENTRIES; vector++) {
+        interrupt_vector_stats_t s;
+        snapshot(vector, &s);
+        if (!s.count)
+            continue;
+        Serial::write("V ");
+        Serial::writeDec(vector);
+        Serial::write(" count ");
+        Serial::writeDec(s.count);
+        Serial::write(" cycles ");
+        Serial::writeHex64(s.total_cycles);
+        Serial::write(" max ");
+        Serial::writeDec(s.max_cycles);
+        Serial::write(" hist");
+        for (uint32_t bucket = 0; bucket < INTERRUPT_STATS_BUCKETS; bucket++) {
+            if (!s.histogram[bucket])
+                continue;
+            Serial::putchar(' ');
+            Serial::writeDec(bucket);
+            Serial::putchar(':');
+            Serial::writeDec(s.histogram[bucket]);
+        }
+        Serial::putchar('\n');
+    }
+    Serial::write("# end\n");
+}
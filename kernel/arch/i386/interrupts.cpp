@@ -1,6 +1,13 @@
+#include <arch/i386/apic.h>
 #include <arch/i386/idt.h>
+#include <arch/i386/interrupt_stats.h>
 #include <arch/i386/interrupts.h>
 #include <asm.h>
+#include <libk/deferred_work.h>
+#include <libk/irq_trace.h>
+#include <libk/irqflags.h>
+#include <libk/rcu.h>
+#include <libk/thread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -18,92 +25,192 @@
  * - Traps: Traps are reported immediately after the execution of the trapping instruction.
  * - Aborts: Some severe unrecoverable error. 
  */
-interrupt_handler_t InterruptHandler::interrupt_handlers[] = {0};
+exception_handler_t InterruptHandler::exception_handlers[] = {0};
+interrupt_action* InterruptHandler::chains[] = {0};
+interrupt_dispatch_t InterruptHandler::dispatch[] = {0};
+uint32_t InterruptHandler::unhandled[] = {0};
+interrupt_action InterruptHandler::actionPool[INTERRUPT_MAX_ACTIONS];
+interrupt_action* InterruptHandler::freeActions = 0;
+static DEFINE_LOCK_STATS(chain_lock_stats, "irq chains");
+spinlock_t InterruptHandler::chainLock = SPINLOCK_INIT_STATS(&chain_lock_stats);
 
 InterruptHandler::InterruptHandler() {
-  register_interrupt_handler(0, divideByZeroExceptionHandler);
-  register_interrupt_handler(1, debugExceptionHandler);
-  register_interrupt_handler(2, nonMaskableInterruptExceptionHandler);
-  register_interrupt_handler(3, breakpointExceptionHandler);
-  register_interrupt_handler(4, intoDetectedOverflowExceptionHandler);
-  register_interrupt_handler(5, outOfBoundsExceptionHandler);
-  register_interrupt_handler(6, invalidOpcodeExceptionHandler);
-  register_interrupt_handler(7, noCoprocessorExceptionHandler);
-  register_interrupt_handler(8, doubleFaultExceptionHandler);
-  register_interrupt_handler(9, coprocessorSegmentOverrunExceptionHandler);
-  register_interrupt_handler(10, badTssExceptionHandler);
-  register_interrupt_handler(11, segmentNotPresentExceptionHandler);
-  register_interrupt_handler(12, stackFaultExceptionHandler);
-  register_interrupt_handler(13, generalProtectionFaultExceptionHandler);
-  register_interrupt_handler(14, pageFaultExceptionHandler);
-  register_interrupt_handler(15, unkownInterruptExceptionHandler);
-  register_interrupt_handler(16, coprocessorFaultExceptionHandler);
-  register_interrupt_handler(17, alignmentCheckExceptionHandler);
-  register_interrupt_handler(18, machineCheckExceptionHandler);
-}
-
-bool InterruptHandler::register_interrupt_handler(uint32_t idt_index, interrupt_handler_t handler) {
-  if (idt_index >= IDT_NUM_ENTRIES) {
+  // Every vector needs a dispatch function before the first interrupt.
+  for (uint32_t i = 0; i < INTERRUPT_MAX_ACTIONS; i++) {
+    actionPool[i].next = freeActions;
+    freeActions = &actionPool[i];
+  }
+  for (uint32_t i = 0; i < IDT_NUM_ENTRIES; i++) {
+    updateDispatch(i);
+  }
+
+  register_exception_handler(0, divideByZeroExceptionHandler);
+  register_exception_handler(1, debugExceptionHandler);
+  register_exception_handler(2, nonMaskableInterruptExceptionHandler);
+  register_exception_handler(3, breakpointExceptionHandler);
+  register_exception_handler(4, intoDetectedOverflowExceptionHandler);
+  register_exception_handler(5, outOfBoundsExceptionHandler);
+  register_exception_handler(6, invalidOpcodeExceptionHandler);
+  register_exception_handler(7, noCoprocessorExceptionHandler);
+  register_exception_handler(8, doubleFaultExceptionHandler);
+  register_exception_handler(9, coprocessorSegmentOverrunExceptionHandler);
+  register_exception_handler(10, badTssExceptionHandler);
+  register_exception_handler(11, segmentNotPresentExceptionHandler);
+  register_exception_handler(12, stackFaultExceptionHandler);
+  register_exception_handler(13, generalProtectionFaultExceptionHandler);
+  register_exception_handler(14, pageFaultExceptionHandler);
+  register_exception_handler(15, unkownInterruptExceptionHandler);
+  register_exception_handler(16, coprocessorFaultExceptionHandler);
+  register_exception_handler(17, alignmentCheckExceptionHandler);
+  register_exception_handler(18, machineCheckExceptionHandler);
+}
+
+bool InterruptHandler::register_exception_handler(uint32_t idt_index, exception_handler_t handler) {
+  if (idt_index >= EXCEPTION_NUM_ENTRIES) {
     return false;
   }
-  
-  if (interrupt_handlers[idt_index] != NULL) {
+
+  if (exception_handlers[idt_index] != NULL) {
     return false;
   }
 
-  interrupt_handlers[idt_index] = handler;
+  exception_handlers[idt_index] = handler;
+  updateDispatch(idt_index);
   return true;
 }
 
-void InterruptHandler::fault_handler(struct regs *r) {
-  if(r->idt_index <19) {
-    void (*handler)(struct regs * r);
+bool InterruptHandler::register_interrupt_handler(uint32_t idt_index, interrupt_handler_t handler,
+                                                  void* data) {
+  if (idt_index < EXCEPTION_NUM_ENTRIES || idt_index >= IDT_NUM_ENTRIES || !handler) {
+    return false;
+  }
 
-    handler = interrupt_handlers[r->idt_index];
+  uint32_t flags = spin_lock_irqsave(&chainLock);
+  interrupt_action* action = freeActions;
+  if (!action) {
+    spin_unlock_irqrestore(&chainLock, flags);
+    printf("No room for another interrupt handler on %lu\n", idt_index);
+    return false;
+  }
+  freeActions = action->next;
+  action->handler = handler;
+  action->data = data;
+  action->next = NULL;
+
+  // Append, so handlers run in the order they were registered.
+  interrupt_action** link = &chains[idt_index];
+  while (*link) {
+    link = &(*link)->next;
+  }
+  rcu_assign_pointer(*link, action);
+  updateDispatch(idt_index);
+  spin_unlock_irqrestore(&chainLock, flags);
+  return true;
+}
+
+bool InterruptHandler::unregister_interrupt_handler(uint32_t idt_index, interrupt_handler_t handler,
+                                                    void* data) {
+  if (idt_index >= IDT_NUM_ENTRIES) {
+    return false;
+  }
 
-    if (handler) {
-      handler(r);
+  uint32_t flags = spin_lock_irqsave(&chainLock);
+  for (interrupt_action** link = &chains[idt_index]; *link; link = &(*link)->next) {
+    interrupt_action* action = *link;
+    if (action->handler == handler && action->data == data) {
+      rcu_assign_pointer(*link, action->next);
+      updateDispatch(idt_index);
+      spin_unlock_irqrestore(&chainLock, flags);
+      Rcu::call(&action->rcu, releaseAction);
+      return true;
     }
+  }
+  spin_unlock_irqrestore(&chainLock, flags);
+  return false;
+}
+
+void InterruptHandler::releaseAction(struct rcu_head* head) {
+  interrupt_action* action =
+      (interrupt_action*)((uint8_t*)head - offsetof(interrupt_action, rcu));
+  uint32_t flags = spin_lock_irqsave(&chainLock);
+  action->next = freeActions;
+  freeActions = action;
+  spin_unlock_irqrestore(&chainLock, flags);
+}
+
+void InterruptHandler::updateDispatch(uint32_t idt_index) {
+  interrupt_action* chain = chains[idt_index];
+  bool shared = chain && chain->next;
+
+  if (idt_index < EXCEPTION_NUM_ENTRIES) {
+    // Reserved exceptions (19-31) and ones without a handler stop the system.
+    dispatch[idt_index] = (idt_index < 19) ? dispatchException : dispatchFatal;
+  } else if (idt_index >= IRQ_FIRST_IDT_INDEX && idt_index <= IRQ_LAST_IDT_INDEX) {
+    dispatch[idt_index] = !chain ? dispatchIrqNone : shared ? dispatchIrqShared : dispatchIrqSingle;
   } else {
-    printf("Unhandled Exception. System Halted! %d\n", r->idt_index);
-    for (;;);
+    dispatch[idt_index] = !chain ? dispatchNone : shared ? dispatchShared : dispatchSingle;
   }
 }
 
-void InterruptHandler::irq_handler(struct regs *r) {
-  // Blank function pointer
-  void (*handler)(struct regs * r);
+bool InterruptHandler::runChain(struct regs* r) {
+  bool handled = false;
+  for (interrupt_action* action = rcu_dereference(chains[r->idt_index]); action;
+       action = rcu_dereference(action->next)) {
+    if (action->handler(r, action->data) == INTERRUPT_HANDLED) {
+      handled = true;
+    }
+  }
+  return handled;
+}
 
-  // If there's a custom handler to handle the IRQ, handle it
-  handler = interrupt_handlers[r->idt_index];
+void InterruptHandler::dispatchException(struct regs* r) {
+  exception_handler_t handler = exception_handlers[r->idt_index];
   if (handler) {
     handler(r);
   }
+}
 
-  // If the IDT entry that was invoked was greater than 40, sends an EOI
-  // to the slave controller
-  if (r->idt_index >= 40) {
-    outb(0xA0, 0x20);
-  }
+void InterruptHandler::dispatchFatal(struct regs* r) {
+  printf("Unhandled Exception. System Halted! %d\n", r->idt_index);
+  halt_forever();
+}
 
-  // Sends an EOI to the master interrupt controller
-  outb(0x20, 0x20);
+void InterruptHandler::dispatchIrqNone(struct regs* r) {
+  unhandled[r->idt_index]++;
+  // Tells the interrupt controller (APIC or PIC) that we are done
+  APIC::eoi(r->idt_index);
 }
 
-void InterruptHandler::runInterruptHandler(struct regs* r) {
-  size_t idt_index = r->idt_index;
-  if (idt_index < 32) {
-    fault_handler(r);
-    return;
+void InterruptHandler::dispatchIrqSingle(struct regs* r) {
+  // The handler may have just been removed, the dispatch function follows.
+  interrupt_action* action = rcu_dereference(chains[r->idt_index]);
+  if (!action || action->handler(r, action->data) != INTERRUPT_HANDLED) {
+    unhandled[r->idt_index]++;
   }
+  APIC::eoi(r->idt_index);
+}
+
+void InterruptHandler::dispatchIrqShared(struct regs* r) {
+  if (!runChain(r)) {
+    unhandled[r->idt_index]++;
+  }
+  APIC::eoi(r->idt_index);
+}
 
-  if (idt_index >= 32 && idt_index <= 47) {
-    irq_handler(r);
-    return;
+void InterruptHandler::dispatchNone(struct regs* r) {
+  unhandled[r->idt_index]++;
+}
+
+void InterruptHandler::dispatchSingle(struct regs* r) {
+  interrupt_action* action = rcu_dereference(chains[r->idt_index]);
+  if (!action || action->handler(r, action->data) != INTERRUPT_HANDLED) {
+    unhandled[r->idt_index]++;
   }
+}
 
-  if (interrupt_handlers[r->idt_index] != NULL) {
-    interrupt_handlers[r->idt_index](r);
+void InterruptHandler::dispatchShared(struct regs* r) {
+  if (!runChain(r)) {
+    unhandled[r->idt_index]++;
   }
 }
 
@@ -161,7 +268,7 @@ void InterruptHandler::doubleFaultExceptionHandler(struct regs* r) {
    * A double fault cannot be recovered. The faulting process must be terminated. 
    */
   printf("Double fault\n");
-  for (;;); //TODO use asm hlt or even better use kpanic
+  halt_forever();
 }
 
 void InterruptHandler::coprocessorSegmentOverrunExceptionHandler(struct regs* r) {
@@ -267,6 +374,28 @@ void InterruptHandler::machineCheckExceptionHandler(struct regs* r) {
   printf("Machine check exception\n");
 }
 
-extern "C" void run_interrupt_handler(struct regs* r) {
+extern "C" void run_interrupt_handler(struct regs* r, uint64_t entry_tsc) {
+  Scheduler::irqEnter();
+  Rcu::irqEnter();
+
+  // The CPU cleared IF on entry, the window started at the stub's rdtsc.
+  if (IrqOffTracer::enabled) {
+    IrqOffTracer::interruptEntry(r->idt_index, r->eip, entry_tsc);
+  }
+
   InterruptHandler::runInterruptHandler(r);
+  InterruptStats::record(r->idt_index, rdtsc() - entry_tsc);
+
+  // Whatever an IRQ handler deferred runs now, with interrupts enabled.
+  if (r->idt_index >= IRQ_FIRST_IDT_INDEX && r->idt_index <= IRQ_LAST_IDT_INDEX) {
+    DeferredWorkQueue::irqExit();
+  }
+
+  // The outermost interrupt may switch threads, the frame stays on this
+  // thread's stack until it runs again.
+  Scheduler::irqExit();
+
+  if (IrqOffTracer::enabled) {
+    IrqOffTracer::interruptExit(r->eflags);
+  }
 }
\ No newline at end of file
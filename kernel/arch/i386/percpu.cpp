@@ -0,0 +1,32 @@
+#include <arch/i386/percpu.h>
+
+#include <libk/heap_mem.h>
+#include <stdio.h>
+#include <string.h>
+
+DEFINE_PER_CPU(uint32_t, cpu_number) = 0;
+DEFINE_PER_CPU(uint32_t, this_cpu_off) = 0;
+
+uint32_t PerCpu::offsets[SMP_MAX_CPUS];
+
+void PerCpu::fill(uint8_t *copy, uint32_t cpu) {
+    memcpy(copy, __per_cpu_start, getSize());
+    offsets[cpu] = copy - __per_cpu_start;
+    per_cpu(cpu_number, cpu) = cpu;
+    per_cpu(this_cpu_off, cpu) = offsets[cpu];
+}
+
+void PerCpu::initBoot() {
+    fill(__per_cpu_boot, 0);
+    load(0);
+    printf("Per-CPU area: %lu bytes.\n", getSize());
+}
+
+bool PerCpu::allocate(uint32_t cpu) {
+    // Page aligned, which keeps it off the cache lines of other data.
+    uint8_t *copy = (uint8_t *)kmalloc_aligned(getSize());
+    if (!copy)
+        return false;
+    fill(copy, cpu);
+    return true;
+}
@@ -0,0 +1,401 @@
+#include <arch/i386/smp.h>
+
+#include <arch/i386/apic.h>
+#include <arch/i386/gdt.h>
+#include <arch/i386/idt.h>
+#include <arch/i386/percpu.h>
+#include <arch/i386/syscall.h>
+#include <asm.h>
+#include <devices/clockevent.h>
+#include <devices/clocksource.h>
+#include <devices/timer.h>
+#include <libk/heap_mem.h>
+#include <libk/rcu.h>
+#include <libk/thread.h>
+#include <libk/timer_wheel.h>
+#include <stdio.h>
+#include <string.h>
+
+cpu_info SMP::cpus[SMP_MAX_CPUS];
+uint32_t SMP::cpuCount = 0;
+volatile uint32_t SMP::onlineCount = 1;
+VirtualMemoryManager *SMP::vmm = 0;
+
+const void *SMP::mapTable(physical_addr paddr, uint32_t length) {
+    // The first MB is identity mapped
+    if (paddr + length <= LOW_MEMORY_END)
+        return (const void *)paddr;
+    physical_addr first = paddr & ~(PAGE_SIZE - 1);
+    uint32_t pages = (paddr + length - first + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pages > SMP_TABLE_WINDOW_PAGES)
+        return 0;
+    for (uint32_t page = 0; page < pages; page++) {
+        if (!vmm->map_mmio(first + page * PAGE_SIZE, SMP_TABLE_VIRT_ADDR + page * PAGE_SIZE))
+            return 0;
+    }
+    return (const void *)(SMP_TABLE_VIRT_ADDR + (paddr - first));
+}
+
+bool SMP::checksumOk(const void *table, uint32_t length) {
+    const uint8_t *bytes = (const uint8_t *)table;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++)
+        sum += bytes[i];
+    return sum == 0;
+}
+
+physical_addr SMP::scan(physical_addr start, physical_addr end, const char *signature,
+                        uint32_t length) {
+    size_t signature_len = strlen(signature);
+    for (physical_addr addr = start; addr + length <= end; addr += 16) {
+        if (memcmp((const void *)addr, signature, signature_len) == 0 &&
+            checksumOk((const void *)addr, length))
+            return addr;
+    }
+    return 0;
+}
+
+physical_addr SMP::findInBios(const char *signature, uint32_t length) {
+    // The first KB of the Extended BIOS Data Area, then the BIOS ROM. The BIOS
+    // data area holds the EBDA's segment.
+    const uint16_t *ebda_segment = (const uint16_t *)SMP_EBDA_SEGMENT_PTR;
+    // GCC takes pointers into the first page for null pointer arithmetic
+    asm("" : "+r"(ebda_segment));
+    physical_addr ebda = (physical_addr)*ebda_segment << 4;
+    physical_addr found = 0;
+    if (ebda && ebda < LOW_MEMORY_END)
+        found = scan(ebda, ebda + SMP_EBDA_SEARCH_LEN, signature, length);
+    if (!found)
+        found = scan(SMP_BIOS_ROM_START, SMP_BIOS_ROM_END, signature, length);
+    return found;
+}
+
+void SMP::addCpu(uint8_t apic_id) {
+    if (cpuCount == SMP_MAX_CPUS) {
+        printf("SMP: CPU with APIC id %u ignored, the kernel supports %u.\n", apic_id,
+               SMP_MAX_CPUS);
+        return;
+    }
+    cpus[cpuCount++].apicId = apic_id;
+}
+
+bool SMP::parseMadt(physical_addr rsdt_addr) {
+    const acpi_header *rsdt = (const acpi_header *)mapTable(rsdt_addr, sizeof(acpi_header));
+    if (!rsdt || memcmp(rsdt->signature, "RSDT", 4) != 0)
+        return false;
+    // The window is reused for every table, so copy the pointers out first.
+    uint32_t tables[SMP_ACPI_MAX_TABLES];
+    uint32_t length = rsdt->length;
+    rsdt = (const acpi_header *)mapTable(rsdt_addr, length);
+    if (!rsdt || length < sizeof(acpi_header) || !checksumOk(rsdt, length))
+        return false;
+    uint32_t count = (length - sizeof(acpi_header)) / sizeof(uint32_t);
+    if (count > SMP_ACPI_MAX_TABLES)
+        count = SMP_ACPI_MAX_TABLES;
+    memcpy(tables, rsdt + 1, count * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < count; i++) {
+        const acpi_header *header = (const acpi_header *)mapTable(tables[i], sizeof(acpi_header));
+        if (!header || memcmp(header->signature, "APIC", 4) != 0)
+            continue;
+        length = header->length;
+        const acpi_madt *madt = (const acpi_madt *)mapTable(tables[i], length);
+        if (!madt || length < sizeof(acpi_madt) || !checksumOk(madt, length))
+            return false;
+
+        // Only the overrides the firmware lists differ from identity wiring.
+        for (uint8_t irq = 0; irq < APIC_ISA_IRQS; irq++)
+            APIC::setIrqOverride(irq, irq);
+        const uint8_t *entry = (const uint8_t *)(madt + 1);
+        const uint8_t *end = (const uint8_t *)madt + length;
+        while (entry + sizeof(madt_entry) <= end) {
+            const madt_entry *e = (const madt_entry *)entry;
+            if (e->length < sizeof(madt_entry) || entry + e->length > end)
+                break;
+            if (e->type == MADT_LAPIC) {
+                const madt_lapic *lapic = (const madt_lapic *)e;
+                if (lapic->flags & MADT_LAPIC_ENABLED)
+                    addCpu(lapic->apicId);
+            } else if (e->type == MADT_IOAPIC) {
+                // The one serving the ISA IRQs
+                const madt_ioapic *ioapic = (const madt_ioapic *)e;
+                if (ioapic->gsiBase == 0)
+                    APIC::setIoapicAddress(ioapic->address);
+            } else if (e->type == MADT_ISO) {
+                const madt_iso *iso = (const madt_iso *)e;
+                APIC::setIrqOverride(iso->source, iso->gsi);
+            }
+            entry += e->length;
+        }
+        return cpuCount > 0;
+    }
+    return false;
+}
+
+bool SMP::parseMpTable(physical_addr floating_addr) {
+    const mp_floating *floating = (const mp_floating *)floating_addr;
+    if (!floating->configAddress)
+        return false;   // A default configuration, without a table
+    physical_addr config_addr = floating->configAddress;
+    const mp_config *config = (const mp_config *)mapTable(config_addr, sizeof(mp_config));
+    if (!config || memcmp(config->signature, "PCMP", 4) != 0)
+        return false;
+    uint32_t length = config->length;
+    config = (const mp_config *)mapTable(config_addr, length);
+    if (!config || length < sizeof(mp_config) || !checksumOk(config, length))
+        return false;
+
+    // Bus entries come first. Interrupt entries name their source bus by id.
+    bool isa_bus[MP_MAX_BUSES];
+    memset(isa_bus, 0, sizeof(isa_bus));
+    bool ioapic_found = false;
+    for (uint8_t irq = 0; irq < APIC_ISA_IRQS; irq++)
+        APIC::setIrqOverride(irq, irq);
+    const uint8_t *entry = (const uint8_t *)(config + 1);
+    const uint8_t *end = (const uint8_t *)config + length;
+    for (uint32_t i = 0; i < config->entryCount && entry < end; i++) {
+        switch (*entry) {
+            case MP_ENTRY_PROCESSOR: {
+                const mp_processor *processor = (const mp_processor *)entry;
+                if (processor->flags & MP_PROCESSOR_ENABLED)
+                    addCpu(processor->apicId);
+                entry += sizeof(mp_processor);
+                break;
+            }
+            case MP_ENTRY_BUS: {
+                const mp_bus *bus = (const mp_bus *)entry;
+                if (bus->busId < MP_MAX_BUSES)
+                    isa_bus[bus->busId] = memcmp(bus->busType, "ISA", 3) == 0;
+                entry += sizeof(mp_bus);
+                break;
+            }
+            case MP_ENTRY_IOAPIC: {
+                // Assume the first usable one serves the ISA IRQs
+                const mp_ioapic *ioapic = (const mp_ioapic *)entry;
+                if ((ioapic->flags & MP_IOAPIC_ENABLED) && !ioapic_found) {
+                    APIC::setIoapicAddress(ioapic->address);
+                    ioapic_found = true;
+                }
+                entry += sizeof(mp_ioapic);
+                break;
+            }
+            case MP_ENTRY_IO_INTERRUPT: {
+                const mp_io_interrupt *interrupt = (const mp_io_interrupt *)entry;
+                if (interrupt->interruptType == 0 && interrupt->sourceBus < MP_MAX_BUSES &&
+                    isa_bus[interrupt->sourceBus])
+                    APIC::setIrqOverride(interrupt->sourceIrq, interrupt->destPin);
+                entry += sizeof(mp_io_interrupt);
+                break;
+            }
+            default:
+                // Local interrupt assignments, and anything unknown, are 8 bytes
+                entry += 8;
+                break;
+        }
+    }
+    return cpuCount > 0;
+}
+
+void SMP::detect(VirtualMemoryManager *vmm) {
+    SMP::vmm = vmm;
+    const char *source = "ACPI";
+    physical_addr rsdp = findInBios("RSD PTR ", sizeof(acpi_rsdp));
+    if (!rsdp || !parseMadt(((const acpi_rsdp *)rsdp)->rsdtAddress)) {
+        cpuCount = 0;
+        source = "MP table";
+        physical_addr floating = findInBios("_MP_", sizeof(mp_floating));
+        if (!floating || !parseMpTable(floating)) {
+            cpuCount = 0;
+            source = "no tables";
+        }
+    }
+
+    // The BSP goes first. Its initial APIC id comes from CPUID.1:EBX.
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    uint8_t bsp_id = ebx >> 24;
+    uint32_t bsp = 0;
+    while (bsp < cpuCount && cpus[bsp].apicId != bsp_id)
+        bsp++;
+    if (bsp == cpuCount) {
+        // Not listed, or no tables at all: run on the BSP alone.
+        cpuCount = 0;
+        addCpu(bsp_id);
+        bsp = 0;
+    }
+    cpus[bsp].apicId = cpus[0].apicId;
+    cpus[0].apicId = bsp_id;
+    cpus[0].online = true;
+    printf("SMP: %lu CPUs found (%s), BSP APIC id %u.\n", cpuCount, source, bsp_id);
+}
+
+void SMP::delayUs(uint32_t us) {
+    if (ClockSource::usesTsc()) {
+        timeout_t timeout;
+        timeout_start(&timeout, us);
+        while (!timeout_expired(&timeout))
+            cpu_relax();
+        return;
+    }
+    // Without the TSC the clock only moves with the tick, which is not
+    // running yet. A read of the POST port takes about a microsecond.
+    for (uint32_t i = 0; i < us; i++)
+        inb(0x80);
+}
+
+void SMP::installTrampoline() {
+    uint32_t size = smp_trampoline_end - smp_trampoline_start;
+    memcpy((void *)SMP_TRAMPOLINE_PADDR, smp_trampoline_start, size);
+    smp_trampoline_params *params = (smp_trampoline_params *)
+        (SMP_TRAMPOLINE_PADDR + (smp_trampoline_data - smp_trampoline_start));
+    params->gdtBase = SMP_TRAMPOLINE_PADDR + (smp_trampoline_gdt - smp_trampoline_start);
+    params->protectedEntry =
+        SMP_TRAMPOLINE_PADDR + (smp_trampoline_protected - smp_trampoline_start);
+    params->cr3 = read_cr3();
+    params->cr4 = read_cr4();
+}
+
+bool SMP::startAp(uint32_t cpu) {
+    cpu_info *info = &cpus[cpu];
+    info->stack = (uint8_t *)kmalloc(SMP_AP_STACK_SIZE);
+    if (!info->stack || !PerCpu::allocate(cpu))
+        return false;
+
+    volatile smp_trampoline_params *params = (volatile smp_trampoline_params *)
+        (SMP_TRAMPOLINE_PADDR + (smp_trampoline_data - smp_trampoline_start));
+    params->stack = (uint32_t)info->stack + SMP_AP_STACK_SIZE;
+    params->cpu = cpu;
+
+    // INIT resets the AP into its wait-for-SIPI state. The startup IPI's
+    // vector is the page it begins executing at.
+    uint8_t id = info->apicId;
+    uint32_t startup = LAPIC_ICR_STARTUP | (SMP_TRAMPOLINE_PADDR >> 12);
+    APIC::sendIpi(id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL | LAPIC_ICR_ASSERT);
+    APIC::sendIpi(id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL);
+    delayUs(SMP_INIT_DELAY_US);
+    APIC::sendIpi(id, startup);
+    delayUs(SMP_SIPI_DELAY_US);
+    // The second one is for CPUs that missed the first. A running CPU ignores it.
+    if (!info->online) {
+        APIC::sendIpi(id, startup);
+        delayUs(SMP_SIPI_DELAY_US);
+    }
+    for (uint32_t waited = 0; !info->online && waited < SMP_AP_TIMEOUT_US; waited += 10)
+        delayUs(10);
+    return info->online;
+}
+
+uint32_t SMP::bootAps() {
+    if (cpuCount < 2)
+        return onlineCount;
+    if (!APIC::isEnabled()) {
+        printf("SMP: no APIC, the other %lu CPUs stay offline.\n", cpuCount - 1);
+        return onlineCount;
+    }
+
+    set_idt_entry(SMP_CALL_VECTOR, (uint32_t)&smp_call_entry, 0x08, 0x8E);
+    installTrampoline();
+    for (uint32_t cpu = 1; cpu < cpuCount; cpu++) {
+        if (!startAp(cpu)) {
+            // It may still wake up later and read the trampoline, which
+            // must not be pointed at another CPU's stack then.
+            printf("SMP: CPU %lu (APIC id %u) did not start.\n", cpu, cpus[cpu].apicId);
+            break;
+        }
+    }
+    printf("SMP: %lu of %lu CPUs online.\n", onlineCount, cpuCount);
+    return onlineCount;
+}
+
+void SMP::apMain(uint32_t cpu) {
+    cpu_info *self = &cpus[cpu];
+    gdt_install_cpu(cpu, (uint32_t)self->stack + SMP_AP_STACK_SIZE);
+    PerCpu::load(cpu);
+    idt_load_cpu();
+    Syscall::initCpu((uint32_t)self->stack + SMP_AP_STACK_SIZE);
+    APIC::initCpu();
+    Rcu::cpuOnline(cpu);
+    Scheduler::initCpu(cpu);
+
+    __sync_fetch_and_add(&onlineCount, 1);
+    self->online = true;
+    apIdle(self);
+}
+
+void SMP::apIdle(cpu_info *self) {
+    // The APs use the raw interrupt flag: the irqsoff tracer keeps a single
+    // window and belongs to the BSP.
+    bool ticking = false;
+    for (;;) {
+        disable_interrupts();
+        smp_call_t func = self->func;
+        if (func) {
+            void *arg = self->arg;
+            self->func = 0;
+            enable_interrupts();
+            func(arg);
+            // Between calls the CPU holds no RCU references.
+            Rcu::noteQs();
+            self->calls++;
+            // Frees the mailbox for the next call()
+            asm volatile("" : : : "memory");
+            self->busy = 0;
+            continue;
+        }
+        // Announced first: a CPU that queues a thread after the check
+        // kicks this one.
+        Scheduler::idleEnter();
+        if (Scheduler::hasReady()) {
+            Scheduler::idleExit();
+            // Threads are preempted on the CPU's own tick, which only runs
+            // while there are any.
+            if (!ticking) {
+                ClockEvent::startLocalTick(TICKS_PER_SECOND);
+                ticking = true;
+            }
+            Scheduler::schedule();
+            continue;
+        }
+        if (ticking) {
+            ClockEvent::stopLocalTick();
+            ticking = false;
+        }
+        // sti only takes effect after the next instruction, so a call IPI
+        // or a kick cannot slip in between the check and the hlt.
+        Rcu::idleEnter();
+        asm volatile("sti\n\thlt" : : : "memory");
+        Rcu::idleExit();
+        Scheduler::idleExit();
+    }
+}
+
+bool SMP::call(uint32_t cpu, smp_call_t func, void *arg) {
+    if (cpu == 0 || !isOnline(cpu))
+        return false;
+    cpu_info *target = &cpus[cpu];
+    if (!__sync_bool_compare_and_swap(&target->busy, 0, 1))
+        return false;
+    target->arg = arg;
+    asm volatile("" : : : "memory");
+    target->func = func;
+    APIC::sendIpi(target->apicId, LAPIC_ICR_FIXED | SMP_CALL_VECTOR);
+    return true;
+}
+
+void SMP::kick(uint32_t cpu) {
+    // The call vector does nothing but return, which ends the hlt.
+    if (isOnline(cpu) && APIC::isEnabled())
+        APIC::sendIpi(cpus[cpu].apicId, LAPIC_ICR_FIXED | SMP_CALL_VECTOR);
+}
+
+void SMP::callInterrupt() {
+    APIC::eoi(SMP_CALL_VECTOR);
+}
+
+void smp_ap_main(uint32_t cpu) {
+    SMP::apMain(cpu);
+}
+
+void smp_call_interrupt(void) {
+    SMP::callInterrupt();
+}
@@ -0,0 +1,75 @@
+#include <arch/i386/gdt.h>
+#include <arch/i386/percpu.h>
+#include <arch/i386/syscall.h>
+#include <asm.h>
+#include <devices/timer.h>
+#include <stdio.h>
+
+#define SYSCALL_STACK_SIZE 8192
+
+syscall_handler_t Syscall::table[SYSCALL_MAX] = {0};
+bool Syscall::fastPath = false;
+
+// Both entry paths run on this stack until there are threads with their own.
+alignas(16) static uint8_t syscallStack[SYSCALL_STACK_SIZE];
+
+extern "C" void syscall_dispatch(struct syscall_frame* frame) {
+    Syscall::dispatch(frame);
+}
+
+void Syscall::init() {
+    registerSyscall(SYSCALL_NOP, sysNop);
+    registerSyscall(SYSCALL_WRITE, sysWrite);
+    registerSyscall(SYSCALL_UPTIME, sysUptime);
+
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    uint32_t family = (eax >> 8) & 0xF;
+    uint32_t model = (eax >> 4) & 0xF;
+    uint32_t stepping = eax & 0xF;
+    // The Pentium Pro sets the SEP bit without implementing SYSENTER.
+    bool has_sep = (edx & SYSCALL_CPUID_SEP) &&
+                   !(family == 6 && model < 3 && stepping < 3);
+    fastPath = has_sep;
+    initCpu((uint32_t)(syscallStack + SYSCALL_STACK_SIZE));
+    printf("System calls installed (%s).\n", fastPath ? "sysenter" : "int 0x80");
+}
+
+void Syscall::initCpu(uint32_t esp0) {
+    if (fastPath) {
+        wrmsr(MSR_SYSENTER_CS, KERNEL_CODE_SEGMENT);
+        wrmsr(MSR_SYSENTER_EIP, (uint32_t)syscall_sysenter_entry);
+    }
+    setKernelStack(esp0);
+}
+
+bool Syscall::registerSyscall(uint32_t number, syscall_handler_t handler) {
+    if (number >= SYSCALL_MAX) {
+        return false;
+    }
+    table[number] = handler;
+    return true;
+}
+
+void Syscall::setKernelStack(uint32_t esp0) {
+    gdt_set_kernel_stack(PerCpu::currentCpu(), esp0);
+    if (fastPath) {
+        wrmsr(MSR_SYSENTER_ESP, esp0);
+    }
+}
+
+int32_t Syscall::sysNop(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t) {
+    return 0;
+}
+
+int32_t Syscall::sysWrite(uint32_t buf, uint32_t len, uint32_t, uint32_t, uint32_t) {
+    const char* data = (const char*)buf;
+    for (uint32_t i = 0; i < len; i++) {
+        putchar(data[i]);
+    }
+    return len;
+}
+
+int32_t Syscall::sysUptime(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t) {
+    return (int32_t)Timer::get_ticks();
+}
@@ -3,7 +3,9 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <arch/i386/tty.h>
 #include <arch/i386/vga.h>
+#include <libk/spinlock.h>
 
 size_t t_line_fill[VGA_WIDTH];
 size_t t_row;
@@ -11,6 +13,11 @@ size_t t_column;
 uint8_t t_color;
 uint16_t* t_buffer;
 
+// Interrupt handlers print too, e.g. the keyboard echo. A string goes out in
+// one piece under the lock, so lines from different CPUs don't mix.
+static DEFINE_LOCK_STATS(tty_lock_stats, "tty");
+static spinlock_t t_lock = SPINLOCK_INIT_STATS(&tty_lock_stats);
+
 void t_putentryat(char c, uint8_t color, size_t x, size_t y);
 void t_scroll();
 
@@ -28,6 +35,7 @@ void terminal_initialize(void) {
 }
 
 void t_backspace() {
+  uint32_t flags = spin_lock_irqsave(&t_lock);
   if (t_column == 0) {
     if (t_row > 0) {
       t_row--;
@@ -39,6 +47,7 @@ void t_backspace() {
 
   t_putentryat(32, t_color, t_column, t_row);
   update_cursor(t_row, t_column);
+  spin_unlock_irqrestore(&t_lock, flags);
 }
 
 void t_setcolor(uint8_t color) { t_color = color; }
@@ -48,7 +57,7 @@ void t_putentryat(char c, uint8_t color, size_t x, size_t y) {
   t_buffer[index] = make_vgaentry(c, color);
 }
 
-void t_putchar(char c) {
+static void t_putchar_locked(char c) {
   if (c != '\n') {
     t_putentryat(c, t_color, t_column, t_row);
   }
@@ -61,7 +70,13 @@ void t_putchar(char c) {
     }
   }
 
+}
+
+void t_putchar(char c) {
+  uint32_t flags = spin_lock_irqsave(&t_lock);
+  t_putchar_locked(c);
   update_cursor(t_row, t_column);
+  spin_unlock_irqrestore(&t_lock, flags);
 }
 
 void t_scroll() {
@@ -82,7 +97,10 @@ void t_scroll() {
 }
 
 void t_write(const char* data, size_t size) {
-  for (size_t i = 0; i < size; i++) t_putchar(data[i]);
+  uint32_t flags = spin_lock_irqsave(&t_lock);
+  for (size_t i = 0; i < size; i++) t_putchar_locked(data[i]);
+  update_cursor(t_row, t_column);
+  spin_unlock_irqrestore(&t_lock, flags);
 }
 
 void t_writestring(const char* data) { t_write(data, strlen(data)); }
@@ -0,0 +1,96 @@
+#include <arch/i386/apic.h>
+#include <arch/i386/interrupts.h>
+#include <asm.h>
+#include <devices/clockevent.h>
+#include <devices/clocksource.h>
+#include <stdio.h>
+
+#define PIT_CHANNEL0_PORT   0x40
+#define PIT_COMMAND_PORT    0x43
+// Channel 0, low then high byte, binary
+#define PIT_CHANNEL0_SQUARE_WAVE 0x36   // Mode 3
+#define PIT_CHANNEL0_ONESHOT     0x30   // Mode 0, interrupt on terminal count
+
+clockevent_device ClockEvent::device = CLOCKEVENT_PIT;
+uint32_t ClockEvent::lapicKhz = 0;
+
+bool ClockEvent::calibrateLapic() {
+    // Let the timer run down from the top, masked, for a TSC timed interval.
+    APIC::lapicWrite(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    APIC::lapicWrite(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | TIMER_IDT_INDEX);
+    APIC::lapicWrite(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    uint64_t start = ClockSource::nowNs();
+    while (ClockSource::nowNs() - start < CLOCKEVENT_LAPIC_CALIBRATE_NS);
+    uint32_t elapsed = 0xFFFFFFFF - APIC::lapicRead(LAPIC_TIMER_CURRENT);
+    APIC::lapicWrite(LAPIC_TIMER_INITIAL, 0);
+
+    lapicKhz = elapsed / (CLOCKEVENT_LAPIC_CALIBRATE_NS / NSEC_PER_MSEC);
+    return lapicKhz != 0;
+}
+
+void ClockEvent::init() {
+    if (APIC::isEnabled() && ClockSource::usesTsc() && calibrateLapic()) {
+        device = CLOCKEVENT_LAPIC;
+        // The PIT keeps counting but must not raise the timer vector too.
+        APIC::maskIrq(0);
+        printf("Clock events: Local APIC timer at %lu kHz.\n", lapicKhz);
+        return;
+    }
+    device = CLOCKEVENT_PIT;
+    printf("Clock events: PIT.\n");
+}
+
+uint32_t ClockEvent::nsToCount(uint64_t ns) {
+    uint64_t max = getMaxDeltaNs();
+    if (ns > max)
+        ns = max;
+    uint64_t count = device == CLOCKEVENT_LAPIC
+        ? div64_32(ns * lapicKhz, NSEC_PER_MSEC)
+        : div64_32(ns * PIT_FREQUENCY, NSEC_PER_SEC);
+    if (!count)
+        count = 1;
+    if (device == CLOCKEVENT_PIT && count > CLOCKEVENT_PIT_MAX_COUNT)
+        count = CLOCKEVENT_PIT_MAX_COUNT;
+    return (uint32_t)count;
+}
+
+uint64_t ClockEvent::getMaxDeltaNs() {
+    if (device == CLOCKEVENT_LAPIC)
+        return CLOCKEVENT_LAPIC_MAX_NS;
+    return div64_32((uint64_t)CLOCKEVENT_PIT_MAX_COUNT * NSEC_PER_SEC, PIT_FREQUENCY);
+}
+
+void ClockEvent::setPeriodic(uint32_t hz) {
+    if (device == CLOCKEVENT_LAPIC) {
+        APIC::lapicWrite(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+        APIC::lapicWrite(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | TIMER_IDT_INDEX);
+        APIC::lapicWrite(LAPIC_TIMER_INITIAL, lapicKhz * 1000 / hz);
+        return;
+    }
+    uint32_t divisor = PIT_FREQUENCY / hz;
+    outb(PIT_COMMAND_PORT, PIT_CHANNEL0_SQUARE_WAVE);
+    outb(PIT_CHANNEL0_PORT, divisor & 0xFF);
+    outb(PIT_CHANNEL0_PORT, divisor >> 8);
+}
+
+void ClockEvent::startLocalTick(uint32_t hz) {
+    if (device == CLOCKEVENT_LAPIC)
+        setPeriodic(hz);
+}
+
+void ClockEvent::stopLocalTick() {
+    if (device == CLOCKEVENT_LAPIC)
+        APIC::lapicWrite(LAPIC_TIMER_INITIAL, 0);
+}
+
+void ClockEvent::setOneShot(uint64_t ns) {
+    uint32_t count = nsToCount(ns);
+    if (device == CLOCKEVENT_LAPIC) {
+        APIC::lapicWrite(LAPIC_LVT_TIMER, LAPIC_TIMER_ONESHOT | TIMER_IDT_INDEX);
+        APIC::lapicWrite(LAPIC_TIMER_INITIAL, count);
+        return;
+    }
+    outb(PIT_COMMAND_PORT, PIT_CHANNEL0_ONESHOT);
+    outb(PIT_CHANNEL0_PORT, count & 0xFF);
+    outb(PIT_CHANNEL0_PORT, count >> 8);
+}
@@ -0,0 +1,102 @@
+#include <asm.h>
+#include <devices/clocksource.h>
+#include <devices/timer.h>
+#include <stdio.h>
+
+#define PIT_CHANNEL2_PORT   0x42
+#define PIT_COMMAND_PORT    0x43
+#define PIT_GATE_PORT       0x61    // Channel 2 gate and output, PC speaker
+#define PIT_GATE_ENABLE     0x01
+#define PIT_SPEAKER_ENABLE  0x02
+#define PIT_CHANNEL2_OUT    0x20
+// Channel 2, low then high byte, mode 0 (interrupt on terminal count), binary
+#define PIT_CHANNEL2_ONESHOT 0xB0
+// Gives up on a channel 2 that never fires, about a second of port reads
+#define PIT_POLL_LIMIT      1000000
+
+bool ClockSource::tsc = false;
+bool ClockSource::invariant = false;
+uint64_t ClockSource::tscBase = 0;
+uint32_t ClockSource::tscKhz = 0;
+uint32_t ClockSource::mult = 0;
+uint32_t ClockSource::shift = 0;
+
+uint64_t ClockSource::calibrationRun() {
+    uint16_t latch = PIT_FREQUENCY / (1000 / CLOCK_CALIBRATE_MS);
+
+    // Gate on, speaker off, then load the count: the output drops and rises
+    // again once the count has run out.
+    outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~PIT_SPEAKER_ENABLE) | PIT_GATE_ENABLE);
+    outb(PIT_COMMAND_PORT, PIT_CHANNEL2_ONESHOT);
+    outb(PIT_CHANNEL2_PORT, latch & 0xFF);
+    outb(PIT_CHANNEL2_PORT, latch >> 8);
+
+    uint64_t start = rdtsc();
+    uint32_t polls = 0;
+    while (!(inb(PIT_GATE_PORT) & PIT_CHANNEL2_OUT)) {
+        if (++polls == PIT_POLL_LIMIT)
+            return 0;
+    }
+    return rdtsc() - start;
+}
+
+bool ClockSource::calibrate() {
+    uint64_t best = 0;
+    uint64_t worst = 0;
+    for (uint32_t run = 0; run < CLOCK_CALIBRATE_RUNS; run++) {
+        uint64_t cycles = calibrationRun();
+        if (!cycles)
+            return false;
+        // Anything that interrupted a run (an SMI, the emulator) made it
+        // longer, never shorter, so the shortest run is the most accurate.
+        if (!best || cycles < best)
+            best = cycles;
+        if (cycles > worst)
+            worst = cycles;
+    }
+    if (best >> 32 || worst - best > best / CLOCK_CALIBRATE_SPREAD)
+        return false;
+
+    uint32_t cycles = (uint32_t)best;
+    uint32_t run_ns = CLOCK_CALIBRATE_MS * NSEC_PER_MSEC;
+    tscKhz = cycles / CLOCK_CALIBRATE_MS;
+
+    // ns = cycles * run_ns / best. Use the largest shift (the most precise
+    // mult) that still keeps mult in 32 bits.
+    for (shift = 32; shift > 0; shift--) {
+        uint64_t m = div64_32((uint64_t)run_ns << shift, cycles);
+        if (!(m >> 32)) {
+            mult = (uint32_t)m;
+            break;
+        }
+    }
+    return mult != 0;
+}
+
+uint64_t ClockSource::tickNs() {
+    return Timer::get_ticks() * (NSEC_PER_SEC / TICKS_PER_SECOND);
+}
+
+void ClockSource::init(bool allow_tsc) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    bool has_tsc = edx & CLOCK_CPUID_TSC;
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (has_tsc && eax >= 0x80000007) {
+        cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+        invariant = edx & CLOCK_CPUID_INVARIANT;
+    }
+
+    if (!allow_tsc || !has_tsc) {
+        printf("Clock: timer ticks, no TSC.\n");
+        return;
+    }
+    if (!calibrate()) {
+        tscKhz = 0;
+        printf("Clock: timer ticks, TSC calibration failed.\n");
+        return;
+    }
+    tscBase = rdtsc();
+    tsc = true;
+    printf("Clock: TSC at %lu kHz%s.\n", tscKhz, invariant ? ", invariant" : "");
+}
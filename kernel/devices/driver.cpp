@@ -1,22 +1,149 @@
+#include <asm.h>
+#include <devices/clocksource.h>
 #include <devices/driver.h>
+#include <stdio.h>
 
-void Driver::initialize() {}
+static const char* driver_state_names[] = {"registered", "ready", "failed", "skipped"};
+
+Driver::Driver(const char *name, uint32_t flags)
+    : name(name), flags(flags), manager(0), numDeps(0), state(DRIVER_REGISTERED),
+      waitingFor(0), depFailed(false), readyNext(0), initNs(0) {}
+
+bool Driver::dependsOn(Driver *driver) {
+    if (numDeps == DRIVER_MAX_DEPS)
+        return false;
+    deps[numDeps++] = driver;
+    return true;
+}
+
+bool Driver::initialize() { return true; }
 void Driver::reset() {}
 void Driver::destroy() {}
 
 DriverManager::DriverManager()
 {
-    numDrivers = 0;
+    spin_lock_init(&readyLock);
+    bootReady = 0;
+    remaining = 0;
+    inFlight = 0;
 }
 
 void DriverManager::addDriver(Driver* driver)
 {
-    drivers[numDrivers] = driver;
-    numDrivers++;
+    driver->manager = this;
+    drivers.pushBack(driver);
+}
+
+bool DriverManager::isLoaded(Driver *driver)
+{
+    return driver->manager == this && driver->link.isLinked();
+}
+
+void DriverManager::makeReady(Driver *driver)
+{
+    __atomic_add_fetch(&inFlight, 1, __ATOMIC_RELAXED);
+    if (driver->depFailed) {
+        driver->state = DRIVER_SKIPPED;
+        finish(driver);
+    } else if (driver->flags & DRIVER_BOOT_CPU) {
+        uint32_t flags = spin_lock_irqsave(&readyLock);
+        driver->readyNext = bootReady;
+        bootReady = driver;
+        spin_unlock_irqrestore(&readyLock, flags);
+    } else {
+        group.spawn(&driver->task, runTask, driver);
+    }
+}
+
+void DriverManager::run(Driver *driver)
+{
+    uint64_t start = ClockSource::nowNs();
+    bool ok = driver->initialize();
+    driver->initNs = ClockSource::nowNs() - start;
+    driver->state = ok ? DRIVER_READY : DRIVER_FAILED;
+    finish(driver);
 }
 
-void DriverManager::initializeAll()
+void DriverManager::runTask(void *arg)
 {
-    for(int i = 0; i < numDrivers; i++)
-        drivers[i]->initialize();
-}
\ No newline at end of file
+    Driver *driver = (Driver *)arg;
+    driver->manager->run(driver);
+}
+
+void DriverManager::finish(Driver *done)
+{
+    // Nobody adds drivers while they initialize, the list holds still.
+    for (Driver *driver = drivers.front(); driver; driver = drivers.next(driver)) {
+        for (uint32_t i = 0; i < driver->numDeps; i++) {
+            if (driver->deps[i] != done)
+                continue;
+            if (done->state != DRIVER_READY)
+                driver->depFailed = true;
+            // The last dependency to finish moves it on.
+            if (__atomic_sub_fetch(&driver->waitingFor, 1, __ATOMIC_ACQ_REL) == 0)
+                makeReady(driver);
+        }
+    }
+    __atomic_sub_fetch(&remaining, 1, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&inFlight, 1, __ATOMIC_RELEASE);
+}
+
+Driver *DriverManager::takeBootReady()
+{
+    uint32_t flags = spin_lock_irqsave(&readyLock);
+    Driver *driver = bootReady;
+    if (driver)
+        bootReady = driver->readyNext;
+    spin_unlock_irqrestore(&readyLock, flags);
+    return driver;
+}
+
+uint32_t DriverManager::initializeAll()
+{
+    uint32_t count = 0;
+    for (Driver *driver = drivers.front(); driver; driver = drivers.next(driver)) {
+        driver->state = DRIVER_REGISTERED;
+        driver->depFailed = false;
+        driver->waitingFor = driver->numDeps;
+        for (uint32_t i = 0; i < driver->numDeps; i++) {
+            // Never finishes: the driver is reported as skipped below.
+            if (!isLoaded(driver->deps[i]))
+                driver->waitingFor = driver->waitingFor + DRIVER_MAX_DEPS;
+        }
+        count++;
+    }
+    remaining = count;
+
+    for (Driver *driver = drivers.front(); driver; driver = drivers.next(driver)) {
+        if (driver->waitingFor == 0)
+            makeReady(driver);
+    }
+
+    // Boot CPU drivers run here, the others on the workers, which this CPU
+    // helps out while it has nothing of its own to do.
+    while (__atomic_load_n(&remaining, __ATOMIC_ACQUIRE)) {
+        if (Driver *driver = takeBootReady()) {
+            run(driver);
+            continue;
+        }
+        if (WorkerPool::runOne())
+            continue;
+        // Whatever is left waits for a dependency that never comes:
+        // a missing driver or a cycle.
+        if (!__atomic_load_n(&inFlight, __ATOMIC_ACQUIRE) && !bootReady)
+            break;
+        cpu_relax();
+    }
+    group.wait();
+
+    uint32_t notReady = 0;
+    for (Driver *driver = drivers.front(); driver; driver = drivers.next(driver)) {
+        if (driver->state == DRIVER_REGISTERED)
+            driver->state = DRIVER_SKIPPED;
+        if (driver->state != DRIVER_READY)
+            notReady++;
+        printf("Driver %s: %s in %lu us.\n", driver->name, driver_state_names[driver->state],
+               (uint32_t)div64_32(driver->initNs, 1000));
+    }
+    return notReady;
+}
@@ -8,6 +8,15 @@
 #include <stdio.h>
 
 Keyboard::KeyboardState Keyboard::state;
+SpscRing<char, KEYBOARD_BUFFER_SIZE> Keyboard::buffer;
+DeferredWork Keyboard::echoWork;
+volatile char Keyboard::input[KEYBOARD_INPUT_SIZE];
+volatile uint32_t Keyboard::inputHead = 0;
+volatile uint32_t Keyboard::inputTail = 0;
+wait_queue_t Keyboard::readers = WAIT_QUEUE_INIT;
+AsyncCompletion Keyboard::reply;
+volatile bool Keyboard::ledsChanged = false;
+bool Keyboard::ledsBusy = false;
 
 // Scancode table used to layout a standard US keyboard.
 // Uses the second row if SHIFT is held
@@ -107,12 +116,22 @@ static constexpr unsigned char kbdus[128][4] = {
 };
 
 // Handles the keyboard interrupt
-void Keyboard::keyboardHandler(__attribute__((unused)) regs *r) {
+interrupt_result Keyboard::keyboardHandler(__attribute__((unused)) regs *r,
+                                           __attribute__((unused)) void *data) {
     unsigned char scancode;
     int column = 0;
     char clicked = 0;
+    // Nothing in the output buffer, another device on the line raised it
+    if (!(inb(0x64) & 0x01)) {
+        return INTERRUPT_NOT_HANDLED;
+    }
     // Read from the keyboard's data buffer
     scancode = inb(0x60);
+    // Not a key: the keyboard answers a command of sendCommand.
+    if (scancode == KEYBOARD_ACK || scancode == KEYBOARD_RESEND) {
+        reply.complete(scancode);
+        return INTERRUPT_HANDLED;
+    }
     // If the top bit of the scancode is set, a key has just been released
     if (scancode & 0x80) {
         if (scancode >> 2 == 42 || scancode >> 2 == 54) {
@@ -121,7 +140,7 @@ void Keyboard::keyboardHandler(__attribute__((unused)) regs *r) {
     } else {
         switch (scancode) {
             case 14: // backspace
-                t_backspace();
+                clicked = '\b';
                 break;
             case 42: // shifts
             case 54:
@@ -129,25 +148,92 @@ void Keyboard::keyboardHandler(__attribute__((unused)) regs *r) {
                 break;
             case 58: // caps lock
                 state.caps_lock = !state.caps_lock;
+                ledsChanged = true;
+                DeferredWorkQueue::schedule(&echoWork);
                 break;
             default:
                 column = state.shift_held * 1 + state.caps_lock * 2;
                 clicked = kbdus[scancode][column];
-                if (clicked != 0 && clicked != 27) {
-                    putchar(clicked);
-                }
                 break;
         }
     }
+
+    // Drawing on the console is slow, leave it to deferred work.
+    // When the buffer is full the keystroke is dropped.
+    if (clicked != 0 && clicked != 27 && buffer.push(clicked))
+        DeferredWorkQueue::schedule(&echoWork);
+    return INTERRUPT_HANDLED;
+}
+
+void Keyboard::echo(__attribute__((unused)) void *data) {
+    // Taken a batch at a time, the handler sees the room freed once per batch.
+    char batch[16];
+    while (uint32_t count = buffer.popBatch(batch, sizeof(batch))) {
+        for (uint32_t i = 0; i < count; i++) {
+            char c = batch[i];
+            if (c == '\b')
+                t_backspace();
+            else
+                putchar(c);
+            // Nobody reading: the oldest characters are lost first.
+            if (inputHead - inputTail >= KEYBOARD_INPUT_SIZE)
+                __sync_fetch_and_add(&inputTail, 1);
+            input[inputHead % KEYBOARD_INPUT_SIZE] = c;
+            asm volatile("" : : : "memory");
+            inputHead = inputHead + 1;
+        }
+        WaitQueue::wakeAll(&readers);
+    }
+    // Retried on the next keystroke if the pool had no frame.
+    if (ledsChanged && !ledsBusy)
+        ledsBusy = Executor::spawn(updateLeds());
+}
+
+Task<int32_t> Keyboard::sendCommand(uint8_t byte) {
+    reply.reset();
+    // The controller takes the byte once its input buffer is empty.
+    timeout_t timeout;
+    timeout_start(&timeout, 1000);
+    while (inb(0x64) & 0x02) {
+        if (timeout_expired(&timeout))
+            co_return KEYBOARD_RESEND;
+    }
+    outb(0x60, byte);
+    co_return co_await reply;
+}
+
+Task<void> Keyboard::updateLeds() {
+    // Caps Lock may be hit again while the keyboard is still answering.
+    while (ledsChanged) {
+        ledsChanged = false;
+        uint8_t leds = state.caps_lock ? KEYBOARD_LED_CAPS_LOCK : 0;
+        if (co_await sendCommand(KEYBOARD_CMD_SET_LEDS) != KEYBOARD_ACK ||
+            co_await sendCommand(leds) != KEYBOARD_ACK)
+            break;
+    }
+    ledsBusy = false;
 }
 
-Keyboard::Keyboard(InterruptHandler* interruptHandler) {
-    interruptHandler->register_interrupt_handler(KEYBOARD_IDT_INDEX, keyboardHandler);
+char Keyboard::getChar() {
+    for (;;) {
+        wait_event(&readers, inputTail != inputHead);
+        // Readers race each other for the character, the loser waits again.
+        uint32_t tail = inputTail;
+        char c = input[tail % KEYBOARD_INPUT_SIZE];
+        if (tail != inputHead && __sync_bool_compare_and_swap(&inputTail, tail, tail + 1))
+            return c;
+    }
+}
+
+Keyboard::Keyboard() : Driver("keyboard") {}
+
+bool Keyboard::initialize() {
+    deferred_work_init(&echoWork, echo, 0, DEFERRED_PRIORITY_NORMAL);
     Keyboard::state.caps_lock = 0;
     Keyboard::state.shift_held = 0;
+    InterruptHandler::register_interrupt_handler(KEYBOARD_IDT_INDEX, keyboardHandler);
     printf("Keyboard installed.\n");
+    return true;
 }
-
-void Keyboard::initialize() {}
 void Keyboard::reset() {}
 void Keyboard::destroy() {}
@@ -0,0 +1,68 @@
+#include <asm.h>
+#include <devices/serial.h>
+
+// UART register offsets from the base port
+#define SERIAL_DATA         0   // Data, or divisor low byte when DLAB is set
+#define SERIAL_INT_ENABLE   1   // Interrupt enable, or divisor high byte when DLAB is set
+#define SERIAL_FIFO_CTRL    2
+#define SERIAL_LINE_CTRL    3
+#define SERIAL_MODEM_CTRL   4
+#define SERIAL_LINE_STATUS  5
+
+#define SERIAL_LINE_STATUS_THR_EMPTY 0x20
+
+bool Serial::ready = false;
+
+void Serial::init() {
+    outb(SERIAL_COM1_PORT + SERIAL_INT_ENABLE, 0x00);  // No interrupts, we poll
+    outb(SERIAL_COM1_PORT + SERIAL_LINE_CTRL, 0x80);   // DLAB on to set the divisor
+    outb(SERIAL_COM1_PORT + SERIAL_DATA, 0x01);        // Divisor 1: 115200 baud
+    outb(SERIAL_COM1_PORT + SERIAL_INT_ENABLE, 0x00);
+    outb(SERIAL_COM1_PORT + SERIAL_LINE_CTRL, 0x03);   // 8 bits, no parity, one stop bit
+    outb(SERIAL_COM1_PORT + SERIAL_FIFO_CTRL, 0xC7);   // Enable and clear FIFOs, 14 byte threshold
+    outb(SERIAL_COM1_PORT + SERIAL_MODEM_CTRL, 0x03);  // DTR and RTS
+    ready = true;
+}
+
+void Serial::waitTransmitEmpty() {
+    while (!(inb(SERIAL_COM1_PORT + SERIAL_LINE_STATUS) & SERIAL_LINE_STATUS_THR_EMPTY));
+}
+
+void Serial::putchar(char c) {
+    if (!ready)
+        init();
+    if (c == '\n')
+        putchar('\r');
+    waitTransmitEmpty();
+    outb(SERIAL_COM1_PORT + SERIAL_DATA, c);
+}
+
+void Serial::write(const char* data) {
+    while (*data)
+        putchar(*data++);
+}
+
+void Serial::writeHex(uint32_t value) {
+    static const char digits[] = "0123456789abcdef";
+    write("0x");
+    for (int shift = 28; shift >= 0; shift -= 4)
+        putchar(digits[(value >> shift) & 0xF]);
+}
+
+void Serial::writeHex64(uint64_t value) {
+    static const char digits[] = "0123456789abcdef";
+    write("0x");
+    for (int shift = 60; shift >= 0; shift -= 4)
+        putchar(digits[(value >> shift) & 0xF]);
+}
+
+void Serial::writeDec(uint32_t value) {
+    char buffer[10];
+    int count = 0;
+    do {
+        buffer[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (count)
+        putchar(buffer[--count]);
+}
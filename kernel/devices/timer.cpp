@@ -1,32 +1,110 @@
 #include <arch/i386/idt.h>
 #include <arch/i386/interrupts.h>
+#include <arch/i386/percpu.h>
 #include <asm.h>
+#include <devices/clockevent.h>
+#include <devices/clocksource.h>
 #include <devices/timer.h>
+#include <libk/irqflags.h>
+#include <libk/seqlock.h>
+#include <libk/thread.h>
+#include <libk/timer_wheel.h>
 #include <stdio.h>
 
-#define TICKS_PER_SECOND 100
-
-// Holds how many ticks that the system has been running for
-int Timer::timer_ticks = 0;
+// Holds how many ticks that the system has been running for. 64 bits, at
+// 100 Hz a signed int overflowed after 248 days.
+volatile uint64_t Timer::timer_ticks = 0;
+seqcount_t Timer::ticks_seq = SEQCOUNT_INIT;
+bool Timer::tick_stopped = false;
+uint32_t Timer::tick_stops = 0;
 
 // Sets up the system clock
-Timer::Timer(InterruptHandler* interruptHandler) {
-    interruptHandler->register_interrupt_handler(TIMER_IDT_INDEX, timer_handler);
+Timer::Timer() : Driver("timer", DRIVER_BOOT_CPU) {}
+
+bool Timer::initialize() {
+    InterruptHandler::register_interrupt_handler(TIMER_IDT_INDEX, timer_handler);
+    ClockEvent::init();
     timer_phase(TICKS_PER_SECOND);
-  printf("Timer installed.\n");
+    printf("Timer installed.\n");
+    return true;
 }
 
 void Timer::timer_phase(int hz) {
-    int divisor = 1193180 / hz;   // Calculates the divisor
-    outb(0x43, 0x36);             // Set our command byte 0x36
-    outb(0x40, divisor & 0xFF);   // Set low byte of divisor
-    outb(0x40, divisor >> 8);     // Set high byte of divisor
+    ClockEvent::setPeriodic(hz);
+}
+
+interrupt_result Timer::timer_handler(__attribute__((unused)) regs *r,
+                                     __attribute__((unused)) void *data) {
+    // The timer has no status to check, the tick is always ours.
+    if (PerCpu::currentCpu() != 0) {
+        // An AP's own tick, see SMP::apIdle. The boot CPU keeps the time.
+        Scheduler::tick();
+        return INTERRUPT_HANDLED;
+    }
+    if (tick_stopped) {
+        // The one-shot fired: the system is no longer idle.
+        restart_tick();
+    } else {
+        write_seqcount_begin(&ticks_seq);
+        timer_ticks++;
+        write_seqcount_end(&ticks_seq);
+    }
+    TimerWheel::tick(timer_ticks);
+    Scheduler::tick();
+    return INTERRUPT_HANDLED;
+}
+
+void Timer::restart_tick() {
+    uint64_t ticks = div64_32(ClockSource::nowNs(), TICK_NSEC);
+    if (ticks > timer_ticks) {
+        write_seqcount_begin(&ticks_seq);
+        timer_ticks = ticks;
+        write_seqcount_end(&ticks_seq);
+    }
+    tick_stopped = false;
+    ClockEvent::setPeriodic(TICKS_PER_SECOND);
+}
+
+void Timer::idle_enter(uint64_t next_event_ns) {
+    if (tick_stopped || !ClockSource::usesTsc())
+        return;
+
+    uint64_t now = ClockSource::nowNs();
+    uint64_t delta = ClockEvent::getMaxDeltaNs();
+    if (next_event_ns != TIMER_NO_EVENT) {
+        uint64_t until = next_event_ns > now ? next_event_ns - now : 0;
+        if (until < delta)
+            delta = until;
+    }
+    // Reprogramming costs more than a tick or two saves.
+    if (delta < 2 * TICK_NSEC)
+        return;
+
+    tick_stopped = true;
+    tick_stops++;
+    ClockEvent::setOneShot(delta);
+}
+
+void Timer::idle_exit() {
+    // Some other interrupt woke us up before the one-shot.
+    uint32_t flags = local_irq_save();
+    if (tick_stopped) {
+        restart_tick();
+        TimerWheel::tick(timer_ticks);
+    }
+    local_irq_restore(flags);
 }
 
-void Timer::timer_handler(__attribute__((unused)) regs *r) {
-    timer_ticks++;
+uint64_t Timer::get_ticks() {
+    // Two loads, read again if the tick landed in between. Works on any CPU.
+    uint32_t seq;
+    uint64_t ticks;
+    do {
+        seq = read_seqcount_begin(&ticks_seq);
+        ticks = timer_ticks;
+    } while (read_seqcount_retry(&ticks_seq, seq));
+    return ticks;
 }
 
-void Timer::initialize() {}
 void Timer::reset() {}
 void Timer::destroy() {}
\ No newline at end of file
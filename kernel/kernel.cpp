@@ -3,6 +3,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <libk/basesystem.h>
+#include <libk/deferred_work.h>
+#include <libk/irqflags.h>
+#include <libk/rcu.h>
+#include <libk/thread.h>
+#include <libk/timer_wheel.h>
+#include <devices/timer.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -18,8 +24,39 @@ void kernel_main(void) {
   // printf("Hello, kernel World %lu!\n", HEAP_PAGE_ACTUAL_SIZE);
   // int a = 10;
   // printf("aia %lx\n", virt_to_phys((virtual_addr)&a));
+  // This is the idle thread: it only runs when no other thread is ready.
   for (;;) {
-    asm("hlt");
+    // Finish deferred work left over by interrupt exits, then sleep until
+    // the next interrupt. Work queued after the check is seen on wakeup,
+    // safe_halt enables interrupts and halts in one go.
+    while (DeferredWorkQueue::runPending(DEFERRED_WORK_BATCH));
+    local_irq_disable();
+    if (DeferredWorkQueue::hasPending()) {
+      local_irq_enable();
+      continue;
+    }
+    // Announced first: a CPU that queues a thread after the check kicks
+    // this one.
+    Scheduler::idleEnter();
+    if (Scheduler::hasReady()) {
+      Scheduler::idleExit();
+      Scheduler::schedule();
+      local_irq_enable();
+      continue;
+    }
+    Rcu::idleEnter();
+    if (DeferredWorkQueue::hasPending()) {
+      // This CPU ended a grace period and queued its callbacks.
+      Rcu::idleExit();
+      Scheduler::idleExit();
+      local_irq_enable();
+      continue;
+    }
+    Timer::idle_enter(TimerWheel::nextExpiryNs());
+    safe_halt();
+    Rcu::idleExit();
+    Scheduler::idleExit();
+    Timer::idle_exit();
   }
 }
 
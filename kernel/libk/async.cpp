@@ -0,0 +1,195 @@
+#include <libk/async.h>
+
+#define COROUTINE_POOL_ARENA_SIZE \
+    (COROUTINE_POOL_BLOCKS * COROUTINE_POOL_MIN_SIZE * ((1 << COROUTINE_POOL_CLASSES) - 1))
+
+// Class n takes COROUTINE_POOL_BLOCKS blocks of COROUTINE_POOL_MIN_SIZE << n
+// bytes, right after class n - 1. Blocks are carved off on first use.
+static uint8_t pool_arena[COROUTINE_POOL_ARENA_SIZE] __attribute__((aligned(16)));
+
+static DEFINE_LOCK_STATS(pool_lock_stats, "coroutine-pool");
+spinlock_t CoroutinePool::lock = SPINLOCK_INIT_STATS(&pool_lock_stats);
+CoroutinePool::block *CoroutinePool::freeList[COROUTINE_POOL_CLASSES];
+uint32_t CoroutinePool::carved[COROUTINE_POOL_CLASSES];
+uint32_t CoroutinePool::inUse[COROUTINE_POOL_CLASSES];
+uint32_t CoroutinePool::failures = 0;
+
+static DEFINE_LOCK_STATS(executor_lock_stats, "executor");
+spinlock_t Executor::lock = SPINLOCK_INIT_STATS(&executor_lock_stats);
+async_node *Executor::head = 0;
+async_node *Executor::tail = 0;
+DeferredWork Executor::runWork = { 0, run, 0, DEFERRED_PRIORITY_NORMAL, false };
+uint32_t Executor::resumed = 0;
+
+uint32_t CoroutinePool::classFor(size_t size) {
+    uint32_t size_class = 0;
+    while (size_class < COROUTINE_POOL_CLASSES &&
+           (size_t)COROUTINE_POOL_MIN_SIZE << size_class < size)
+        size_class++;
+    return size_class;
+}
+
+void *CoroutinePool::allocate(size_t size) {
+    uint32_t size_class = classFor(size);
+    if (size_class == COROUTINE_POOL_CLASSES) {
+        __atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    uint32_t flags = spin_lock_irqsave(&lock);
+    void *ptr = freeList[size_class];
+    if (ptr) {
+        freeList[size_class] = freeList[size_class]->next;
+    } else if (carved[size_class] < COROUTINE_POOL_BLOCKS) {
+        uint32_t block_size = COROUTINE_POOL_MIN_SIZE << size_class;
+        uint32_t offset = COROUTINE_POOL_BLOCKS * COROUTINE_POOL_MIN_SIZE * ((1 << size_class) - 1);
+        ptr = pool_arena + offset + carved[size_class]++ * block_size;
+    }
+    if (ptr)
+        inUse[size_class]++;
+    else
+        failures++;
+    spin_unlock_irqrestore(&lock, flags);
+    return ptr;
+}
+
+void CoroutinePool::free(void *ptr, size_t size) {
+    uint32_t size_class = classFor(size);
+    block *freed = (block *)ptr;
+    uint32_t flags = spin_lock_irqsave(&lock);
+    freed->next = freeList[size_class];
+    freeList[size_class] = freed;
+    inUse[size_class]--;
+    spin_unlock_irqrestore(&lock, flags);
+}
+
+void Executor::post(async_node *node) {
+    node->next = 0;
+    uint32_t flags = spin_lock_irqsave(&lock);
+    if (tail)
+        tail->next = node;
+    else
+        head = node;
+    tail = node;
+    spin_unlock_irqrestore(&lock, flags);
+    DeferredWorkQueue::schedule(&runWork);
+}
+
+void Executor::run(__attribute__((unused)) void *data) {
+    uint32_t flags = spin_lock_irqsave(&lock);
+    async_node *list = head;
+    head = 0;
+    tail = 0;
+    spin_unlock_irqrestore(&lock, flags);
+
+    // Whatever the coroutines post while they run waits for the next round.
+    while (list) {
+        // The node lives in the coroutine's frame, which may be gone after.
+        async_node *next = list->next;
+        list->handle.resume();
+        resumed++;
+        list = next;
+    }
+}
+
+bool AsyncEvent::Awaiter::await_ready() {
+    uint32_t flags = spin_lock_irqsave(&event->lock);
+    bool ready = event->count > 0;
+    if (ready)
+        event->count--;
+    spin_unlock_irqrestore(&event->lock, flags);
+    return ready;
+}
+
+bool AsyncEvent::Awaiter::await_suspend(std::coroutine_handle<> waiter) {
+    handle = waiter;
+    next = 0;
+    uint32_t flags = spin_lock_irqsave(&event->lock);
+    // A signal that came after await_ready: go on without suspending.
+    if (event->count > 0) {
+        event->count--;
+        spin_unlock_irqrestore(&event->lock, flags);
+        return false;
+    }
+    if (event->tail)
+        event->tail->next = this;
+    else
+        event->head = this;
+    event->tail = this;
+    spin_unlock_irqrestore(&event->lock, flags);
+    return true;
+}
+
+void AsyncEvent::signal() {
+    uint32_t flags = spin_lock_irqsave(&lock);
+    async_node *waiter = head;
+    if (waiter) {
+        head = waiter->next;
+        if (!head)
+            tail = 0;
+    } else {
+        count++;
+    }
+    spin_unlock_irqrestore(&lock, flags);
+    if (waiter)
+        Executor::post(waiter);
+}
+
+bool AsyncCompletion::Awaiter::await_suspend(std::coroutine_handle<> waiter) {
+    handle = waiter;
+    uint32_t flags = spin_lock_irqsave(&completion->lock);
+    bool suspend = !completion->done;
+    if (suspend) {
+        assert(!completion->waiter);
+        completion->waiter = this;
+    }
+    spin_unlock_irqrestore(&completion->lock, flags);
+    return suspend;
+}
+
+void AsyncCompletion::complete(int32_t result) {
+    uint32_t flags = spin_lock_irqsave(&lock);
+    status = result;
+    done = true;
+    async_node *node = waiter;
+    waiter = 0;
+    spin_unlock_irqrestore(&lock, flags);
+    if (node)
+        Executor::post(node);
+}
+
+void AsyncCompletion::reset() {
+    uint32_t flags = spin_lock_irqsave(&lock);
+    assert(!waiter);
+    done = false;
+    status = 0;
+    spin_unlock_irqrestore(&lock, flags);
+}
+
+interrupt_result AsyncIrq::handler(__attribute__((unused)) regs *r, void *self) {
+    AsyncIrq *irq = (AsyncIrq *)self;
+    if (!irq->ack(irq->data))
+        return INTERRUPT_NOT_HANDLED;
+    irq->event.signal();
+    return INTERRUPT_HANDLED;
+}
+
+bool AsyncIrq::attach(uint32_t idt_index, async_irq_ack_t ack, void *data) {
+    this->idtIndex = idt_index;
+    this->ack = ack;
+    this->data = data;
+    return InterruptHandler::register_interrupt_handler(idt_index, handler, this);
+}
+
+bool AsyncIrq::detach() {
+    return InterruptHandler::unregister_interrupt_handler(idtIndex, handler, this);
+}
+
+void AsyncSleep::expired(void *data) {
+    Executor::post((async_node *)data);
+}
+
+void AsyncSleep::await_suspend(std::coroutine_handle<> waiter) {
+    handle = waiter;
+    ktimer_init(&timer, expired, (async_node *)this);
+    TimerWheel::add(&timer, TimerWheel::expiryAfterMs(ms));
+}
@@ -1,32 +1,69 @@
 #include <libk/basesystem.h>
 
+#include <arch/i386/apic.h>
 #include <arch/i386/gdt.h>
 #include <arch/i386/idt.h>
+#include <arch/i386/percpu.h>
+#include <arch/i386/smp.h>
+#include <arch/i386/syscall.h>
 #include <arch/i386/tty.h>
 #include <asm.h>
+#include <devices/clocksource.h>
 #include <devices/kb.h>
+#include <devices/serial.h>
 #include <devices/timer.h>
 #include <external/multiboot.h>
 #include <libk/phys_mem.h>
 #include <libk/virt_mem.h>
 #include <libk/heap_mem.h>
+#include <libk/irqflags.h>
+#include <libk/new.h>
+#include <libk/task_group.h>
+#include <libk/thread.h>
+#include <libk/timer_wheel.h>
 
 #include <stdio.h>
+#include <string.h>
+
+// The memory managers are needed long after init() returns, so they are
+// constructed in static storage instead of on its stack.
+alignas(PhysicalMemoryManager) static uint8_t physicalMemoryManagerStorage[sizeof(PhysicalMemoryManager)];
+alignas(VirtualMemoryManager) static uint8_t virtualMemoryManagerStorage[sizeof(VirtualMemoryManager)];
+alignas(HeapMemoryManager) static uint8_t heapMemoryManagerStorage[sizeof(HeapMemoryManager)];
+// So are the drivers and their manager, which keeps them listed.
+alignas(DriverManager) static uint8_t driverManagerStorage[sizeof(DriverManager)];
+alignas(Timer) static uint8_t timerStorage[sizeof(Timer)];
+alignas(Keyboard) static uint8_t keyboardStorage[sizeof(Keyboard)];
 
 void BaseSystem::init(multiboot_info* mb) {
     terminal_initialize();
+    Serial::init();
     print_early_boot_info(mb);
+    read_boot_options(mb);
     init_gdt();
+    PerCpu::initBoot();
     init_idt();
     InterruptHandler interruptHandler;
     init_isr();
     init_irq();
-    PhysicalMemoryManager physicalMemoryManager(mb);
-    VirtualMemoryManager virtualMemoryManager(&physicalMemoryManager);
-    HeapMemoryManager heapMemoryManager(&virtualMemoryManager, HEAP_VIRT_ADDR_START, HEAP_VIRT_ADDR_START+HEAP_INITIAL_BLOCK_SIZE, 0xCFFFF000, false, false);
-    DriverManager driverManager;
-    initializeDrivers(&driverManager, &interruptHandler);
-    enable_interrupts();
+    PhysicalMemoryManager* physicalMemoryManager =
+        new (physicalMemoryManagerStorage) PhysicalMemoryManager(mb);
+    VirtualMemoryManager* virtualMemoryManager =
+        new (virtualMemoryManagerStorage) VirtualMemoryManager(physicalMemoryManager);
+    kernel_heap = new (heapMemoryManagerStorage) HeapMemoryManager(virtualMemoryManager,
+        HEAP_VIRT_ADDR_START, HEAP_VIRT_ADDR_START+HEAP_INITIAL_BLOCK_SIZE, HEAP_MAX_ADDR, false, false);
+    SMP::detect(virtualMemoryManager);
+    APIC::init(virtualMemoryManager, !options.noapic);
+    Syscall::init();
+    ClockSource::init(!options.notsc);
+    TimerWheel::init();
+    Scheduler::init();
+    if (!options.nosmp)
+        SMP::bootAps();
+    WorkerPool::init();
+    DriverManager* driverManager = new (driverManagerStorage) DriverManager();
+    initializeDrivers(driverManager);
+    local_irq_enable();
 }
 
 void BaseSystem::print_early_boot_info(multiboot_info* mb) {
@@ -44,6 +81,30 @@ void BaseSystem::print_early_boot_info(multiboot_info* mb) {
     }
 }
 
+void BaseSystem::read_boot_options(multiboot_info* mb) {
+    options.noapic = has_boot_option(mb, "noapic");
+    options.notsc = has_boot_option(mb, "notsc");
+    options.nosmp = has_boot_option(mb, "nosmp");
+}
+
+bool BaseSystem::has_boot_option(multiboot_info* mb, const char* option) {
+    if (!(mb->flags & MULTIBOOT_INFO_CMDLINE))
+        return false;
+    const char* cmdline = (const char*) mb->cmdline;
+    size_t len = strlen(option);
+    // Options are separated by spaces. Match whole words only.
+    while (*cmdline) {
+        while (*cmdline == ' ')
+            cmdline++;
+        if (memcmp(cmdline, option, len) == 0 &&
+            (cmdline[len] == ' ' || cmdline[len] == '\0'))
+            return true;
+        while (*cmdline && *cmdline != ' ')
+            cmdline++;
+    }
+    return false;
+}
+
 bool BaseSystem::init_gdt() {
     gdt_install();
     return true;
@@ -64,12 +125,11 @@ bool BaseSystem::init_irq() {
     return true;
 }
 
-bool BaseSystem::initializeDrivers(DriverManager* driverManager, InterruptHandler* interruptHandler) {
-    Timer timer(interruptHandler);;
-    Keyboard keyboard(interruptHandler);;
+bool BaseSystem::initializeDrivers(DriverManager* driverManager) {
+    Timer* timer = new (timerStorage) Timer();
+    Keyboard* keyboard = new (keyboardStorage) Keyboard();
 
-    driverManager->addDriver(&timer);
-    driverManager->addDriver(&keyboard);
-    driverManager->initializeAll();
-    return true;
+    driverManager->addDriver(timer);
+    driverManager->addDriver(keyboard);
+    return driverManager->initializeAll() == 0;
 }
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include <arch/i386/percpu.h>
+#include <arch/i386/smp.h>
+#include <libk/deferred_work.h>
+#include <libk/irqflags.h>
+#include <libk/spinlock.h>
+#include <libk/thread.h>
+
+DeferredWorkQueue::queue_t DeferredWorkQueue::queues[DEFERRED_PRIORITY_COUNT];
+volatile uint32_t DeferredWorkQueue::pendingMask = 0;
+volatile bool DeferredWorkQueue::running = false;
+uint32_t DeferredWorkQueue::runCount[DEFERRED_PRIORITY_COUNT];
+
+static DEFINE_LOCK_STATS(deferred_lock_stats, "deferred");
+spinlock_t DeferredWorkQueue::lock = SPINLOCK_INIT_STATS(&deferred_lock_stats);
+
+bool DeferredWorkQueue::schedule(DeferredWork *work) {
+    uint32_t flags = spin_lock_irqsave(&lock);
+    if (work->pending) {
+        spin_unlock_irqrestore(&lock, flags);
+        return false;
+    }
+    work->pending = true;
+    work->next = 0;
+    queue_t *queue = &queues[work->priority];
+    if (queue->tail)
+        queue->tail->next = work;
+    else
+        queue->head = work;
+    queue->tail = work;
+    pendingMask |= 1 << work->priority;
+    spin_unlock_irqrestore(&lock, flags);
+
+    // The boot CPU may be halted with its tick stopped.
+    if (PerCpu::currentCpu() != 0)
+        SMP::kick(0);
+    return true;
+}
+
+DeferredWork *DeferredWorkQueue::dequeue() {
+    uint32_t flags = spin_lock_irqsave(&lock);
+    if (!pendingMask) {
+        spin_unlock_irqrestore(&lock, flags);
+        return 0;
+    }
+    // Lowest set bit is the highest priority.
+    uint32_t priority = __builtin_ctz(pendingMask);
+    queue_t *queue = &queues[priority];
+    DeferredWork *work = queue->head;
+    queue->head = work->next;
+    if (!queue->head) {
+        queue->tail = 0;
+        pendingMask &= ~(1 << priority);
+    }
+    // Cleared before it runs, so the function may re-arm its own item.
+    work->pending = false;
+    runCount[priority]++;
+    spin_unlock_irqrestore(&lock, flags);
+    return work;
+}
+
+bool DeferredWorkQueue::runPending(uint32_t budget) {
+    // Work never runs nested in other work, e.g. from an interrupt that
+    // arrived while the idle loop was draining.
+    if (running)
+        return hasPending();
+    // A callback that wakes a thread must not switch away from us while
+    // 'running' is set: the boot CPU's interrupt exits would skip all work
+    // until we got the CPU back.
+    Scheduler::preemptDisable();
+    running = true;
+    while (budget--) {
+        DeferredWork *work = dequeue();
+        if (!work)
+            break;
+        work->func(work->data);
+    }
+    running = false;
+    Scheduler::preemptEnable();
+    return hasPending();
+}
+
+void DeferredWorkQueue::irqExit() {
+    // The other CPUs' ticks come through here as well, work is the boot CPU's.
+    if (running || !pendingMask || PerCpu::currentCpu() != 0)
+        return;
+    local_irq_enable();
+    runPending(DEFERRED_WORK_BATCH);
+    // The interrupt stub expects interrupts off until its iret.
+    local_irq_disable();
+}
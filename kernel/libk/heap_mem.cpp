@@ -1,10 +1,16 @@
 #include<libk/heap_mem.h>
+#include<libk/heap_trace.h>
 #include<stdio.h>
+#include<string.h>
 #include<assert.h>
 
-static uint8_t header_t_less_than(void*a, void *b) {
-   return (((header_t*)a)->size < ((header_t*)b)->size)?1:0;
-}
+HeapMemoryManager *kernel_heap = 0;
+
+static DEFINE_LOCK_STATS(heap_lock_stats, "heap");
+
+static const char *heap_tag_names[HEAP_TAG_COUNT] = {
+    "general", "memory", "interrupts", "drivers", "sched", "timers"
+};
 
 HeapMemoryManager::HeapMemoryManager(VirtualMemoryManager *virtualMemoryManager, uint32_t start_addr, uint32_t end_address, 
                             uint32_t max_address, bool supervisor, bool readonly) {
@@ -13,19 +19,21 @@ HeapMemoryManager::HeapMemoryManager(VirtualMemoryManager *virtualMemoryManager,
     this->max_address = max_address;
     this->supervisor = supervisor;
     this->readonly = readonly;
+    this->numLargeAllocs = 0;
+    memset(tagStats, 0, sizeof(tagStats));
+    spin_lock_init(&lock, &heap_lock_stats);
 
-    for (virtual_addr vaddr = HEAP_VIRT_ADDR_START; vaddr < HEAP_VIRT_ADDR_START+HEAP_INITIAL_BLOCK_SIZE; vaddr += PAGE_SIZE_HEX) {
+    for (virtual_addr vaddr = start_addr; vaddr < end_address; vaddr += PAGE_SIZE_HEX) {
         virtualMemoryManager->alloc_page(vaddr);
     }
 
-    // Initialise the index.
-    OrderedArray orderedArray = OrderedArray((virtual_addr*)start_addr, HEAP_INDEX_SIZE, &header_t_less_than);
-    this->indexTable = &orderedArray;
+    // Initialise the index now that its pages are mapped.
+    this->indexTable = heap_index_t((header_t**)start_addr);
 
     // Shift the start address forward to resemble where we can start putting data.
-    start_addr += sizeof(type_t)*HEAP_INDEX_SIZE;
+    start_addr += sizeof(header_t*)*HEAP_INDEX_SIZE;
     // Make sure the start address is page-aligned.
-    if ((start_addr & 0xFFFFF000) != 0) {
+    if ((start_addr & 0xFFF) != 0) {
         start_addr &= 0xFFFFF000;
         start_addr += 0x1000;
     }
@@ -36,13 +44,38 @@ HeapMemoryManager::HeapMemoryManager(VirtualMemoryManager *virtualMemoryManager,
    hole->size = (size_t) end_address-start_addr;
    hole->magic = HEAP_MAGIC;
    hole->is_hole = true;
-   this->indexTable->insertNode((void*)hole);
+   footer_t *footer = (footer_t *)(end_address - sizeof(footer_t));
+   footer->magic = HEAP_MAGIC;
+   footer->header = hole;
+   this->indexTable.insertNode(hole);
 
    printf("Heap Memory initialized at %lx.\n", start_addr);
 
 }
 
-void* HeapMemoryManager::alloc(size_t size, bool page_align) {
+void* HeapMemoryManager::alloc(size_t size, bool page_align, heap_tag tag) {
+    uint32_t flags = spin_lock_irqsave(&lock);
+    void *block = allocUnlocked(size, page_align, tag);
+    spin_unlock_irqrestore(&lock, flags);
+    return block;
+}
+
+void HeapMemoryManager::free(void *p) {
+    uint32_t flags = spin_lock_irqsave(&lock);
+    freeUnlocked(p);
+    spin_unlock_irqrestore(&lock, flags);
+}
+
+void* HeapMemoryManager::allocUnlocked(size_t size, bool page_align, heap_tag tag) {
+   // Big buffers get their own pages and never fragment the hole heap.
+   if (size >= HEAP_LARGE_ALLOC_THRESHOLD) {
+       if (numLargeAllocs < HEAP_LARGE_MAX_ALLOCS)
+           return allocLarge(size, tag);
+       // The side table is full. The hole heap takes it, page aligned all the same.
+       page_align = true;
+   }
+
+   size_t requested = size;
     // Make sure we take the size of header/footer into account.
    size_t new_size = size + sizeof(header_t) + sizeof(footer_t);
    // Find the smallest hole that will fit.
@@ -53,26 +86,25 @@ void* HeapMemoryManager::alloc(size_t size, bool page_align) {
        uint32_t old_length = end_address - start_address;
        uint32_t old_end_address = end_address;
 
-       // We need to allocate some more space.
-       expand(old_length+new_size);
+       // We need to allocate some more space. Aligning may skip up to a page.
+       expand(old_length + new_size + (page_align ? PAGE_SIZE : 0));
        uint32_t new_length = end_address-start_address;
 
-       // Find the endmost header. (Not endmost in size, but in location).
+       // Find the hole that reaches the old end of the heap, if there is one.
        iterator = 0;
-       // Vars to hold the index of, and value of, the endmost header found so far.
-       int32_t idx = -1; uint32_t value = 0x0;
-       while (iterator < (int32_t)indexTable->getSize())
+       int32_t idx = -1;
+       while (iterator < (int32_t)indexTable.getSize())
        {
-           uint32_t tmp = (uint32_t) indexTable->findAtIndex(iterator);
-           if (tmp > value)
+           header_t *tmp = indexTable.findAtIndex(iterator);
+           if ((uintptr_t)tmp + tmp->size == old_end_address)
            {
-               value = tmp;
                idx = iterator;
+               break;
            }
            iterator++;
        }
 
-       // If we didn't find ANY headers, we need to add one.
+       // If there is none, the new space becomes a hole of its own.
        if (idx == -1)
        {
            header_t *header = (header_t *)old_end_address;
@@ -82,58 +114,60 @@ void* HeapMemoryManager::alloc(size_t size, bool page_align) {
            footer_t *footer = (footer_t *) (old_end_address + header->size - sizeof(footer_t));
            footer->magic = HEAP_MAGIC;
            footer->header = header;
-           indexTable->insertNode((void*)header);
+           indexTable.insertNode(header);
        }
        else
        {
-           // The last header needs adjusting.
-           header_t *header = (header_t *) indexTable->findAtIndex(idx); // TODO: doubtful
+           // The last hole grows. Its size is its key in the index, so re-insert it.
+           header_t *header = indexTable.findAtIndex(idx);
+           indexTable.removeAtIndex(idx);
            header->size += new_length - old_length;
            // Rewrite the footer.
-           footer_t *footer = (footer_t *) ( (uint32_t)header + header->size - sizeof(footer_t) );
+           footer_t *footer = (footer_t *) ( (uintptr_t)header + header->size - sizeof(footer_t) );
            footer->header = header;
            footer->magic = HEAP_MAGIC;
+           indexTable.insertNode(header);
        }
        // We now have enough space. Recurse, and call the function again.
-       return alloc(size, page_align);
+       return allocUnlocked(size, page_align, tag);
    } 
 
-   header_t *orig_hole_header = (header_t *) indexTable->findAtIndex(iterator);
-   uint32_t orig_hole_pos = (uint32_t)orig_hole_header;
+   header_t *orig_hole_header = indexTable.findAtIndex(iterator);
+   uintptr_t orig_hole_pos = (uintptr_t)orig_hole_header;
    uint32_t orig_hole_size = orig_hole_header->size;
-   // Here we work out if we should split the hole we found into two parts.
-   // Is the original hole size - requested hole size less than the overhead for adding a new hole?
-   if (orig_hole_size - new_size < sizeof(header_t)+sizeof(footer_t))
-   {
-       // Then just increase the requested size to the size of the hole we found.
-       size += orig_hole_size-new_size;
-       new_size = orig_hole_size;
-   }
+   // The hole is used up. What is left of it in front or behind is re-added below.
+   indexTable.removeAtIndex(iterator);
 
    // If we need to page-align the data, do it now and make a new hole in front of our block.
-   if (page_align && orig_hole_pos&0xFFFFF000)
+   uint32_t offset = page_align ? alignOffset(orig_hole_pos) : 0;
+   if (offset)
    {
-       uint32_t new_location   = orig_hole_pos + 0x1000 /* page size */ - (orig_hole_pos&0xFFF) - sizeof(header_t);
        header_t *hole_header = (header_t *)orig_hole_pos;
-       hole_header->size     = 0x1000 /* page size */ - (orig_hole_pos&0xFFF) - sizeof(header_t);
+       hole_header->size     = offset;
        hole_header->magic    = HEAP_MAGIC;
        hole_header->is_hole  = 1;
-       footer_t *hole_footer = (footer_t *) ( (int32_t)new_location - sizeof(footer_t) );
+       footer_t *hole_footer = (footer_t *) (orig_hole_pos + offset - sizeof(footer_t));
        hole_footer->magic    = HEAP_MAGIC;
        hole_footer->header   = hole_header;
-       orig_hole_pos         = new_location;
-       orig_hole_size        = orig_hole_size - hole_header->size;
+       indexTable.insertNode(hole_header);
+       orig_hole_pos         = orig_hole_pos + offset;
+       orig_hole_size        = orig_hole_size - offset;
    }
-   else
+
+   // Here we work out if we should split the hole we found into two parts.
+   // Is the original hole size - requested hole size less than the overhead for adding a new hole?
+   if (orig_hole_size - new_size < sizeof(header_t)+sizeof(footer_t))
    {
-       // Else we don't need this hole any more, delete it from the index.
-       indexTable->removeAtIndex(iterator);
+       // Then just increase the requested size to the size of the hole we found.
+       size += orig_hole_size-new_size;
+       new_size = orig_hole_size;
    }
 
    // Overwrite the original header...
    header_t *block_header  = (header_t *)orig_hole_pos;
    block_header->magic     = HEAP_MAGIC;
    block_header->is_hole   = 0;
+   block_header->tag       = tag;
    block_header->size      = new_size;
    // ...And the footer
    footer_t *block_footer  = (footer_t *) (orig_hole_pos + sizeof(header_t) + size);
@@ -148,131 +182,134 @@ void* HeapMemoryManager::alloc(size_t size, bool page_align) {
        hole_header->magic    = HEAP_MAGIC;
        hole_header->is_hole  = 1;
        hole_header->size     = orig_hole_size - new_size;
-       footer_t *hole_footer = (footer_t *) ( (int32_t)hole_header + orig_hole_size - new_size - sizeof(footer_t) );
-       if ((uint32_t)hole_footer < end_address)
+       footer_t *hole_footer = (footer_t *) ( (uintptr_t)hole_header + orig_hole_size - new_size - sizeof(footer_t) );
+       if ((uintptr_t)hole_footer < end_address)
        {
            hole_footer->magic = HEAP_MAGIC;
            hole_footer->header = hole_header;
        }
        // Put the new hole in the index;
-       indexTable->insertNode((void*)hole_header);
+       indexTable.insertNode(hole_header);
    }
 
+   chargeAlloc(tag, requested, new_size);
+
+   void *block = (void *) ( (uintptr_t)block_header+sizeof(header_t) );
+   if (HeapTracer::enabled)
+       HeapTracer::record(HEAP_TRACE_ALLOC, requested, page_align, tag, (uintptr_t)block);
+
    // ...And we're done!
-   return (void *) ( (uint32_t)block_header+sizeof(header_t) );
+   return block;
 }
 
-void HeapMemoryManager::free(void *p) {
+void HeapMemoryManager::freeUnlocked(void *p) {
     // Exit gracefully for null pointers.
     if (p == 0)
         return;
 
+    if (isLarge(p)) {
+        freeLarge(p);
+        return;
+    }
+
     // Get the header and footer associated with this pointer.
-   header_t *header = (header_t*) ( (int32_t)p - sizeof(header_t) );
-   footer_t *footer = (footer_t*) ( (int32_t)header + header->size - sizeof(footer_t) );
+   header_t *header = (header_t*) ( (uintptr_t)p - sizeof(header_t) );
+   footer_t *footer = (footer_t*) ( (uintptr_t)header + header->size - sizeof(footer_t) );
 
    // Sanity checks.
    assert(header->magic == HEAP_MAGIC);
    assert(footer->magic == HEAP_MAGIC);
 
+   chargeFree(header->tag, header->size);
+   if (HeapTracer::enabled)
+       HeapTracer::record(HEAP_TRACE_FREE, header->size, false, header->tag, (uintptr_t)p);
+
    // Make us a hole.
    header->is_hole = 1;
 
-   // Do we want to add this header into the 'free holes' index?
-   bool do_add = true;
-
     // Unify left
    // If the thing immediately to the left of us is a footer...
-   footer_t *test_footer = (footer_t*) ( (int32_t)header - sizeof(footer_t) );
-   if (test_footer->magic == HEAP_MAGIC &&
+   footer_t *test_footer = (footer_t*) ( (uintptr_t)header - sizeof(footer_t) );
+   if ((uintptr_t)header > start_address &&
+       test_footer->magic == HEAP_MAGIC &&
        test_footer->header->is_hole == 1)
    {
-       int32_t cache_size = header->size; // Cache our current size.
+       uint32_t cache_size = header->size; // Cache our current size.
        header = test_footer->header;     // Rewrite our header with the new one.
+       removeHole(header);               // Its size changes, it is re-inserted below.
        footer->header = header;          // Rewrite our footer to point to the new header.
        header->size += cache_size;       // Change the size.
-       do_add = false;                   // Since this header is already in the index, we don't want to add it again.
    }
 
    // Unify right
    // If the thing immediately to the right of us is a header...
-   header_t *test_header = (header_t*) ( (int32_t)footer + sizeof(footer_t) );
-   if (test_header->magic == HEAP_MAGIC &&
+   header_t *test_header = (header_t*) ( (uintptr_t)footer + sizeof(footer_t) );
+   if ((uintptr_t)test_header < end_address &&
+       test_header->magic == HEAP_MAGIC &&
        test_header->is_hole)
    {
        header->size += test_header->size; // Increase our size.
-       test_footer = (footer_t*) ( (int32_t)test_header + // Rewrite it's footer to point to our header.
+       test_footer = (footer_t*) ( (uintptr_t)test_header + // Rewrite it's footer to point to our header.
                                    test_header->size - sizeof(footer_t) );
+       test_footer->header = header;
        footer = test_footer;
        // Find and remove this header from the index.
-       int32_t iterator = 0;
-       while ( (iterator < (int32_t)indexTable->getSize()) &&
-               (indexTable->findAtIndex(iterator) != (void*)test_header) )
-           iterator++;
-
-       // Make sure we actually found the item.
-       assert(iterator < (int32_t)indexTable->getSize());
-       // Remove it.
-       indexTable->removeAtIndex(iterator);
+       removeHole(test_header);
    }
 
    // If the footer location is the end address, we can contract.
-   if ( (int32_t)footer+sizeof(footer_t) == end_address)
+   if ( (uintptr_t)footer+sizeof(footer_t) == end_address)
    {
-       int32_t old_length = end_address - start_address;
-       int32_t new_length = contract( (int32_t)header - start_address);
+       uint32_t old_length = end_address - start_address;
+       uint32_t new_length = contract( (uintptr_t)header - start_address);
        // Check how big we will be after resizing.
-       if (header->size - (old_length-new_length) > 0)
+       if (header->size > old_length-new_length)
        {/* TODO
            // We will still exist, so resize us.
            header->size -= old_length - new_length;
-           footer = (footer_t*) ( (int32_t)header + header->size - sizeof(footer_t) );
+           footer = (footer_t*) ( (uintptr_t)header + header->size - sizeof(footer_t) );
            footer->magic = HEAP_MAGIC;
            footer->header = header;*/
        }
-       else
-       {
-           // We will no longer exist :(. Remove us from the index.
-           int32_t iterator = 0;
-           while ( (iterator < (int32_t)indexTable->getSize()) &&
-                   (indexTable->findAtIndex(iterator) != (void*)test_header) )
-               iterator++;
-           // If we didn't find ourselves, we have nothing to remove.
-           if (iterator < (int32_t)indexTable->getSize())
-               indexTable->removeAtIndex(iterator);
-       }
    }
 
-    if (do_add)
-        indexTable->insertNode((void*) header); 
+   indexTable.insertNode(header);
+}
+
+void HeapMemoryManager::removeHole(header_t *hole) {
+   // Make sure we actually found the item.
+   bool found = indexTable.erase(hole);
+   assert(found);
+}
 
+uint32_t HeapMemoryManager::alignOffset(uint32_t location) {
+   // Distance from the hole to the first header whose data is page aligned.
+   uint32_t data = location + sizeof(header_t);
+   if ((data & (PAGE_SIZE - 1)) == 0)
+       return 0;
+   uint32_t offset = PAGE_SIZE - (data % PAGE_SIZE);
+   // The skipped space becomes a hole of its own, so it must fit a header and footer.
+   if (offset < sizeof(header_t) + sizeof(footer_t))
+       offset += PAGE_SIZE;
+   return offset;
 }
 
 int32_t HeapMemoryManager::findSmallestHole(size_t size, bool page_align) {
-    // Find the smallest hole that will fit.
-   size_t iterator = 0;
-   while (iterator < indexTable->getSize())
+    // Holes smaller than 'size' can never fit, so skip them with a binary search.
+   size_t iterator = indexTable.lowerBound((uint32_t)size);
+   // Without alignment the first candidate is the smallest hole that will fit.
+   while (page_align && iterator < indexTable.getSize())
    {
-       header_t *header = (header_t *) indexTable->findAtIndex(iterator);
-       // If the user has requested the memory be page-aligned
-       if (page_align)
-       {
-           // Page-align the starting point of this header.
-           uint32_t location = (uint32_t)header;
-           int32_t offset = 0;
-           if (((location+sizeof(header_t)) & 0xFFFFF000) != 0)
-               offset = PAGE_SIZE_HEX  - (location+sizeof(header_t))%PAGE_SIZE_HEX;
-           uint32_t hole_size = (uint32_t)header->size - offset;
-           // Can we fit now?
-           if (hole_size >= (uint32_t)size)
-               break;
-       }
-       else if (header->size >= size)
+       header_t *header = indexTable.findAtIndex(iterator);
+       // Page-align the starting point of this header.
+       uint32_t offset = alignOffset((uintptr_t)header);
+       // Can we fit now?
+       if (header->size >= offset && header->size - offset >= size)
            break;
        iterator++;
    }
    // Why did the loop exit?
-   if (iterator == indexTable->getSize())
+   if (iterator == indexTable.getSize())
        return -1; // We got to the end and didn't find anything.
    else
        return iterator;
@@ -282,7 +319,7 @@ void HeapMemoryManager::expand(size_t new_size) {
     // Sanity check.
    assert(new_size > end_address - start_address);
    // Get the nearest following page boundary.
-   if ((new_size&0xFFFFF000) != 0)
+   if ((new_size & (PAGE_SIZE - 1)) != 0)
    {
        new_size &= 0xFFFFF000;
        new_size += PAGE_SIZE_HEX;
@@ -295,7 +332,7 @@ void HeapMemoryManager::expand(size_t new_size) {
    uint32_t i = old_size;
    while (i < new_size)
    {
-       virtualMemoryManager->alloc_page(i);
+       virtualMemoryManager->alloc_page(start_address + i);
        i += PAGE_SIZE_HEX /* page size */;
    }
    end_address = start_address+new_size;
@@ -304,4 +341,165 @@ void HeapMemoryManager::expand(size_t new_size) {
 size_t HeapMemoryManager::contract(size_t new_size) {
     // TODO
     return new_size;
-}
\ No newline at end of file
+}
+
+void HeapMemoryManager::getFragmentation(heap_frag_stats_t *stats) {
+    uint32_t flags = spin_lock_irqsave(&lock);
+    memset(stats, 0, sizeof(heap_frag_stats_t));
+    stats->heap_bytes = end_address - start_address;
+    stats->holes = indexTable.getSize();
+    for (size_t i = 0; i < indexTable.getSize(); i++) {
+        header_t *hole = indexTable.findAtIndex(i);
+        stats->free_bytes += hole->size;
+    }
+    // The index is sorted by size, the last hole is the largest.
+    if (stats->holes)
+        stats->largest_hole = (indexTable.findAtIndex(stats->holes - 1))->size;
+    stats->large_objects = numLargeAllocs;
+    for (size_t i = 0; i < numLargeAllocs; i++)
+        stats->large_pages += largeAllocs[i].pages;
+    spin_unlock_irqrestore(&lock, flags);
+}
+
+void* HeapMemoryManager::allocLarge(size_t size, uint8_t tag) {
+    // Rounding up a size near 4GB would wrap to a request for no pages.
+    if (size > HEAP_LARGE_VIRT_ADDR_END - HEAP_LARGE_VIRT_ADDR_START) {
+        printf("Large object window too small for %x bytes\n", size);
+        return 0;
+    }
+    uint32_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t span = (pages + HEAP_LARGE_GUARD_PAGES) * PAGE_SIZE;
+
+    // First fit over the gaps between the (sorted) side table entries.
+    virtual_addr base = HEAP_LARGE_VIRT_ADDR_START;
+    size_t slot = 0;
+    while (slot < numLargeAllocs) {
+        if (largeAllocs[slot].base - base >= span)
+            break;
+        base = largeAllocs[slot].base + (largeAllocs[slot].pages + HEAP_LARGE_GUARD_PAGES) * PAGE_SIZE;
+        slot++;
+    }
+    if (slot == numLargeAllocs && HEAP_LARGE_VIRT_ADDR_END - base < span) {
+        printf("Large object window exhausted, cannot allocate %x bytes\n", size);
+        return 0;
+    }
+
+    // Back the range with frames. Roll back if the PMM runs dry half way.
+    for (uint32_t i = 0; i < pages; i++) {
+        if (!virtualMemoryManager->alloc_page(base + i * PAGE_SIZE)) {
+            while (i--)
+                virtualMemoryManager->free_page(base + i * PAGE_SIZE);
+            return 0;
+        }
+    }
+
+    memmove(&largeAllocs[slot + 1], &largeAllocs[slot], (numLargeAllocs - slot) * sizeof(large_alloc_t));
+    largeAllocs[slot].base = base;
+    largeAllocs[slot].pages = pages;
+    largeAllocs[slot].tag = tag;
+    numLargeAllocs++;
+
+    chargeAlloc(tag, size, pages * PAGE_SIZE);
+    if (HeapTracer::enabled)
+        HeapTracer::record(HEAP_TRACE_ALLOC, size, true, tag, base);
+
+    return (void*) base;
+}
+
+void HeapMemoryManager::freeLarge(void *p) {
+    int32_t slot = findLarge((uintptr_t)p);
+    // Anything else inside the window is a stray or double free.
+    assert(slot != -1);
+
+    virtual_addr base = largeAllocs[slot].base;
+    for (uint32_t i = 0; i < largeAllocs[slot].pages; i++)
+        virtualMemoryManager->free_page(base + i * PAGE_SIZE);
+    chargeFree(largeAllocs[slot].tag, largeAllocs[slot].pages * PAGE_SIZE);
+    if (HeapTracer::enabled)
+        HeapTracer::record(HEAP_TRACE_FREE, largeAllocs[slot].pages * PAGE_SIZE, false,
+                           largeAllocs[slot].tag, base);
+
+    numLargeAllocs--;
+    memmove(&largeAllocs[slot], &largeAllocs[slot + 1], (numLargeAllocs - slot) * sizeof(large_alloc_t));
+}
+
+int32_t HeapMemoryManager::findLarge(virtual_addr base) {
+    // The table is sorted by base address, so binary search it.
+    size_t lo = 0, hi = numLargeAllocs;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (largeAllocs[mid].base == base)
+            return mid;
+        if (largeAllocs[mid].base < base)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return -1;
+}
+
+void HeapMemoryManager::chargeAlloc(uint8_t tag, size_t requested, uint32_t bytes) {
+    heap_tag_stats_t *stats = &tagStats[tag];
+    stats->allocs++;
+    stats->live_bytes += bytes;
+    if (stats->live_bytes > stats->peak_bytes)
+        stats->peak_bytes = stats->live_bytes;
+
+    uint32_t bucket = 31 - __builtin_clz(requested | 1);
+    if (bucket >= HEAP_HISTOGRAM_BUCKETS)
+        bucket = HEAP_HISTOGRAM_BUCKETS - 1;
+    stats->histogram[bucket]++;
+}
+
+void HeapMemoryManager::chargeFree(uint8_t tag, uint32_t bytes) {
+    tagStats[tag].frees++;
+    tagStats[tag].live_bytes -= bytes;
+}
+
+void HeapMemoryManager::printStats() {
+    // Print a copy, the console is too slow to hold the lock for.
+    heap_tag_stats_t snapshot[HEAP_TAG_COUNT];
+    uint32_t flags = spin_lock_irqsave(&lock);
+    memcpy(snapshot, tagStats, sizeof(snapshot));
+    uint32_t large_objects = numLargeAllocs;
+    spin_unlock_irqrestore(&lock, flags);
+
+    printf("Heap usage by subsystem:\n");
+    for (int tag = 0; tag < HEAP_TAG_COUNT; tag++) {
+        heap_tag_stats_t *stats = &snapshot[tag];
+        if (!stats->allocs)
+            continue;
+        printf("  %s: live %lu peak %lu allocs %lu frees %lu\n", heap_tag_names[tag],
+               stats->live_bytes, stats->peak_bytes, stats->allocs, stats->frees);
+        printf("    sizes:");
+        for (int bucket = 0; bucket < HEAP_HISTOGRAM_BUCKETS; bucket++) {
+            if (stats->histogram[bucket])
+                printf(" %u+:%lu", 1u << bucket, stats->histogram[bucket]);
+        }
+        printf("\n");
+    }
+    printf("  large objects: %lu\n", large_objects);
+}
+
+const char *heap_tag_name(heap_tag tag) {
+    if (tag >= HEAP_TAG_COUNT)
+        return "unknown";
+    return heap_tag_names[tag];
+}
+
+void *kmalloc(size_t size, heap_tag tag) {
+    if (!kernel_heap)
+        return 0;
+    return kernel_heap->alloc(size, false, tag);
+}
+
+void *kmalloc_aligned(size_t size, heap_tag tag) {
+    if (!kernel_heap)
+        return 0;
+    return kernel_heap->alloc(size, true, tag);
+}
+
+void kfree(void *p) {
+    if (kernel_heap)
+        kernel_heap->free(p);
+}
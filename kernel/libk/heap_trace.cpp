@@ -0,0 +1,65 @@
+#include <asm.h>
+#include <devices/serial.h>
+#include <libk/heap_trace.h>
+#include <string.h>
+
+heap_trace_record_t HeapTracer::ring[HEAP_TRACE_RING_SIZE];
+uint32_t HeapTracer::total = 0;
+bool HeapTracer::enabled = false;
+
+void HeapTracer::start() {
+    memset(ring, 0, sizeof(ring));
+    total = 0;
+    enabled = true;
+}
+
+void HeapTracer::stop() {
+    enabled = false;
+}
+
+void HeapTracer::record(uint8_t op, uint32_t size, bool align, uint8_t tag, uint32_t id) {
+    heap_trace_record_t *entry = &ring[total % HEAP_TRACE_RING_SIZE];
+    entry->op = op;
+    entry->align = align;
+    entry->tag = tag;
+    entry->size = size;
+    entry->id = id;
+    entry->timestamp = rdtsc();
+    total++;
+}
+
+uint32_t HeapTracer::dropped() {
+    return total > HEAP_TRACE_RING_SIZE ? total - HEAP_TRACE_RING_SIZE : 0;
+}
+
+void HeapTracer::dump() {
+    // Don't record our own (allocation free) dump while walking the ring.
+    bool was_enabled = enabled;
+    enabled = false;
+
+    uint32_t first = dropped();
+    Serial::write("# openos heap trace v1\n# records ");
+    Serial::writeDec(total);
+    Serial::write(" dropped ");
+    Serial::writeDec(first);
+    Serial::putchar('\n');
+
+    for (uint32_t i = first; i < total; i++) {
+        heap_trace_record_t *entry = &ring[i % HEAP_TRACE_RING_SIZE];
+        Serial::putchar(entry->op == HEAP_TRACE_ALLOC ? 'A' : 'F');
+        Serial::putchar(' ');
+        Serial::writeDec(entry->size);
+        Serial::putchar(' ');
+        Serial::writeDec(entry->align);
+        Serial::putchar(' ');
+        Serial::writeDec(entry->tag);
+        Serial::putchar(' ');
+        Serial::writeHex(entry->id);
+        Serial::putchar(' ');
+        Serial::writeHex64(entry->timestamp);
+        Serial::putchar('\n');
+    }
+    Serial::write("# end\n");
+
+    enabled = was_enabled;
+}
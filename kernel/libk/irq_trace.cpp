@@ -0,0 +1,117 @@
+#include <arch/i386/percpu.h>
+#include <asm.h>
+#include <devices/serial.h>
+#include <libk/irq_trace.h>
+#include <string.h>
+
+bool IrqOffTracer::enabled = false;
+bool IrqOffTracer::open = false;
+uint64_t IrqOffTracer::openedAt = 0;
+uint32_t IrqOffTracer::openedEip = 0;
+uint32_t IrqOffTracer::openedVector = 0;
+uint32_t IrqOffTracer::windows = 0;
+uint32_t IrqOffTracer::histogram[IRQ_TRACE_BUCKETS];
+irq_trace_window_t IrqOffTracer::worst;
+
+// The tracer itself uses the raw flag helpers, the traced ones would call
+// back into it. It keeps a single window, the boot CPU's: the transitions of
+// the other CPUs are ignored.
+
+void IrqOffTracer::start() {
+    uint32_t flags = read_eflags();
+    disable_interrupts();
+    memset(histogram, 0, sizeof(histogram));
+    memset(&worst, 0, sizeof(worst));
+    windows = 0;
+    // A window that is already open (we are inside one now) was never timed.
+    open = false;
+    enabled = true;
+    write_eflags(flags);
+}
+
+void IrqOffTracer::stop() {
+    enabled = false;
+    open = false;
+}
+
+void IrqOffTracer::openWindow(uint32_t eip, uint32_t vector, uint64_t tsc) {
+    openedAt = tsc;
+    openedEip = eip;
+    openedVector = vector;
+    open = true;
+}
+
+void IrqOffTracer::irqsOff() {
+    if (!open && PerCpu::currentCpu() == 0)
+        openWindow((uint32_t)__builtin_return_address(0), IRQ_TRACE_NO_VECTOR, rdtsc());
+}
+
+void IrqOffTracer::irqsOn() {
+    if (!open || PerCpu::currentCpu() != 0)
+        return;
+    uint64_t cycles = rdtsc() - openedAt;
+    open = false;
+    windows++;
+
+    uint32_t clamped = cycles > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)cycles;
+    uint32_t bucket = 31 - __builtin_clz(clamped | 1);
+    if (bucket >= IRQ_TRACE_BUCKETS)
+        bucket = IRQ_TRACE_BUCKETS - 1;
+    histogram[bucket]++;
+
+    if (cycles > worst.cycles) {
+        worst.cycles = cycles;
+        worst.start = openedAt;
+        worst.eip = openedEip;
+        worst.vector = openedVector;
+    }
+}
+
+void IrqOffTracer::interruptEntry(uint32_t vector, uint32_t eip, uint64_t tsc) {
+    // An exception raised inside a cli section belongs to that section.
+    if (!open && PerCpu::currentCpu() == 0)
+        openWindow(eip, vector, tsc);
+}
+
+void IrqOffTracer::interruptExit(uint32_t eflags) {
+    // iret only re-enables interrupts if the interrupted context had them on.
+    if (eflags & 0x200)
+        irqsOn();
+}
+
+void IrqOffTracer::getWorst(irq_trace_window_t *out) {
+    uint32_t flags = read_eflags();
+    disable_interrupts();
+    memcpy(out, &worst, sizeof(worst));
+    write_eflags(flags);
+}
+
+void IrqOffTracer::dump() {
+    irq_trace_window_t w;
+    getWorst(&w);
+
+    Serial::write("# openos irqsoff trace v1\n");
+    Serial::write("windows ");
+    Serial::writeDec(windows);
+    Serial::write(" worst ");
+    Serial::writeHex64(w.cycles);
+    Serial::write(" eip ");
+    Serial::writeHex(w.eip);
+    Serial::write(" vector ");
+    if (w.vector == IRQ_TRACE_NO_VECTOR)
+        Serial::putchar('-');
+    else
+        Serial::writeDec(w.vector);
+    Serial::write(" at ");
+    Serial::writeHex64(w.start);
+    Serial::write("\nhist");
+    for (uint32_t bucket = 0; bucket < IRQ_TRACE_BUCKETS; bucket++) {
+        if (!histogram[bucket])
+            continue;
+        Serial::putchar(' ');
+        Serial::writeDec(bucket);
+        Serial::putchar(':');
+        Serial::writeDec(histogram[bucket]);
+    }
+    Serial::write("\n# end\n");
+}
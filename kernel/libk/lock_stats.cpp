@@ -0,0 +1,43 @@
+#include <devices/serial.h>
+#include <libk/lock_stats.h>
+#include <string.h>
+
+bool LockStats::enabled = false;
+
+void LockStats::start() {
+    reset();
+    enabled = true;
+}
+
+void LockStats::stop() {
+    enabled = false;
+}
+
+void LockStats::reset() {
+    // Holders may still be counting, the numbers are only a guide anyway.
+    for (struct lock_stats *stats = __lock_stats_start; stats < __lock_stats_end; stats++) {
+        stats->acquisitions = 0;
+        stats->contended = 0;
+        stats->waitCycles = 0;
+        stats->maxWaitCycles = 0;
+    }
+}
+
+void LockStats::dump() {
+    Serial::write("# openos lock stats v1\n");
+    for (struct lock_stats *stats = __lock_stats_start; stats < __lock_stats_end; stats++) {
+        if (!stats->acquisitions)
+            continue;
+        Serial::write(stats->name);
+        Serial::write(" acquired ");
+        Serial::writeDec(stats->acquisitions);
+        Serial::write(" contended ");
+        Serial::writeDec(stats->contended);
+        Serial::write(" wait ");
+        Serial::writeHex64(stats->waitCycles);
+        Serial::write(" max ");
+        Serial::writeHex64(stats->maxWaitCycles);
+        Serial::putchar('\n');
+    }
+    Serial::write("# end\n");
+}
@@ -3,6 +3,7 @@
 
 #include <external/multiboot.h>
 #include <libk/phys_mem.h>
+#include <libk/task_group.h>
 
 uint32_t* PhysicalMemoryManager::phys_memory_map_ = 0;
 uint32_t PhysicalMemoryManager::phys_mem_size_kb_ = 0;
@@ -11,6 +12,9 @@ uint32_t PhysicalMemoryManager::total_blocks_ = 0;
 uint32_t PhysicalMemoryManager::kernel_phys_map_start = 0;
 uint32_t PhysicalMemoryManager::kernel_phys_map_end = 0;
 
+static DEFINE_LOCK_STATS(pmm_lock_stats, "pmm");
+spinlock_t PhysicalMemoryManager::lock_ = SPINLOCK_INIT_STATS(&pmm_lock_stats);
+
 int PhysicalMemoryManager::find_free_block() {
   for (uint32_t i = 0; i < total_blocks_; i++) {
     uint32_t block = phys_memory_map_[i];
@@ -57,26 +61,30 @@ int PhysicalMemoryManager::find_free_blocks(uint32_t count) {
 
 // Functions to manage a single block in memory
 physical_addr PhysicalMemoryManager::alloc_block() {
-  if (total_blocks_ - used_blocks_ <= 0) {
-    return 0;
+  uint32_t flags = spin_lock_irqsave(&lock_);
+  int free_block = -1;
+  if (total_blocks_ - used_blocks_ > 0) {
+    free_block = find_free_block();
   }
-
-  int free_block = find_free_block();
   if (free_block == -1) {
+    spin_unlock_irqrestore(&lock_, flags);
     return 0;
   }
 
   map_set(free_block);
   uint32_t addr = free_block * PHYS_BLOCK_SIZE;
   used_blocks_++;
+  spin_unlock_irqrestore(&lock_, flags);
   return addr;
 }
 
 void PhysicalMemoryManager::free_block(physical_addr addr) {
   int block = addr / PHYS_BLOCK_SIZE;
 
+  uint32_t flags = spin_lock_irqsave(&lock_);
   map_unset(block);
   used_blocks_--;
+  spin_unlock_irqrestore(&lock_, flags);
 }
 
 bool PhysicalMemoryManager::is_alloced(physical_addr addr) {
@@ -87,12 +95,13 @@ bool PhysicalMemoryManager::is_alloced(physical_addr addr) {
 // Functions to allocate multiple blocks of memory
 
 physical_addr PhysicalMemoryManager::alloc_blocks(uint32_t count) {
-  if (total_blocks_ - used_blocks_ <= 0) {
-    return 0;
+  uint32_t flags = spin_lock_irqsave(&lock_);
+  int free_block = -1;
+  if (total_blocks_ - used_blocks_ > 0) {
+    free_block = find_free_blocks(count);
   }
-
-  int free_block = find_free_blocks(count);
   if (free_block == -1) {
+    spin_unlock_irqrestore(&lock_, flags);
     return 0;
   }
 
@@ -102,15 +111,18 @@ physical_addr PhysicalMemoryManager::alloc_blocks(uint32_t count) {
 
   uint32_t addr = free_block * PHYS_BLOCK_SIZE;
   used_blocks_ += count;
+  spin_unlock_irqrestore(&lock_, flags);
   return addr;
 }
 
 void PhysicalMemoryManager::free_blocks(physical_addr addr, uint32_t count) {
   int block = addr / PHYS_BLOCK_SIZE;
 
+  uint32_t flags = spin_lock_irqsave(&lock_);
   for (uint32_t i = 0; i < count; i++) map_unset(block + i);
 
   used_blocks_ -= count;
+  spin_unlock_irqrestore(&lock_, flags);
 }
 
 // Internal functions to allocate ranges of memory
@@ -119,8 +131,11 @@ void PhysicalMemoryManager::allocate_chunk(int base_addr, int length) {
   int cur_block_addr = base_addr / PHYS_BLOCK_SIZE;
   int num_blocks = length / PHYS_BLOCK_SIZE;
   while (num_blocks-- >= 0) {
+    // Ranges may overlap ones that are already reserved, only count new blocks
+    if (!map_test(cur_block_addr)) {
+      used_blocks_++;
+    }
     map_set(cur_block_addr++);
-    used_blocks_--;
   }
 }
 
@@ -161,8 +176,11 @@ PhysicalMemoryManager::PhysicalMemoryManager(struct multiboot_info* mb) {
   // From the freed memory, we need to allocate the ones used by the Kernel
   allocate_chunk(KERNEL_START_PADDR, KERNEL_SIZE);
 
+  // The page the other CPUs start from must never be handed out (one block)
+  allocate_chunk(SMP_TRAMPOLINE_PADDR, 0);
+
   // We also need to allocate the memory used by the Physical Map itself
-  allocate_chunk(*phys_memory_map_, total_blocks_);
+  allocate_chunk((uint32_t)phys_memory_map_, total_blocks_ / PHYS_BLOCKS_PER_BYTE);
   kernel_phys_map_start = (uint32_t)phys_memory_map_;
   kernel_phys_map_end =
       kernel_phys_map_start + (total_blocks_ / PHYS_BLOCKS_PER_BYTE);
@@ -170,4 +188,85 @@ PhysicalMemoryManager::PhysicalMemoryManager(struct multiboot_info* mb) {
          kernel_phys_map_start, kernel_phys_map_end);
 }
 
-void PhysicalMemoryManager::update_map_addr(physical_addr addr) { phys_memory_map_ = (uint32_t*)addr; }
\ No newline at end of file
+void PhysicalMemoryManager::update_map_addr(physical_addr addr) { phys_memory_map_ = (uint32_t*)addr; }
+
+// Statistics
+
+static const char* phys_zone_names[PHYS_ZONE_COUNT] = {"DMA", "Normal", "HighMem"};
+
+struct free_count {
+  const uint32_t* map;
+  volatile uint32_t free;
+};
+
+static void count_free_words(uint32_t begin, uint32_t end, void* arg) {
+  free_count* count = (free_count*)arg;
+  uint32_t free = 0;
+  for (uint32_t word = begin; word < end; word++)
+    free += 32 - __builtin_popcount(count->map[word]);
+  __atomic_add_fetch(&count->free, free, __ATOMIC_RELAXED);
+}
+
+uint32_t PhysicalMemoryManager::count_free(uint32_t first, uint32_t last) {
+  uint32_t free = 0;
+  uint32_t bit = first;
+  // Head and tail bits one by one, whole words in between
+  while (bit < last && bit % 32) {
+    if (!map_test(bit)) free++;
+    bit++;
+  }
+  if (bit + 32 <= last) {
+    // Big zones are split across the CPUs.
+    free_count count = {phys_memory_map_, 0};
+    parallel_for(bit / 32, last / 32, PHYS_COUNT_GRAIN_WORDS, count_free_words, &count);
+    free += count.free;
+    bit = last / 32 * 32;
+  }
+  while (bit < last) {
+    if (!map_test(bit)) free++;
+    bit++;
+  }
+  return free;
+}
+
+uint32_t PhysicalMemoryManager::get_zone_free_blocks(phys_zone zone) {
+  static const uint32_t zone_end[PHYS_ZONE_COUNT] = {
+      PHYS_ZONE_DMA_END / PHYS_BLOCK_SIZE, PHYS_ZONE_NORMAL_END / PHYS_BLOCK_SIZE,
+      0xFFFFFFFF};
+  uint32_t first = zone == PHYS_ZONE_DMA ? 0 : zone_end[zone - 1];
+  uint32_t last = zone_end[zone];
+  if (last > total_blocks_) last = total_blocks_;
+  if (first >= last) return 0;
+  return count_free(first, last);
+}
+
+uint32_t PhysicalMemoryManager::get_largest_free_run() {
+  uint32_t largest = 0;
+  uint32_t run = 0;
+  for (uint32_t bit = 0; bit < total_blocks_;) {
+    uint32_t word = phys_memory_map_[bit / 32];
+    if (bit % 32 == 0 && bit + 32 <= total_blocks_ && (word == 0 || word == 0xFFFFFFFF)) {
+      // Whole word free or used, no need to look at single bits
+      run = word ? 0 : run + 32;
+      bit += 32;
+    } else {
+      run = map_test(bit) ? 0 : run + 1;
+      bit++;
+    }
+    if (run > largest) largest = run;
+  }
+  return largest;
+}
+
+const char* PhysicalMemoryManager::zone_name(phys_zone zone) {
+  return zone < PHYS_ZONE_COUNT ? phys_zone_names[zone] : "unknown";
+}
+
+void PhysicalMemoryManager::print_stats() {
+  printf("Physical memory: %lu of %lu blocks used\n", used_blocks_, total_blocks_);
+  for (int zone = 0; zone < PHYS_ZONE_COUNT; zone++) {
+    printf("  %s: %lu free\n", zone_name((phys_zone)zone),
+           get_zone_free_blocks((phys_zone)zone));
+  }
+  printf("  largest free run: %lu blocks\n", get_largest_free_run());
+}
@@ -0,0 +1,146 @@
+#include <libk/irqflags.h>
+#include <libk/rcu.h>
+
+DEFINE_PER_CPU(uint32_t, rcu_idle) = 0;
+
+static DEFINE_LOCK_STATS(rcu_lock_stats, "rcu");
+spinlock_t Rcu::lock = SPINLOCK_INIT_STATS(&rcu_lock_stats);
+volatile uint32_t Rcu::gpStarted = 0;
+volatile uint32_t Rcu::gpCompleted = 0;
+volatile uint32_t Rcu::qsMask = 0;
+volatile uint32_t Rcu::onlineMask = 1;     // The boot CPU
+rcu_head *Rcu::nextList = 0;
+rcu_head **Rcu::nextTail = &Rcu::nextList;
+rcu_head *Rcu::waitList = 0;
+rcu_head **Rcu::waitTail = &Rcu::waitList;
+rcu_head *Rcu::doneList = 0;
+rcu_head **Rcu::doneTail = &Rcu::doneList;
+DeferredWork Rcu::callbackWork = { 0, runCallbacks, 0, DEFERRED_PRIORITY_LOW, false };
+uint32_t Rcu::callbacksRun = 0;
+
+void Rcu::cpuOnline(uint32_t cpu) {
+    // A grace period already running does not wait for it: it cannot hold
+    // anything that was removed before.
+    __atomic_fetch_or(&onlineMask, 1u << cpu, __ATOMIC_SEQ_CST);
+}
+
+void Rcu::startGp() {
+    waitList = nextList;
+    waitTail = nextTail;
+    nextList = 0;
+    nextTail = &nextList;
+    gpStarted++;
+
+    // The store is a full barrier: the removals the callbacks wait for are
+    // seen by every CPU that reads qsMask after it.
+    uint32_t online = onlineMask;
+    __atomic_store_n(&qsMask, online, __ATOMIC_SEQ_CST);
+
+    // Idle CPUs hold no references. One that went idle after this look
+    // finds its bit in qsMask, see idleEnter.
+    uint32_t idle = 0;
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if ((online & (1u << cpu)) && per_cpu(rcu_idle, cpu))
+            idle |= 1u << cpu;
+    }
+    if (idle)
+        clearQs(idle, true);
+}
+
+void Rcu::clearQs(uint32_t mask, bool locked) {
+    uint32_t old = __atomic_fetch_and(&qsMask, ~mask, __ATOMIC_SEQ_CST);
+    // Only whoever clears the last bit ends the grace period.
+    if (old == 0 || (old & ~mask))
+        return;
+    if (locked) {
+        completeGp();
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&lock);
+    completeGp();
+    spin_unlock_irqrestore(&lock, flags);
+}
+
+void Rcu::completeGp() {
+    gpCompleted = gpStarted;
+    if (waitList) {
+        *doneTail = waitList;
+        doneTail = waitTail;
+        waitList = 0;
+        waitTail = &waitList;
+        DeferredWorkQueue::schedule(&callbackWork);
+    }
+    if (nextList)
+        startGp();
+}
+
+void Rcu::reportQs() {
+    clearQs(1u << PerCpu::currentCpu(), false);
+}
+
+void Rcu::idleEnter() {
+    this_cpu_write(rcu_idle, 1);
+    // Pairs with startGp: either it sees the flag, or we see our bit.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    noteQs();
+}
+
+void Rcu::idleExit() {
+    this_cpu_write(rcu_idle, 0);
+    // No read-side load may pass the flag, or startGp could skip this CPU
+    // while it reads.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void Rcu::call(rcu_head *head, rcu_callback_t func) {
+    head->func = func;
+    head->next = 0;
+    uint32_t flags = spin_lock_irqsave(&lock);
+    *nextTail = head;
+    nextTail = &head->next;
+    if (gpStarted == gpCompleted)
+        startGp();
+    spin_unlock_irqrestore(&lock, flags);
+}
+
+void Rcu::runCallbacks(__attribute__((unused)) void *data) {
+    uint32_t flags = spin_lock_irqsave(&lock);
+    rcu_head *list = doneList;
+    doneList = 0;
+    doneTail = &doneList;
+    spin_unlock_irqrestore(&lock, flags);
+
+    while (list) {
+        rcu_head *next = list->next;
+        list->func(list);
+        callbacksRun++;
+        list = next;
+    }
+}
+
+struct rcu_sync {
+    rcu_head head;              /* Must stay first */
+    Thread *thread;
+    volatile bool done;
+};
+
+static void rcu_sync_done(rcu_head *head) {
+    rcu_sync *sync = (rcu_sync *)head;
+    // The waiter may return as soon as it sees 'done', taking 'sync' along.
+    Thread *thread = sync->thread;
+    sync->done = true;
+    Scheduler::wake(thread);
+}
+
+void Rcu::synchronize() {
+    rcu_sync sync;
+    sync.thread = Scheduler::getCurrent();
+    sync.done = false;
+    call(&sync.head, rcu_sync_done);
+
+    // Blocking is a quiescent state of this CPU already.
+    uint32_t flags = local_irq_save();
+    while (!sync.done)
+        Scheduler::block();
+    local_irq_restore(flags);
+}
@@ -0,0 +1,53 @@
+#include <libk/spinlock.h>
+
+void spin_lock_slow(spinlock_t *lock, uint16_t ticket) {
+    bool timed = lock->stats && LockStats::enabled;
+    uint64_t start = timed ? rdtsc() : 0;
+
+    for (;;) {
+        uint16_t owner = __atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE);
+        if (owner == ticket)
+            break;
+        // Every holder ahead of us takes a while, no need to look sooner.
+        uint16_t ahead = ticket - owner;
+        for (uint32_t i = 0; i < ahead * SPIN_BACKOFF_PAUSES; i++)
+            cpu_relax();
+    }
+
+    if (timed) {
+        LockStats::acquired(lock->stats);
+        LockStats::waited(lock->stats, rdtsc() - start);
+    }
+}
+
+void read_lock_slow(rwlock_t *lock) {
+    // Step back and queue behind the writer.
+    __atomic_fetch_sub(&lock->cnts, RW_LOCK_READER, __ATOMIC_RELAXED);
+    spin_lock(&lock->wait);
+    __atomic_fetch_add(&lock->cnts, RW_LOCK_READER, __ATOMIC_RELAXED);
+    // A waiting writer holds 'wait', so only one holding the lock is left.
+    while (__atomic_load_n(&lock->cnts, __ATOMIC_ACQUIRE) & RW_LOCK_LOCKED)
+        cpu_relax();
+    spin_unlock(&lock->wait);
+}
+
+void write_lock_slow(rwlock_t *lock) {
+    spin_lock(&lock->wait);
+    uint32_t expected = 0;
+    if (__atomic_compare_exchange_n(&lock->cnts, &expected, RW_LOCK_LOCKED, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        spin_unlock(&lock->wait);
+        return;
+    }
+
+    // Keep new readers out, then wait for the ones inside to leave.
+    __atomic_fetch_or(&lock->cnts, RW_LOCK_WAITING, __ATOMIC_RELAXED);
+    for (;;) {
+        expected = RW_LOCK_WAITING;
+        if (__atomic_compare_exchange_n(&lock->cnts, &expected, RW_LOCK_LOCKED, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        cpu_relax();
+    }
+    spin_unlock(&lock->wait);
+}
@@ -0,0 +1,143 @@
+#include <arch/i386/smp.h>
+#include <asm.h>
+#include <libk/task_group.h>
+#include <libk/thread.h>
+#include <stdio.h>
+
+static DEFINE_LOCK_STATS(worker_lock_stats, "workers");
+spinlock_t WorkerPool::lock = SPINLOCK_INIT_STATS(&worker_lock_stats);
+parallel_task *WorkerPool::head = 0;
+parallel_task *WorkerPool::tail = 0;
+volatile uint32_t WorkerPool::queued = 0;
+wait_queue_t WorkerPool::idle = WAIT_QUEUE_INIT;
+uint32_t WorkerPool::workers = 0;
+uint32_t WorkerPool::tasksRun = 0;
+
+void TaskGroup::spawn(parallel_task *task, task_func_t func, void *arg) {
+    if (!WorkerPool::getWorkers()) {
+        func(arg);
+        return;
+    }
+    task->func = func;
+    task->arg = arg;
+    task->group = this;
+    __atomic_add_fetch(&pending, 1, __ATOMIC_RELAXED);
+    WorkerPool::submit(task);
+}
+
+void TaskGroup::wait() {
+    // Helping out beats sleeping: the tasks are short and the waiter may
+    // well be the boot CPU's idle context, which cannot sleep.
+    while (__atomic_load_n(&pending, __ATOMIC_ACQUIRE)) {
+        if (!WorkerPool::runOne())
+            cpu_relax();
+    }
+}
+
+void WorkerPool::init() {
+    uint32_t cpus = SMP::getOnlineCount();
+    // One CPU gains nothing from handing its work to a thread.
+    if (cpus < 2)
+        return;
+    uint32_t started = 0;
+    for (uint32_t i = 0; i < cpus; i++) {
+        if (Scheduler::create("worker", workerMain, 0))
+            started++;
+    }
+    workers = started;
+    printf("WorkerPool: %lu workers.\n", workers);
+}
+
+void WorkerPool::workerMain(__attribute__((unused)) void *arg) {
+    for (;;) {
+        wait_event(&idle, queued != 0);
+        runOne();
+    }
+}
+
+void WorkerPool::submit(parallel_task *task) {
+    task->next = 0;
+    uint32_t flags = spin_lock_irqsave(&lock);
+    if (tail)
+        tail->next = task;
+    else
+        head = task;
+    tail = task;
+    queued = queued + 1;
+    spin_unlock_irqrestore(&lock, flags);
+    WaitQueue::wakeOne(&idle);
+}
+
+parallel_task *WorkerPool::take() {
+    uint32_t flags = spin_lock_irqsave(&lock);
+    parallel_task *task = head;
+    if (task) {
+        head = task->next;
+        if (!head)
+            tail = 0;
+        queued = queued - 1;
+    }
+    spin_unlock_irqrestore(&lock, flags);
+    return task;
+}
+
+bool WorkerPool::runOne() {
+    parallel_task *task = take();
+    if (!task)
+        return false;
+    // The waiter may return as soon as the group is done, taking 'task' along.
+    TaskGroup *group = task->group;
+    task->func(task->arg);
+    __atomic_add_fetch(&tasksRun, 1, __ATOMIC_RELAXED);
+    group->taskDone();
+    return true;
+}
+
+/* A parallel_for in progress. Every runner claims chunks until none are left. */
+struct parallel_range {
+    volatile uint32_t next;     /* First index nobody claimed yet */
+    uint32_t end;
+    uint32_t grain;
+    parallel_for_func_t func;
+    void *arg;
+};
+
+static void parallel_range_run(void *data) {
+    parallel_range *range = (parallel_range *)data;
+    uint32_t begin = __atomic_load_n(&range->next, __ATOMIC_RELAXED);
+    for (;;) {
+        if (begin >= range->end)
+            return;
+        uint32_t end = range->end - begin > range->grain ? begin + range->grain : range->end;
+        // Claimed with a compare and swap, an add could run past the end and wrap.
+        if (!__atomic_compare_exchange_n(&range->next, &begin, end, false,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            continue;
+        range->func(begin, end, range->arg);
+        begin = end;
+    }
+}
+
+void parallel_for(uint32_t begin, uint32_t end, uint32_t grain,
+                  parallel_for_func_t func, void *arg) {
+    if (begin >= end)
+        return;
+    if (grain == 0)
+        grain = 1;
+    // The caller takes a chunk as well, a helper per other chunk is plenty.
+    uint32_t helpers = (end - begin - 1) / grain;
+    if (helpers > WorkerPool::getWorkers())
+        helpers = WorkerPool::getWorkers();
+    if (helpers == 0) {
+        func(begin, end, arg);
+        return;
+    }
+
+    parallel_range range = { begin, end, grain, func, arg };
+    parallel_task tasks[SMP_MAX_CPUS];
+    TaskGroup group;
+    for (uint32_t i = 0; i < helpers && i < SMP_MAX_CPUS; i++)
+        group.spawn(&tasks[i], parallel_range_run, &range);
+    parallel_range_run(&range);
+    group.wait();
+}
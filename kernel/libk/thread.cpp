@@ -0,0 +1,471 @@
+#include <arch/i386/smp.h>
+#include <arch/i386/syscall.h>
+#include <assert.h>
+#include <devices/clocksource.h>
+#include <devices/serial.h>
+#include <libk/heap_mem.h>
+#include <libk/irqflags.h>
+#include <libk/new.h>
+#include <libk/rcu.h>
+#include <libk/thread.h>
+#include <libk/timer_wheel.h>
+#include <string.h>
+
+DEFINE_PER_CPU(uint32_t, preempt_count) = 0;
+DEFINE_PER_CPU(uint8_t, need_resched) = 0;
+DEFINE_PER_CPU(Thread *, current_thread) = 0;
+
+// All zeroes: empty deques and inboxes, see initCpu for the rest.
+sched_cpu Scheduler::cpus[SMP_MAX_CPUS];
+volatile uint32_t Scheduler::onlineMask = 0;
+volatile uint32_t Scheduler::idleMask = 0;
+volatile uint32_t Scheduler::nextId = 0;
+
+static DEFINE_LOCK_STATS(sched_lock_stats, "sched-inbox");
+
+// The idle threads run on the boot stacks, only their control blocks are needed.
+alignas(Thread) static uint8_t idleThreadStorage[SMP_MAX_CPUS][sizeof(Thread)];
+
+/* Written to the bottom of a dead thread's stack, which nobody uses any more. */
+struct dead_thread {
+    rcu_head head;              /* Must stay first */
+    Thread *thread;
+};
+
+static void free_dead_thread(rcu_head *head) {
+    Thread *thread = ((dead_thread *)head)->thread;
+    kfree(thread->stack);
+    kfree(thread);
+}
+
+void Scheduler::init() {
+    initCpu(0);
+}
+
+void Scheduler::initCpu(uint32_t cpu) {
+    sched_cpu *rq = &cpus[cpu];
+    spin_lock_init(&rq->inboxLock, &sched_lock_stats);
+    Thread *idle = new (idleThreadStorage[cpu]) Thread();
+    idle->id = __atomic_fetch_add(&nextId, 1, __ATOMIC_RELAXED);
+    idle->state = THREAD_RUNNING;
+    idle->name = "idle";
+    idle->cpu = cpu;
+    idle->onCpu = true;
+    rq->idle = idle;
+    rq->lastSwitchNs = ClockSource::nowNs();
+    this_cpu_write(current_thread, idle);
+    __atomic_fetch_or(&onlineMask, 1u << cpu, __ATOMIC_SEQ_CST);
+}
+
+Thread *Scheduler::create(const char *name, thread_func_t func, void *arg) {
+    Thread *thread = (Thread *)kmalloc(sizeof(Thread), HEAP_TAG_SCHED);
+    uint8_t *stack = (uint8_t *)kmalloc(THREAD_STACK_SIZE, HEAP_TAG_SCHED);
+    if (!thread || !stack) {
+        kfree(thread);
+        kfree(stack);
+        return 0;
+    }
+    new (thread) Thread();
+    thread->name = name;
+    thread->stack = stack;
+    thread->func = func;
+    thread->arg = arg;
+    *(uint32_t *)stack = THREAD_STACK_MAGIC;
+
+    // The frame switch_context pops: EFLAGS (interrupts off, as in
+    // schedule), edi, esi, ebx, ebp, then it returns into threadStart.
+    uint32_t *sp = (uint32_t *)(stack + THREAD_STACK_SIZE);
+    *--sp = 0;                          // threadStart never returns
+    *--sp = (uint32_t)threadStart;
+    *--sp = 0;                          // ebp
+    *--sp = 0;                          // ebx
+    *--sp = 0;                          // esi
+    *--sp = 0;                          // edi
+    *--sp = 0x002;                      // EFLAGS, bit 1 is always set
+    thread->esp = (uint32_t)sp;
+
+    uint32_t flags = local_irq_save();
+    uint32_t cpu = PerCpu::currentCpu();
+    thread->id = __atomic_fetch_add(&nextId, 1, __ATOMIC_RELAXED);
+    thread->cpu = cpu;
+    thread->state = THREAD_READY;
+    pushLocal(&cpus[cpu], thread);
+    kickIdle(cpu, &cpus[cpu]);
+    local_irq_restore(flags);
+    return thread;
+}
+
+void Scheduler::threadStart() {
+    // The tail of schedule(), which this thread never ran.
+    finishSwitch();
+    local_irq_enable();
+    Thread *self = getCurrent();
+    self->func(self->arg);
+    exit();
+}
+
+void Scheduler::exit() {
+    local_irq_disable();
+    __atomic_store_n(&getCurrent()->state, THREAD_DEAD, __ATOMIC_RELAXED);
+    schedule();
+    // A dead thread is never picked again, finishSwitch frees it.
+    for (;;);
+}
+
+void Scheduler::pushLocal(sched_cpu *rq, Thread *thread) {
+    // A full deque overflows into the inbox, drained as it empties.
+    if (!rq->queue.push(thread))
+        pushInbox(rq, thread);
+}
+
+void Scheduler::pushInbox(sched_cpu *rq, Thread *thread) {
+    thread->queueNext = 0;
+    spin_lock(&rq->inboxLock);
+    if (rq->inboxTail)
+        rq->inboxTail->queueNext = thread;
+    else
+        rq->inbox = thread;
+    rq->inboxTail = thread;
+    rq->inboxCount++;
+    spin_unlock(&rq->inboxLock);
+}
+
+Thread *Scheduler::popInbox(sched_cpu *rq) {
+    if (!rq->inboxCount)
+        return 0;
+    spin_lock(&rq->inboxLock);
+    Thread *thread = rq->inbox;
+    if (thread) {
+        rq->inbox = thread->queueNext;
+        if (!rq->inbox)
+            rq->inboxTail = 0;
+        rq->inboxCount--;
+    }
+    spin_unlock(&rq->inboxLock);
+    return thread;
+}
+
+void Scheduler::drainInbox(sched_cpu *rq) {
+    while (rq->inboxCount && rq->queue.size() < SCHED_QUEUE_SIZE) {
+        Thread *thread = popInbox(rq);
+        if (!thread)
+            break;
+        rq->queue.push(thread);
+    }
+}
+
+Thread *Scheduler::pickNext(uint32_t cpu, sched_cpu *rq) {
+    drainInbox(rq);
+    // The owner takes from the top as well: oldest first, round robin.
+    while (!rq->queue.isEmpty()) {
+        if (Thread *thread = rq->queue.steal())
+            return thread;
+    }
+    return steal(cpu, rq);
+}
+
+Thread *Scheduler::steal(uint32_t cpu, sched_cpu *rq) {
+    uint32_t others = onlineMask & ~(1u << cpu);
+    while (others) {
+        // The longest queue first, it has the most to spare.
+        uint32_t victim = 0;
+        uint32_t most = 0;
+        for (uint32_t mask = others; mask; mask &= mask - 1) {
+            uint32_t n = queued(&cpus[__builtin_ctz(mask)]);
+            if (n > most) {
+                most = n;
+                victim = __builtin_ctz(mask);
+            }
+        }
+        if (!most)
+            return 0;
+
+        sched_cpu *from = &cpus[victim];
+        Thread *thread = 0;
+        while (!(thread = from->queue.steal()) && !from->queue.isEmpty())
+            cpu_relax();
+        if (!thread)
+            thread = popInbox(from);
+        if (thread) {
+            rq->stats.steals++;
+            return thread;
+        }
+        others &= ~(1u << victim);
+    }
+    return 0;
+}
+
+uint32_t Scheduler::selectCpu(Thread *thread, uint32_t self) {
+    uint32_t last = thread->cpu;
+    if (last == self || !(onlineMask & (1u << last)))
+        return self;
+    // The CPU it last ran on may still have its data in cache. That is
+    // worth a short wait there, not a long one.
+    if (queued(&cpus[last]) <= queued(&cpus[self]) + SCHED_WAKE_IMBALANCE)
+        return last;
+    return self;
+}
+
+void Scheduler::kickIdle(uint32_t cpu, sched_cpu *rq) {
+    uint32_t self = PerCpu::currentCpu();
+    if (per_cpu(current_thread, cpu) == rq->idle) {
+        if (cpu == self)
+            this_cpu_write(need_resched, 1);
+        else
+            SMP::kick(cpu);
+        return;
+    }
+    // Pairs with idleEnter: either that CPU sees the thread, or we see it
+    // idle. The first to clear its bit gets to kick it.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (uint32_t idle = idleMask & ~(1u << self); idle; idle &= idle - 1) {
+        uint32_t bit = idle & -idle;
+        if (__atomic_fetch_and(&idleMask, ~bit, __ATOMIC_RELAXED) & bit) {
+            __atomic_fetch_add(&rq->stats.kicks, 1, __ATOMIC_RELAXED);
+            SMP::kick(__builtin_ctz(bit));
+            return;
+        }
+    }
+}
+
+void Scheduler::balance() {
+    for (uint32_t mask = onlineMask; mask && idleMask; mask &= mask - 1) {
+        uint32_t cpu = __builtin_ctz(mask);
+        if (queued(&cpus[cpu]))
+            kickIdle(cpu, &cpus[cpu]);
+    }
+}
+
+void Scheduler::schedule() {
+    uint32_t cpu = PerCpu::currentCpu();
+    sched_cpu *rq = &cpus[cpu];
+    Thread *prev = getCurrent();
+    this_cpu_write(need_resched, 0);
+    // Preemption is on or the thread gave up the CPU itself: it is outside
+    // any RCU read-side section.
+    Rcu::noteQs();
+
+    assert(!prev->stack || *(uint32_t *)prev->stack == THREAD_STACK_MAGIC);
+    // Still runnable: it is queued again once it is off this CPU, see
+    // finishSwitch. Only the bits wake() sets can change meanwhile.
+    bool runnable = prev != rq->idle && (prev->state & THREAD_STATE_MASK) == THREAD_RUNNING;
+    if (runnable)
+        __atomic_fetch_or(&prev->state, THREAD_READY, __ATOMIC_RELAXED);
+
+    Thread *next = pickNext(cpu, rq);
+    if (!next) {
+        // Nothing else to run. The idle thread takes over, unless the
+        // previous thread can go on or was idle already.
+        if (runnable)
+            next = prev;
+        else if (prev == rq->idle)
+            return;
+        else
+            next = rq->idle;
+    }
+    __atomic_fetch_and(&next->state, ~THREAD_STATE_MASK, __ATOMIC_ACQUIRE);
+    next->sliceLeft = SCHED_TIMESLICE_TICKS;
+    if (next == prev)
+        return;
+
+    if (next->cpu != cpu) {
+        next->cpu = cpu;
+        rq->stats.migrations++;
+    }
+    uint64_t now = ClockSource::nowNs();
+    prev->runtimeNs += now - rq->lastSwitchNs;
+    rq->lastSwitchNs = now;
+    rq->stats.switches++;
+    next->switches++;
+    next->onCpu = true;
+    rq->prev = prev;
+    rq->requeuePrev = runnable;
+    this_cpu_write(current_thread, next);
+    if (next->stack)
+        Syscall::setKernelStack((uint32_t)(next->stack + THREAD_STACK_SIZE));
+    switch_context(&prev->esp, next->esp);
+
+    // Back on prev's stack, some time later, maybe on another CPU.
+    finishSwitch();
+}
+
+void Scheduler::finishSwitch() {
+    sched_cpu *rq = thisRq();
+    Thread *prev = rq->prev;
+    rq->prev = 0;
+    // Nobody waits for a dead thread to leave, and once it has left a
+    // woken one may run and die elsewhere: look before letting go.
+    if ((prev->state & THREAD_STATE_MASK) == THREAD_DEAD) {
+        // Its waker may not be done with it: a stale wakeup can let a
+        // thread see its condition, return and exit before wake() looked
+        // at it. Wakers run with preemption off, a grace period outlasts them.
+        dead_thread *dead = (dead_thread *)prev->stack;
+        dead->thread = prev;
+        Rcu::call(&dead->head, free_dead_thread);
+        return;
+    }
+    // Its stack is no longer in use, another CPU may pick it up.
+    __atomic_store_n(&prev->onCpu, false, __ATOMIC_RELEASE);
+    if (rq->requeuePrev)
+        pushLocal(rq, prev);
+}
+
+void Scheduler::yield() {
+    uint32_t flags = local_irq_save();
+    schedule();
+    local_irq_restore(flags);
+}
+
+void Scheduler::block() {
+    Thread *self = getCurrent();
+    uint32_t state = __atomic_load_n(&self->state, __ATOMIC_RELAXED);
+    for (;;) {
+        if (state & THREAD_WAKEUP) {
+            // Woken since the caller last checked its condition.
+            __atomic_fetch_and(&self->state, ~THREAD_WAKEUP, __ATOMIC_ACQUIRE);
+            return;
+        }
+        if (__atomic_compare_exchange_n(&self->state, &state, THREAD_BLOCKED, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+    schedule();
+}
+
+void Scheduler::wake(Thread *thread) {
+    uint32_t state = __atomic_load_n(&thread->state, __ATOMIC_RELAXED);
+    for (;;) {
+        if (state == THREAD_BLOCKED) {
+            if (__atomic_compare_exchange_n(&thread->state, &state, THREAD_READY, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+                break;
+            continue;
+        }
+        // Not asleep (yet): its next block() returns right away.
+        if ((state & THREAD_WAKEUP) || (state & THREAD_STATE_MASK) == THREAD_DEAD)
+            return;
+        if (__atomic_compare_exchange_n(&thread->state, &state, state | THREAD_WAKEUP, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return;
+    }
+
+    // It may have blocked a moment ago and still be switching away.
+    while (__atomic_load_n(&thread->onCpu, __ATOMIC_ACQUIRE))
+        cpu_relax();
+
+    uint32_t flags = local_irq_save();
+    uint32_t self = PerCpu::currentCpu();
+    uint32_t cpu = selectCpu(thread, self);
+    sched_cpu *rq = &cpus[cpu];
+    if (cpu == self) {
+        pushLocal(rq, thread);
+        rq->stats.wakeLocal++;
+    } else {
+        pushInbox(rq, thread);
+        __atomic_fetch_add(&rq->stats.wakeRemote, 1, __ATOMIC_RELAXED);
+    }
+    kickIdle(cpu, rq);
+    local_irq_restore(flags);
+}
+
+struct sleeper {
+    Thread *thread;
+    volatile bool done;
+};
+
+void Scheduler::sleepWake(void *data) {
+    sleeper *sleep = (sleeper *)data;
+    // Gone as soon as 'done' is seen, read it first.
+    Thread *thread = sleep->thread;
+    sleep->done = true;
+    wake(thread);
+}
+
+void Scheduler::sleepMs(uint32_t ms) {
+    sleeper sleep = { getCurrent(), false };
+    KTimer timer;
+    ktimer_init(&timer, sleepWake, &sleep);
+    uint32_t flags = local_irq_save();
+    TimerWheel::add(&timer, TimerWheel::expiryAfterMs(ms));
+    while (!sleep.done)
+        block();
+    local_irq_restore(flags);
+}
+
+void Scheduler::tick() {
+    sched_cpu *rq = thisRq();
+    Thread *current = getCurrent();
+    if (current == rq->idle) {
+        if (hasReady())
+            this_cpu_write(need_resched, 1);
+    } else if (current->sliceLeft && --current->sliceLeft == 0) {
+        this_cpu_write(need_resched, 1);
+    }
+    if (++rq->balanceTicks >= SCHED_BALANCE_TICKS) {
+        rq->balanceTicks = 0;
+        balance();
+    }
+}
+
+void Scheduler::preemptEnable() {
+    asm volatile("" : : : "memory");
+    this_cpu_dec(preempt_count);
+    if (this_cpu_read(preempt_count) || !this_cpu_read(need_resched) || irqs_disabled())
+        return;
+    local_irq_disable();
+    schedule();
+    local_irq_enable();
+}
+
+void Scheduler::idleEnter() {
+    __atomic_fetch_or(&idleMask, 1u << PerCpu::currentCpu(), __ATOMIC_SEQ_CST);
+}
+
+void Scheduler::idleExit() {
+    __atomic_fetch_and(&idleMask, ~(1u << PerCpu::currentCpu()), __ATOMIC_RELAXED);
+}
+
+bool Scheduler::hasReady() {
+    // Its own queue or one to steal from, it makes no difference here.
+    for (uint32_t mask = onlineMask; mask; mask &= mask - 1) {
+        if (queued(&cpus[__builtin_ctz(mask)]))
+            return true;
+    }
+    return false;
+}
+
+bool Scheduler::getStats(uint32_t cpu, sched_stats *stats) {
+    if (cpu >= SMP_MAX_CPUS || !(onlineMask & (1u << cpu)))
+        return false;
+    memcpy(stats, &cpus[cpu].stats, sizeof(*stats));
+    return true;
+}
+
+void Scheduler::dumpStats() {
+    Serial::write("# openos sched stats v1\n");
+    for (uint32_t mask = onlineMask; mask; mask &= mask - 1) {
+        uint32_t cpu = __builtin_ctz(mask);
+        sched_cpu *rq = &cpus[cpu];
+        Serial::write("cpu ");
+        Serial::writeDec(cpu);
+        Serial::write(" switches ");
+        Serial::writeDec(rq->stats.switches);
+        Serial::write(" migrations ");
+        Serial::writeDec(rq->stats.migrations);
+        Serial::write(" steals ");
+        Serial::writeDec(rq->stats.steals);
+        Serial::write(" wake-local ");
+        Serial::writeDec(rq->stats.wakeLocal);
+        Serial::write(" wake-remote ");
+        Serial::writeDec(rq->stats.wakeRemote);
+        Serial::write(" kicks ");
+        Serial::writeDec(rq->stats.kicks);
+        Serial::write(" queued ");
+        Serial::writeDec(queued(rq));
+        // Up to its last switch
+        Serial::write(" idle-ns ");
+        Serial::writeHex64(rq->idle->runtimeNs);
+        Serial::putchar('\n');
+    }
+    Serial::write("# end\n");
+}
@@ -0,0 +1,249 @@
+#include <arch/i386/percpu.h>
+#include <arch/i386/smp.h>
+#include <devices/timer.h>
+#include <libk/deferred_work.h>
+#include <libk/new.h>
+#include <libk/thread.h>
+#include <libk/timer_wheel.h>
+#include <string.h>
+
+TimerWheel::slot_t *TimerWheel::slots = 0;
+static DEFINE_LOCK_STATS(timer_wheel_lock_stats, "timer-wheel");
+spinlock_t TimerWheel::lock = SPINLOCK_INIT_STATS(&timer_wheel_lock_stats);
+uint32_t TimerWheel::slotMap[TIMER_WHEEL_SLOTS / 32];
+uint64_t TimerWheel::current = 0;
+uint64_t TimerWheel::nextHint = TIMER_NO_EVENT;
+uint32_t TimerWheel::pending = 0;
+
+// One more list than there are slots: the timers being expired right now.
+#define TIMER_WHEEL_EXPIRING TIMER_WHEEL_SLOTS
+
+alignas(ListNode) static uint8_t slotStorage[sizeof(IntrusiveList<KTimer, &KTimer::entry>) * (TIMER_WHEEL_SLOTS + 1)];
+static DeferredWork timerWork;
+
+// First slot of 'level' (0 is the root) and how far its slots reach
+static inline uint32_t levelBase(uint32_t level) {
+    return level ? TIMER_WHEEL_ROOT_SIZE + (level - 1) * TIMER_WHEEL_LEVEL_SIZE : 0;
+}
+
+static inline uint32_t levelShift(uint32_t level) {
+    return level ? TIMER_WHEEL_ROOT_BITS + (level - 1) * TIMER_WHEEL_LEVEL_BITS : 0;
+}
+
+void TimerWheel::init() {
+    slots = (slot_t *)slotStorage;
+    for (uint32_t slot = 0; slot <= TIMER_WHEEL_EXPIRING; slot++) {
+        new (&slots[slot]) slot_t();
+    }
+    memset(slotMap, 0, sizeof(slotMap));
+    current = Timer::get_ticks();
+    nextHint = TIMER_NO_EVENT;
+    pending = 0;
+    deferred_work_init(&timerWork, runExpired, 0, DEFERRED_PRIORITY_HIGH);
+}
+
+uint32_t TimerWheel::slotFor(uint64_t expires) {
+    // Already due: the very next tick processed runs it.
+    if (expires < current)
+        return current & (TIMER_WHEEL_ROOT_SIZE - 1);
+
+    uint64_t delta = expires - current;
+    if (delta > TIMER_WHEEL_MAX_DELTA) {
+        expires = current + TIMER_WHEEL_MAX_DELTA;
+        delta = TIMER_WHEEL_MAX_DELTA;
+    }
+    if (delta < TIMER_WHEEL_ROOT_SIZE)
+        return expires & (TIMER_WHEEL_ROOT_SIZE - 1);
+    for (uint32_t level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if (delta < (1ULL << levelShift(level + 1)))
+            return levelBase(level) + ((expires >> levelShift(level)) & (TIMER_WHEEL_LEVEL_SIZE - 1));
+    }
+    return levelBase(TIMER_WHEEL_LEVELS) +
+           ((expires >> levelShift(TIMER_WHEEL_LEVELS)) & (TIMER_WHEEL_LEVEL_SIZE - 1));
+}
+
+void TimerWheel::enqueue(KTimer *timer) {
+    uint32_t slot = slotFor(timer->expires);
+    timer->slot = slot;
+    slots[slot].pushBack(timer);
+    slotMap[slot / 32] |= 1 << (slot % 32);
+    pending++;
+    if (timer->expires < nextHint)
+        nextHint = timer->expires;
+}
+
+void TimerWheel::dequeue(KTimer *timer) {
+    uint32_t slot = timer->slot;
+    slots[slot].remove(timer);
+    if (slot != TIMER_WHEEL_EXPIRING && slots[slot].isEmpty())
+        slotMap[slot / 32] &= ~(1 << (slot % 32));
+    pending--;
+}
+
+uint32_t TimerWheel::cascade(uint32_t level, uint32_t index) {
+    uint32_t slot = levelBase(level) + index;
+    // Every timer of the slot now lands on a finer level, never back here.
+    while (KTimer *timer = slots[slot].front()) {
+        dequeue(timer);
+        enqueue(timer);
+    }
+    return index;
+}
+
+void TimerWheel::wakeTimekeeper(uint64_t expires, uint64_t hint) {
+    // The boot CPU takes the tick. Idle, it may have stopped it until
+    // 'hint', so a sooner timer added on another CPU would wait for that:
+    // kick it over to program a new one-shot. The idle loop announces
+    // itself before it reads the next expiry, under the lock we just
+    // dropped, so one of the two sees the other.
+    if (expires < hint && PerCpu::currentCpu() != 0 && Scheduler::isIdle(0))
+        SMP::kick(0);
+}
+
+void TimerWheel::add(KTimer *timer, uint64_t expires) {
+    uint32_t flags = spin_lock_irqsave(&lock);
+    uint64_t hint = nextHint;
+    timer->expires = expires;
+    enqueue(timer);
+    spin_unlock_irqrestore(&lock, flags);
+    wakeTimekeeper(expires, hint);
+}
+
+bool TimerWheel::mod(KTimer *timer, uint64_t expires) {
+    uint32_t flags = spin_lock_irqsave(&lock);
+    uint64_t hint = nextHint;
+    bool was_pending = isPending(timer);
+    if (was_pending)
+        dequeue(timer);
+    timer->expires = expires;
+    enqueue(timer);
+    spin_unlock_irqrestore(&lock, flags);
+    wakeTimekeeper(expires, hint);
+    return was_pending;
+}
+
+bool TimerWheel::cancel(KTimer *timer) {
+    uint32_t flags = spin_lock_irqsave(&lock);
+    bool was_pending = isPending(timer);
+    if (was_pending)
+        dequeue(timer);
+    // nextHint may now be early. That only costs one needless run().
+    spin_unlock_irqrestore(&lock, flags);
+    return was_pending;
+}
+
+void TimerWheel::tick(uint64_t ticks) {
+    if (ticks >= nextHint)
+        DeferredWorkQueue::schedule(&timerWork);
+}
+
+void TimerWheel::runExpired(__attribute__((unused)) void *data) {
+    run(Timer::get_ticks());
+}
+
+void TimerWheel::run(uint64_t ticks) {
+    uint32_t flags = spin_lock_irqsave(&lock);
+    if (!pending) {
+        // Nothing to cascade either, skip the ticks slept through.
+        if (current <= ticks)
+            current = ticks + 1;
+    }
+    while (current <= ticks) {
+        uint32_t index = current & (TIMER_WHEEL_ROOT_SIZE - 1);
+        // The root level wrapped around: pull the next slot of each level
+        // that wrapped as well down a level.
+        for (uint32_t level = 1; !index && level <= TIMER_WHEEL_LEVELS; level++) {
+            index = cascade(level, (current >> levelShift(level)) & (TIMER_WHEEL_LEVEL_SIZE - 1));
+        }
+        index = current & (TIMER_WHEEL_ROOT_SIZE - 1);
+        current++;
+
+        // Moved aside first, a timer re-added 255 ticks out lands in this
+        // very slot again. Then taken one by one: a callback may cancel or
+        // re-add any timer, including its own.
+        slot_t *expiring = &slots[TIMER_WHEEL_EXPIRING];
+        while (KTimer *timer = slots[index].popFront()) {
+            timer->slot = TIMER_WHEEL_EXPIRING;
+            expiring->pushBack(timer);
+        }
+        slotMap[index / 32] &= ~(1 << (index % 32));
+        while (KTimer *timer = expiring->front()) {
+            dequeue(timer);
+            spin_unlock_irqrestore(&lock, flags);
+            timer->func(timer->data);
+            flags = spin_lock_irqsave(&lock);
+        }
+    }
+    nextHint = findNextExpiry();
+    spin_unlock_irqrestore(&lock, flags);
+}
+
+uint32_t TimerWheel::findBusySlot(uint32_t first, uint32_t size, uint32_t start) {
+    // Levels start and end on word boundaries, so a word never spans the
+    // wrap around.
+    uint32_t distance = 0;
+    while (distance < size) {
+        uint32_t slot = first + (start + distance) % size;
+        uint32_t bits = slotMap[slot / 32] >> (slot % 32);
+        if (bits)
+            return distance + __builtin_ctz(bits);
+        distance += 32 - slot % 32;
+    }
+    return size;
+}
+
+uint64_t TimerWheel::findNextExpiry() {
+    if (!pending)
+        return TIMER_NO_EVENT;
+
+    // Root slots hold exactly the timers of the next 256 ticks.
+    uint64_t next = TIMER_NO_EVENT;
+    uint32_t distance = findBusySlot(0, TIMER_WHEEL_ROOT_SIZE, current & (TIMER_WHEEL_ROOT_SIZE - 1));
+    if (distance < TIMER_WHEEL_ROOT_SIZE)
+        next = current + distance;
+
+    // A timer on a higher level expires no earlier than its slot is cascaded.
+    for (uint32_t level = 1; level <= TIMER_WHEEL_LEVELS; level++) {
+        uint32_t shift = levelShift(level);
+        uint32_t index = (current >> shift) & (TIMER_WHEEL_LEVEL_SIZE - 1);
+        // Unless 'current' is the tick that cascades it, the current index
+        // was cascaded already and its timers are a lap ahead.
+        uint32_t ahead = (current & ((1ULL << shift) - 1)) ? 1 : 0;
+        distance = findBusySlot(levelBase(level), TIMER_WHEEL_LEVEL_SIZE,
+                                (index + ahead) % TIMER_WHEEL_LEVEL_SIZE);
+        if (distance == TIMER_WHEEL_LEVEL_SIZE)
+            continue;
+        uint64_t cascade_at = ((current >> shift) + ahead + distance) << shift;
+        if (cascade_at < next)
+            next = cascade_at;
+    }
+    return next;
+}
+
+uint64_t TimerWheel::nextExpiry() {
+    uint32_t flags = spin_lock_irqsave(&lock);
+    uint64_t next = nextHint;
+    spin_unlock_irqrestore(&lock, flags);
+    return next;
+}
+
+uint64_t TimerWheel::nextExpiryNs() {
+    uint64_t next = nextExpiry();
+    if (next == TIMER_NO_EVENT)
+        return TIMER_NO_EVENT;
+    uint64_t now = ClockSource::nowNs();
+    uint64_t ticks = Timer::get_ticks();
+    return next <= ticks ? now : now + (next - ticks) * TICK_NSEC;
+}
+
+uint64_t TimerWheel::expiryAfterMs(uint32_t ms) {
+    // The tick count stands still while the boot CPU's tick is stopped and
+    // only catches up on its next interrupt. Counting from the stale value
+    // could fire early: count from the clock, or the tick if that is ahead.
+    uint64_t now = div64_32(ClockSource::nowNs(), TICK_NSEC);
+    uint64_t ticks = Timer::get_ticks();
+    if (ticks > now)
+        now = ticks;
+    // One more tick, the current one is already partly over.
+    return now + msecs_to_ticks(ms) + 1;
+}
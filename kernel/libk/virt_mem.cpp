@@ -34,6 +34,21 @@ void VirtualMemoryManager::free_page(virtual_addr addr) {
   }
 
   pt_entry_del_attrib(pt_entry, I86_PTE_PRESENT);
+  flush_tlb_entry(addr);
+}
+
+bool VirtualMemoryManager::map_mmio(physical_addr paddr, virtual_addr vaddr) {
+  map_page(paddr, vaddr);
+  pd_entry* entry = pdirectory_lookup_entry(cur_directory, vaddr);
+  if (!pd_entry_is_present(*entry)) return false;
+
+  // Device registers must not be cached, every access has to reach the bus.
+  page_table* table = (page_table*)PAGE_GET_TABLE_ADDRESS(entry);
+  pt_entry* page = ptable_lookup_entry(table, vaddr);
+  pt_entry_add_attrib(page, I86_PTE_NOT_CACHEABLE);
+  pt_entry_add_attrib(page, I86_PTE_WRITETHOUGH);
+  flush_tlb_entry(vaddr);
+  return true;
 }
 
 void VirtualMemoryManager::map_page(physical_addr paddr, virtual_addr vaddr) {
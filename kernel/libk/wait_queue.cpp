@@ -0,0 +1,130 @@
+#include <assert.h>
+#include <libk/irqflags.h>
+#include <libk/wait_queue.h>
+
+// All zeroes, which is empty and unlocked.
+futex_bucket Futex::buckets[FUTEX_HASH_BUCKETS];
+
+void WaitQueue::append(wait_queue_t *wq, wait_entry *entry) {
+    entry->next = 0;
+    if (wq->tail)
+        wq->tail->next = entry;
+    else
+        wq->head = entry;
+    wq->tail = entry;
+}
+
+void WaitQueue::unlink(wait_queue_t *wq, wait_entry *entry, wait_entry *prev) {
+    if (prev)
+        prev->next = entry->next;
+    else
+        wq->head = entry->next;
+    if (wq->tail == entry)
+        wq->tail = prev;
+}
+
+void WaitQueue::wakeEntry(wait_queue_t *wq, wait_entry *entry, wait_entry *prev) {
+    unlink(wq, entry, prev);
+    // The waiter may return as soon as it sees 'woken', taking 'entry' along.
+    Thread *thread = entry->thread;
+    entry->woken = true;
+    Scheduler::wake(thread);
+}
+
+void WaitQueue::prepare(wait_queue_t *wq, wait_entry *entry) {
+    entry->thread = Scheduler::getCurrent();
+    entry->key = 0;
+    entry->woken = false;
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    append(wq, entry);
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void WaitQueue::sleep(wait_entry *entry) {
+    assert(!Scheduler::isIdle());
+    uint32_t flags = local_irq_save();
+    while (!entry->woken)
+        Scheduler::block();
+    local_irq_restore(flags);
+}
+
+void WaitQueue::finish(wait_queue_t *wq, wait_entry *entry) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    if (!entry->woken) {
+        wait_entry *prev = 0;
+        for (wait_entry *e = wq->head; e != entry; e = e->next)
+            prev = e;
+        unlink(wq, entry, prev);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+bool WaitQueue::wakeOne(wait_queue_t *wq) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    wait_entry *entry = wq->head;
+    if (entry)
+        wakeEntry(wq, entry, 0);
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return entry != 0;
+}
+
+uint32_t WaitQueue::wakeAll(wait_queue_t *wq) {
+    uint32_t woken = 0;
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    while (wait_entry *entry = wq->head) {
+        wakeEntry(wq, entry, 0);
+        woken++;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return woken;
+}
+
+wait_queue_t *Futex::bucketFor(volatile uint32_t *addr) {
+    // Fibonacci hashing: the multiplication carries the low address bits,
+    // which differ the most, up into the top ones.
+    uint32_t hash = ((uint32_t)addr * 0x9E3779B9u) >> (32 - FUTEX_HASH_BITS);
+    return &buckets[hash].queue;
+}
+
+bool Futex::wait(volatile uint32_t *addr, uint32_t expected) {
+    assert(!Scheduler::isIdle());
+    wait_queue_t *wq = bucketFor(addr);
+    wait_entry entry;
+    entry.thread = Scheduler::getCurrent();
+    entry.key = (uintptr_t)addr;
+    entry.woken = false;
+
+    // A waker changes the word before it takes the bucket lock: either we
+    // see the new value here, or it sees us queued.
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    if (*addr != expected) {
+        spin_unlock_irqrestore(&wq->lock, flags);
+        return false;
+    }
+    WaitQueue::append(wq, &entry);
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    WaitQueue::sleep(&entry);
+    return true;
+}
+
+uint32_t Futex::wake(volatile uint32_t *addr, uint32_t count) {
+    wait_queue_t *wq = bucketFor(addr);
+    uint32_t woken = 0;
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    wait_entry *prev = 0;
+    wait_entry *entry = wq->head;
+    while (entry && woken < count) {
+        wait_entry *next = entry->next;
+        // Other addresses may hash to the same bucket.
+        if (entry->key == (uintptr_t)addr) {
+            WaitQueue::wakeEntry(wq, entry, prev);
+            woken++;
+        } else {
+            prev = entry;
+        }
+        entry = next;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return woken;
+}
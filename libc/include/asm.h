@@ -20,12 +20,76 @@ inline uint8_t inb(uint16_t port) {
   return ret;
 }
 
-inline void enable_interrupts(void) { asm volatile("sti"); }
+// Raw interrupt flag control. Kernel code should use the traced versions in
+// libk/irqflags.h instead.
+inline void enable_interrupts(void) { asm volatile("sti" : : : "memory"); }
 
-inline void disable_interrupts(void) { asm volatile("sti"); }
+inline void disable_interrupts(void) { asm volatile("cli" : : : "memory"); }
+
+inline uint32_t read_eflags(void) {
+  uint32_t flags;
+  asm volatile("pushf\n\tpop %0" : "=r"(flags) : : "memory");
+  return flags;
+}
+
+inline void write_eflags(uint32_t flags) {
+  asm volatile("push %0\n\tpopf" : : "r"(flags) : "memory", "cc");
+}
+
+inline uint32_t read_cr3(void) {
+  uint32_t cr3;
+  asm volatile("mov %%cr3, %0" : "=r"(cr3));
+  return cr3;
+}
+
+inline uint32_t read_cr4(void) {
+  uint32_t cr4;
+  asm volatile("mov %%cr4, %0" : "=r"(cr4));
+  return cr4;
+}
+
+// Spin-wait hint. Saves power and lets the other hyperthread run.
+inline void cpu_relax(void) { asm volatile("pause" : : : "memory"); }
 
 inline void invlpg(void* m) {
   asm volatile("invlpg (%0)" : : "b"(m) : "memory");
 }
 
+// Executes CPUID for 'leaf' (sub-leaf 0)
+inline void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx,
+                  uint32_t* edx) {
+  asm volatile("cpuid"
+               : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+               : "a"(leaf), "c"(0));
+}
+
+// Reads a model specific register
+inline uint64_t rdmsr(uint32_t msr) {
+  uint32_t lo, hi;
+  asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+// Writes a model specific register
+inline void wrmsr(uint32_t msr, uint64_t val) {
+  asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+// Reads the processor's time stamp counter
+inline uint64_t rdtsc(void) {
+  uint32_t lo, hi;
+  asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+// 64 by 32 bit division with two divl, without pulling in libgcc's __udivdi3
+inline uint64_t div64_32(uint64_t dividend, uint32_t divisor) {
+  uint32_t hi = dividend >> 32;
+  uint32_t q_hi = hi / divisor;
+  uint32_t rem = hi % divisor;
+  uint32_t q_lo;
+  asm("divl %4" : "=a"(q_lo), "=d"(rem) : "a"((uint32_t)dividend), "d"(rem), "rm"(divisor));
+  return ((uint64_t)q_hi << 32) | q_lo;
+}
+
 #endif  // _LIBC_ASM_H_
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef _LIBK_SPINLOCK_H_
+#define _LIBK_SPINLOCK_H_ 1
+
+/*
+ * Host stand-in for the kernel's libk/spinlock.h. The replay is single
+ * threaded and has no interrupt flag to save, so the locks do nothing; the
+ * kernel header's irqflags.h would not even assemble in a 64 bit process.
+ */
+
+#include <libk/lock_stats.h>
+#include <stdint.h>
+
+typedef struct spinlock {
+    volatile uint32_t tickets;
+    struct lock_stats *stats;
+} spinlock_t;
+
+#define SPINLOCK_INIT                   { 0, 0 }
+#define SPINLOCK_INIT_STATS(stats)      { 0, stats }
+
+inline void spin_lock_init(spinlock_t *lock, struct lock_stats *stats = 0) {
+    lock->tickets = 0;
+    lock->stats = stats;
+}
+
+inline void spin_lock(spinlock_t *) {}
+inline void spin_unlock(spinlock_t *) {}
+inline uint32_t spin_lock_irqsave(spinlock_t *) { return 0; }
+inline void spin_unlock_irqrestore(spinlock_t *, uint32_t) {}
+
+#endif  // _LIBK_SPINLOCK_H_
@@ -0,0 +1,222 @@
+/*
+ * heap_replay: replays a heap trace recorded by HeapTracer against the real
+ * heap code and reports how it performed.
+ *
+ * Recording: call HeapTracer::start() in the kernel, run the workload, then
+ * HeapTracer::dump(). With qemu, '-serial file:trace.txt' captures the dump.
+ *
+ * Usage:
+ *   heap_replay [-r repeat] [-s sample] trace.txt
+ *       Replays the trace 'repeat' times (default 1). Every 'sample' operations
+ *       (default 64) the hole layout is inspected for the fragmentation figures.
+ *   heap_replay -g count [seed]
+ *       Prints a synthetic trace of 'count' operations, handy as a baseline.
+ *
+ * Frees whose allocation happened before the ring buffer window are skipped,
+ * and anything still live at the end of a pass is freed before the next one.
+ */
+#include <libk/heap_mem.h>
+#include <libk/heap_trace.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "sim_vmm.h"
+
+struct TraceOp {
+  char op;
+  uint32_t size;
+  uint32_t align;
+  uint32_t tag;
+  uint32_t id;
+};
+
+struct Report {
+  std::vector<uint64_t> alloc_ns;
+  std::vector<uint64_t> free_ns;
+  uint64_t total_ns = 0;
+  uint32_t failed = 0;
+  uint32_t skipped = 0;
+  uint32_t samples = 0;
+  double frag_sum = 0;
+  double frag_max = 0;
+  uint32_t peak_heap_bytes = 0;
+  uint32_t peak_holes = 0;
+};
+
+static uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static bool load_trace(const char* path, std::vector<TraceOp>* ops) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  char line[256];
+  unsigned long long timestamp;
+  while (fgets(line, sizeof(line), file)) {
+    TraceOp op;
+    if (line[0] != 'A' && line[0] != 'F') continue;
+    if (sscanf(line, "%c %u %u %u %x %llx", &op.op, &op.size, &op.align, &op.tag,
+               &op.id, &timestamp) != 6)
+      continue;
+    if (op.tag >= HEAP_TAG_COUNT) op.tag = HEAP_TAG_GENERAL;
+    ops->push_back(op);
+  }
+  fclose(file);
+  return true;
+}
+
+static void sample(HeapMemoryManager* heap, Report* report) {
+  heap_frag_stats_t stats;
+  heap->getFragmentation(&stats);
+  double frag = stats.free_bytes ? 1.0 - (double)stats.largest_hole / stats.free_bytes : 0;
+  report->samples++;
+  report->frag_sum += frag;
+  report->frag_max = std::max(report->frag_max, frag);
+  report->peak_heap_bytes = std::max(report->peak_heap_bytes, stats.heap_bytes);
+  report->peak_holes = std::max(report->peak_holes, stats.holes);
+}
+
+static void replay(HeapMemoryManager* heap, const std::vector<TraceOp>& ops,
+                   uint32_t sample_every, Report* report) {
+  std::unordered_map<uint32_t, void*> live;
+  uint64_t start = now_ns();
+  for (size_t i = 0; i < ops.size(); i++) {
+    const TraceOp& op = ops[i];
+    if (op.op == 'A') {
+      uint64_t t0 = now_ns();
+      void* p = heap->alloc(op.size, op.align, (heap_tag)op.tag);
+      report->alloc_ns.push_back(now_ns() - t0);
+      if (!p) {
+        report->failed++;
+        continue;
+      }
+      // An id that is still live means its free fell out of the ring; drop it.
+      auto old = live.find(op.id);
+      if (old != live.end()) heap->free(old->second);
+      live[op.id] = p;
+    } else {
+      auto it = live.find(op.id);
+      if (it == live.end()) {
+        report->skipped++;
+        continue;
+      }
+      uint64_t t0 = now_ns();
+      heap->free(it->second);
+      report->free_ns.push_back(now_ns() - t0);
+      live.erase(it);
+    }
+    if (sample_every && i % sample_every == 0) sample(heap, report);
+  }
+  report->total_ns += now_ns() - start;
+  sample(heap, report);
+  for (auto& entry : live) heap->free(entry.second);
+}
+
+static uint64_t percentile(std::vector<uint64_t>& values, double p) {
+  if (values.empty()) return 0;
+  size_t index = (size_t)(p * (values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+static void print_latency(const char* name, std::vector<uint64_t>& values) {
+  printf("%-6s %9zu ops  p50 %6llu ns  p90 %6llu ns  p99 %6llu ns  max %8llu ns\n",
+         name, values.size(), (unsigned long long)percentile(values, 0.50),
+         (unsigned long long)percentile(values, 0.90),
+         (unsigned long long)percentile(values, 0.99),
+         (unsigned long long)percentile(values, 1.0));
+}
+
+static void generate(uint32_t count, uint32_t seed) {
+  // A mix of long lived and short lived objects with a skewed size distribution,
+  // roughly what drivers and bookkeeping structures look like.
+  srand(seed);
+  std::vector<uint32_t> live;
+  uint32_t next_id = 0x1000;
+  printf("# openos heap trace v1\n# records %u dropped 0\n", count);
+  for (uint32_t i = 0; i < count; i++) {
+    bool do_free = !live.empty() && (rand() % 100) < 45;
+    if (do_free) {
+      size_t victim = rand() % live.size();
+      printf("F 0 0 0 0x%x 0x%x\n", live[victim], i);
+      live[victim] = live.back();
+      live.pop_back();
+    } else {
+      uint32_t shift = 3 + rand() % 10;
+      uint32_t size = (1u << shift) + rand() % (1u << shift);
+      uint32_t align = (rand() % 50) == 0;
+      printf("A %u %u %u 0x%x 0x%x\n", size, align, rand() % HEAP_TAG_COUNT, next_id, i);
+      live.push_back(next_id);
+      next_id += 0x10;
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  uint32_t repeat = 1;
+  uint32_t sample_every = 64;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:s:g:")) != -1) {
+    switch (opt) {
+      case 'r':
+        repeat = atoi(optarg);
+        break;
+      case 's':
+        sample_every = atoi(optarg);
+        break;
+      case 'g':
+        generate(atoi(optarg), optind < argc ? atoi(argv[optind]) : 1);
+        return 0;
+      default:
+        fprintf(stderr, "usage: %s [-r repeat] [-s sample] trace.txt | -g count [seed]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "usage: %s [-r repeat] [-s sample] trace.txt | -g count [seed]\n", argv[0]);
+    return 2;
+  }
+
+  std::vector<TraceOp> ops;
+  if (!load_trace(argv[optind], &ops)) return 1;
+
+  // Index entries are pointers, twice as wide on a 64 bit host. Grow the
+  // initial block by the difference so the first hole has its kernel size.
+  static VirtualMemoryManager vmm(0);
+  static HeapMemoryManager heap(&vmm, HEAP_VIRT_ADDR_START,
+                                HEAP_VIRT_ADDR_START + HEAP_INITIAL_BLOCK_SIZE +
+                                    (sizeof(void*) - sizeof(uint32_t)) * HEAP_INDEX_SIZE,
+                                HEAP_MAX_ADDR, false, false);
+
+  Report report;
+  for (uint32_t pass = 0; pass < repeat; pass++) replay(&heap, ops, sample_every, &report);
+
+  size_t total_ops = report.alloc_ns.size() + report.free_ns.size();
+  printf("trace: %zu records, %u passes\n", ops.size(), repeat);
+  printf("throughput: %.0f ops/s (%.3f ms total)\n",
+         report.total_ns ? total_ops * 1e9 / report.total_ns : 0.0, report.total_ns / 1e6);
+  print_latency("alloc", report.alloc_ns);
+  print_latency("free", report.free_ns);
+  printf("failed allocs: %u, skipped frees: %u\n", report.failed, report.skipped);
+  printf("fragmentation: mean %.3f max %.3f over %u samples\n",
+         report.samples ? report.frag_sum / report.samples : 0.0, report.frag_max,
+         report.samples);
+  printf("peak hole heap: %u bytes, peak holes: %u\n", report.peak_heap_bytes, report.peak_holes);
+  printf("pages: peak %u mapped, %u double mapped\n", sim_vmm_stats.peak_mapped_pages,
+         sim_vmm_stats.double_maps);
+  heap.printStats();
+  return 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * Simulated page allocator for the host build of the heap. It stands in for
+ * kernel/libk/virt_mem.cpp: alloc_page maps one anonymous host page at the
+ * requested address and free_page unmaps it, so the heap runs on exactly the
+ * addresses it would use in the kernel.
+ */
+#include "sim_vmm.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+sim_vmm_stats_t sim_vmm_stats;
+
+VirtualMemoryManager::VirtualMemoryManager(PhysicalMemoryManager* pmm) {
+  physicalMemoryManager = pmm;
+  cur_directory = 0;
+}
+
+bool VirtualMemoryManager::alloc_page(virtual_addr addr) {
+  void* page = mmap((void*)(uintptr_t)addr, PAGE_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  if (page == MAP_FAILED) {
+    if (errno != EEXIST) return false;
+    // The kernel would silently leak a frame here, count it instead.
+    sim_vmm_stats.double_maps++;
+    return true;
+  }
+  sim_vmm_stats.mapped_pages++;
+  if (sim_vmm_stats.mapped_pages > sim_vmm_stats.peak_mapped_pages)
+    sim_vmm_stats.peak_mapped_pages = sim_vmm_stats.mapped_pages;
+  return true;
+}
+
+void VirtualMemoryManager::free_page(virtual_addr addr) {
+  munmap((void*)(uintptr_t)addr, PAGE_SIZE);
+  sim_vmm_stats.mapped_pages--;
+}
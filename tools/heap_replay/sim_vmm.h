@@ -0,0 +1,15 @@
+#ifndef _HEAP_REPLAY_SIM_VMM_H_
+#define _HEAP_REPLAY_SIM_VMM_H_
+
+#include <libk/virt_mem.h>
+
+/* Page usage as seen by the simulated page allocator. */
+typedef struct {
+  uint32_t mapped_pages;       /* Pages currently mapped. */
+  uint32_t peak_mapped_pages;  /* Most pages ever mapped at once. */
+  uint32_t double_maps;        /* alloc_page calls on an already mapped page. */
+} sim_vmm_stats_t;
+
+extern sim_vmm_stats_t sim_vmm_stats;
+
+#endif  // _HEAP_REPLAY_SIM_VMM_H_